@@ -0,0 +1,343 @@
+#ifndef BELADY_H
+#define BELADY_H
+
+/**
+ * Belady's optimal (MIN) replacement, replayed offline over a trace
+ * recorded with `cslab_cache -record`, as the upper bound of what any
+ * replacement policy can do for a configuration (`cache_replay -opt`).
+ * Include after cache.h, cache_sim.h and trace.h.
+ *
+ * MIN needs the future: NEXT_USES numbers the references of the trace
+ * 0..n-1 and gives, for every reference, the number of the next one to the
+ * same block (of one block size), computed in a single backward pass over
+ * the trace. They take 8 bytes per reference; traces with more references
+ * than fit in one chunk keep them in an unlinked temporary file, written
+ * and read back one chunk at a time.
+ *
+ * OPT_CACHE is the TWO_LEVEL_CACHE hierarchy (latencies, store allocation,
+ * inclusive L2) with both levels evicting the line used furthest in the
+ * future. Both levels look at the whole reference stream, so a line that
+ * keeps hitting in L1 stays valuable in L2, where inclusion needs it: the
+ * L2 is the usual MIN bound and not an optimum for the L1 miss stream.
+ * Prefetchers are not modeled.
+ **/
+
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+
+class NEXT_USES
+{
+    public:
+    static const UINT64 NEVER = UINT64(-1);
+
+    private:
+    UINT64 _numRefs;
+    UINT64 _chunkRefs;
+    std::vector<UINT64> _memory; // all of them, if they fit in one chunk
+    FILE *_file;                 // the chunks otherwise
+
+    NEXT_USES(const NEXT_USES &);            // not copyable
+    NEXT_USES &operator=(const NEXT_USES &);
+
+    UINT64 ChunkSize(UINT64 start) const { return std::min(_chunkRefs, _numRefs - start); }
+
+    bool WriteChunk(const std::vector<UINT64> &chunk, UINT64 start)
+    {
+        const size_t bytes = ChunkSize(start) * sizeof(UINT64);
+        return pwrite(fileno(_file), &chunk[0], bytes, start * sizeof(UINT64)) == ssize_t(bytes);
+    }
+
+    public:
+    NEXT_USES() : _numRefs(0), _chunkRefs(0), _file(NULL) {}
+    ~NEXT_USES()
+    {
+        if (_file)
+            fclose(_file);
+    }
+
+    UINT64 NumRefs() const { return _numRefs; }
+    bool InMemory() const { return !_file; }
+
+    /**
+     * Computes the next uses of `blockSize` byte blocks in the trace at
+     * `data`, keeping at most `chunkRefs` of them in memory. Returns false
+     * if the temporary file cannot be written.
+     **/
+    bool Build(const VOID *data, UINT64 size, UINT32 blockSize, UINT64 chunkRefs)
+    {
+        const UINT32 lineShift = FloorLog2(blockSize);
+        TRACE_READER reader;
+        reader.Init(data, size);
+        std::vector<MEMREF> refs(reader.Header().blockRefs);
+
+        // Blocks of the trace decode independently, so they are visited
+        // backwards from their offsets
+        std::vector<UINT64> offsets;
+        _numRefs = 0;
+        for (;;) {
+            const UINT64 offset = reader.Offset();
+            const UINT32 n = reader.NextBlock(&refs[0]);
+            if (!n)
+                break;
+            offsets.push_back(offset);
+            _numRefs += n;
+        }
+
+        _chunkRefs = std::max(chunkRefs, UINT64(1));
+        std::vector<UINT64> chunk;
+        if (_numRefs <= _chunkRefs) {
+            _memory.resize(_numRefs);
+        } else {
+            _file = tmpfile();
+            if (!_file)
+                return false;
+            chunk.resize(_chunkRefs);
+        }
+        std::vector<UINT64> &out = _file ? chunk : _memory;
+
+        // block -> number of its next reference + 1, 0 if none
+        BLOCK_MAP<UINT64> next;
+        UINT64 i = _numRefs;
+        UINT64 start = _file && _numRefs ? (_numRefs - 1) / _chunkRefs * _chunkRefs : 0;
+        for (UINT64 b = offsets.size(); b-- > 0; ) {
+            reader.Seek(offsets[b]);
+            const UINT32 n = reader.NextBlock(&refs[0]);
+            for (UINT32 r = n; r-- > 0; ) {
+                i--;
+                if (i < start) {
+                    if (!WriteChunk(chunk, start))
+                        return false;
+                    start -= _chunkRefs;
+                }
+                UINT64 &slot = next[refs[r].addr >> lineShift];
+                out[i - start] = slot ? slot - 1 : UINT64(NEVER);
+                slot = i + 1;
+            }
+        }
+        return !_file || WriteChunk(chunk, 0);
+    }
+
+    /**
+     * Reads the next uses back in reference order, one chunk at a time.
+     * Each reader has its own chunk, so models replayed by different
+     * threads may share the NEXT_USES.
+     **/
+    class CURSOR
+    {
+        private:
+        const NEXT_USES &_uses;
+        std::vector<UINT64> _chunk;
+        UINT64 _start, _end; // references in _chunk
+
+        public:
+        CURSOR(const NEXT_USES &uses) : _uses(uses), _start(0), _end(0) {}
+
+        // Next use of reference i; i never decreases
+        UINT64 operator[](UINT64 i)
+        {
+            ASSERTX(i < _uses._numRefs);
+            if (!_uses._file)
+                return _uses._memory[i];
+            if (i >= _end) {
+                _start = i / _uses._chunkRefs * _uses._chunkRefs;
+                _end = _start + _uses.ChunkSize(_start);
+                _chunk.resize(_uses._chunkRefs);
+                const size_t bytes = (_end - _start) * sizeof(UINT64);
+                const ssize_t read = pread(fileno(_uses._file), &_chunk[0], bytes,
+                                           _start * sizeof(UINT64));
+                ASSERTX(read == ssize_t(bytes));
+                (VOID)read;
+            }
+            return _chunk[i - _start];
+        }
+    };
+};
+
+class OPT_CACHE
+{
+    public:
+    typedef enum
+    {
+        ACCESS_TYPE_LOAD,
+        ACCESS_TYPE_STORE,
+        ACCESS_TYPE_NUM
+    } ACCESS_TYPE;
+
+    private:
+    static const ADDRINT EMPTY = ADDRINT(-1);
+    static const UINT32 HIT_MISS_NUM = 2;
+
+    /**
+     * One level: the blocks held by each set, with the number of their
+     * next reference. Blocks are kept whole (tag and set bits), EMPTY for
+     * invalid ways.
+     **/
+    struct LEVEL
+    {
+        UINT32 size, blockSize, assoc;
+        UINT32 lineShift, setMask;
+        std::vector<ADDRINT> blocks;
+        std::vector<UINT64> nextUses;
+
+        VOID Init(UINT32 cacheSize, UINT32 blockSz, UINT32 associativity)
+        {
+            size = cacheSize;
+            blockSize = blockSz;
+            assoc = associativity;
+            lineShift = FloorLog2(blockSize);
+            setMask = cacheSize / (associativity * blockSize) - 1;
+            blocks.assign(size_t(setMask + 1) * assoc, ADDRINT(EMPTY));
+            nextUses.assign(blocks.size(), UINT64(NEXT_USES::NEVER));
+        }
+
+        UINT32 First(ADDRINT block) const { return (UINT32(block) & setMask) * assoc; }
+
+        // On a hit, records the new next use of `block`
+        bool Find(ADDRINT block, UINT64 nextUse)
+        {
+            const UINT32 first = First(block);
+            for (UINT32 w = first; w < first + assoc; w++)
+                if (blocks[w] == block) {
+                    nextUses[w] = nextUse;
+                    return true;
+                }
+            return false;
+        }
+
+        // Fills a missing block into an invalid way or over the block used
+        // last; returns the evicted block, EMPTY if none
+        ADDRINT Replace(ADDRINT block, UINT64 nextUse)
+        {
+            const UINT32 first = First(block);
+            UINT32 victim = first;
+            for (UINT32 w = first; w < first + assoc; w++) {
+                if (blocks[w] == EMPTY) {
+                    victim = w;
+                    break;
+                }
+                if (nextUses[w] > nextUses[victim])
+                    victim = w;
+            }
+            const ADDRINT replaced = blocks[victim];
+            blocks[victim] = block;
+            nextUses[victim] = nextUse;
+            return replaced;
+        }
+
+        VOID DeleteIfPresent(ADDRINT block)
+        {
+            const UINT32 first = First(block);
+            for (UINT32 w = first; w < first + assoc; w++)
+                if (blocks[w] == block) {
+                    blocks[w] = EMPTY;
+                    nextUses[w] = NEXT_USES::NEVER;
+                }
+        }
+    };
+
+    CACHE_STATS _l1_access[ACCESS_TYPE_NUM][HIT_MISS_NUM];
+    CACHE_STATS _l2_access[ACCESS_TYPE_NUM][HIT_MISS_NUM];
+    UINT32 _latencies[3];
+
+    LEVEL _l1, _l2;
+    NEXT_USES::CURSOR _l1NextUses, _l2NextUses;
+    UINT64 _index; // of the next reference
+
+    const std::string _name;
+
+    public:
+    /**
+     * `l1NextUses` and `l2NextUses` are of the L1 and L2 block sizes in
+     * the trace to be replayed.
+     **/
+    OPT_CACHE(std::string name, const CACHE_CONFIG &config,
+              const NEXT_USES &l1NextUses, const NEXT_USES &l2NextUses,
+              UINT32 l1HitLatency = 1, UINT32 l2HitLatency = 10,
+              UINT32 l2MissLatency = 150)
+        : _l1NextUses(l1NextUses), _l2NextUses(l2NextUses), _index(0), _name(name)
+    {
+        _l1.Init(config.l1Size * KILO, config.l1Block, config.l1Assoc);
+        _l2.Init(config.l2Size * KILO, config.l2Block, config.l2Assoc);
+        _latencies[0] = l1HitLatency;
+        _latencies[1] = l2HitLatency;
+        _latencies[2] = l2MissLatency;
+        memset(_l1_access, 0, sizeof(_l1_access));
+        memset(_l2_access, 0, sizeof(_l2_access));
+    }
+
+    // Returns the cycles to serve the request; the PC is not needed
+    UINT32 Access(ADDRINT addr, ACCESS_TYPE accessType, ADDRINT = 0, UINT32 = 0)
+    {
+        const UINT64 index = _index++;
+        const ADDRINT l1Block = addr >> _l1.lineShift;
+        const ADDRINT l2Block = addr >> _l2.lineShift;
+        const UINT64 l1NextUse = _l1NextUses[index];
+        const UINT64 l2NextUse = _l2NextUses[index];
+
+        const bool l1Hit = _l1.Find(l1Block, l1NextUse);
+        _l1_access[accessType][l1Hit]++;
+        UINT32 cycles = _latencies[0];
+
+        if (l1Hit) {
+            // The L2 copy is referenced too, keep its next use current
+            _l2.Find(l2Block, l2NextUse);
+            return cycles;
+        }
+
+        if (accessType == ACCESS_TYPE_LOAD || STORE_ALLOCATION == STORE_ALLOCATE)
+            _l1.Replace(l1Block, l1NextUse);
+
+        const bool l2Hit = _l2.Find(l2Block, l2NextUse);
+        _l2_access[accessType][l2Hit]++;
+        cycles += _latencies[1];
+
+        if (!l2Hit) {
+            cycles += _latencies[2];
+            const ADDRINT replaced = _l2.Replace(l2Block, l2NextUse);
+            if (L2_INCLUSIVE == 1 && replaced != EMPTY) {
+                const ADDRINT first = replaced << (_l2.lineShift - _l1.lineShift);
+                for (UINT32 i = 0; i < _l2.blockSize / _l1.blockSize; i++)
+                    _l1.DeleteIfPresent(first + i);
+            }
+        }
+        return cycles;
+    }
+
+    string StatsLong(string prefix = "") const
+    {
+        return LevelStatsLong(prefix, "L1", _l1_access) +
+               LevelStatsLong(prefix, "L2", _l2_access);
+    }
+
+    string PrintCache(string prefix = "") const
+    {
+        string out;
+
+        out += prefix + _name + ":\n";
+        out += prefix + "  L1-Data Cache:\n";
+        out += prefix + "    Size(KB):       " + dec2str(_l1.size/KILO, 5) + "\n";
+        out += prefix + "    Block Size(B):  " + dec2str(_l1.blockSize, 5) + "\n";
+        out += prefix + "    Associativity:  " + dec2str(_l1.assoc, 5) + "\n";
+        out += prefix + "\n";
+        out += prefix + "  L2-Data Cache:\n";
+        out += prefix + "    Size(KB):       " + dec2str(_l2.size/KILO, 5) + "\n";
+        out += prefix + "    Block Size(B):  " + dec2str(_l2.blockSize, 5) + "\n";
+        out += prefix + "    Associativity:  " + dec2str(_l2.assoc, 5) + "\n";
+        out += prefix + "\n";
+
+        out += prefix + "Latencies: " + dec2str(_latencies[0], 4) + " "
+            + dec2str(_latencies[1], 4) + " "
+            + dec2str(_latencies[2], 4) + "\n";
+        out += prefix + "L1-Sets: OPT assoc: " + dec2str(_l1.assoc, 3) + "\n";
+        out += prefix + "L2-Sets: OPT assoc: " + dec2str(_l2.assoc, 3) + "\n";
+        out += prefix + "Store_allocation: " + (STORE_ALLOCATION == STORE_ALLOCATE ? "Yes" : "No") + "\n";
+        out += prefix + "L2_inclusive: " + (L2_INCLUSIVE == 1 ? "Yes" : "No") + "\n";
+        out += "\n";
+
+        return out;
+    }
+};
+
+#endif // BELADY_H
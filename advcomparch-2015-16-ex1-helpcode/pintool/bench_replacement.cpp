@@ -0,0 +1,91 @@
+/**
+ * Microbenchmark of the cache.h replacement policies.
+ *
+ * For associativities 4, 8 and 16 it drives an L2-sized set of every
+ * policy with the same stream of random (set, tag) accesses, skewed so
+ * that a few tags of each set are hot, calling Replace() on every miss as
+ * TWO_LEVEL_CACHE does. It prints accesses per second and the miss ratio,
+ * with a runtime associativity ("dyn") and with the associativity fixed
+ * at compile time ("static").
+ *
+ *   $ make bench_replacement && ./bench_replacement
+ **/
+#include "pin_compat.h"
+
+#include <cstdio>
+#include <sys/time.h>
+
+#include "cache.h"
+#include "host_check.h"
+
+static const UINT32 NUM_SETS = 4096;
+static const UINT32 NUM_ACCESSES = 1 << 20;
+static const UINT32 ROUNDS = 16;
+
+static UINT64 rng_state = 0x9e3779b97f4a7c15ULL;
+static UINT64 Rand64() { return Rand64(rng_state); }
+
+static double Now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+template <class SET>
+static VOID Time(UINT32 associativity, bool isStatic,
+                 const std::vector<UINT32> &qset, const std::vector<CACHE_TAG> &qtag)
+{
+    SET sets;
+    sets.Init(NUM_SETS, associativity);
+
+    UINT64 misses = 0;
+    double start = Now();
+    for (UINT32 r = 0; r < ROUNDS; r++)
+        for (UINT32 q = 0; q < NUM_ACCESSES; q++)
+            if (!sets.Find(qset[q], qtag[q])) {
+                sets.Replace(qset[q], qtag[q]);
+                misses++;
+            }
+    double secs = Now() - start;
+
+    printf("assoc %2u  %-5s %-6s %8.1f Maccesses/s  miss ratio %5.2f%%\n",
+           associativity, sets.Name().c_str(), isStatic ? "static" : "dyn",
+           (double)ROUNDS * NUM_ACCESSES / secs / 1e6,
+           100.0 * misses / ((double)ROUNDS * NUM_ACCESSES));
+}
+
+template <template <UINT32> class POLICY, UINT32 ASSOC>
+static VOID TimePolicy(const std::vector<UINT32> &qset, const std::vector<CACHE_TAG> &qtag)
+{
+    Time<POLICY<0> >(ASSOC, false, qset, qtag);
+    Time<POLICY<ASSOC> >(ASSOC, true, qset, qtag);
+}
+
+template <UINT32 ASSOC>
+static VOID Bench()
+{
+    // Tags 0 .. 2 * ASSOC - 1 of each set, the smaller ones more often
+    std::vector<UINT32> qset(NUM_ACCESSES);
+    std::vector<CACHE_TAG> qtag(NUM_ACCESSES);
+    for (UINT32 q = 0; q < NUM_ACCESSES; q++) {
+        qset[q] = Rand64() % NUM_SETS;
+        qtag[q] = CACHE_TAG(Rand64() % (1 + Rand64() % (2 * ASSOC)));
+    }
+
+    TimePolicy<CACHE_SET::LRU_T, ASSOC>(qset, qtag);
+    TimePolicy<CACHE_SET::PLRU_T, ASSOC>(qset, qtag);
+    TimePolicy<CACHE_SET::NRU_T, ASSOC>(qset, qtag);
+    TimePolicy<CACHE_SET::LFU_T, ASSOC>(qset, qtag);
+    TimePolicy<CACHE_SET::LRFU_T, ASSOC>(qset, qtag);
+    printf("\n");
+}
+
+int main()
+{
+    printf("Host tag match kernel: %s\n\n", TAG_MATCH::IsaName(TAG_MATCH::HostIsa()));
+    Bench<4>();
+    Bench<8>();
+    Bench<16>();
+    return 0;
+}
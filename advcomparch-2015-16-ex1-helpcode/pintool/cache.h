@@ -2,13 +2,17 @@
 #define CACHE_H
 
 #include <algorithm>
+#include <map>
+#include <vector>
 #include <iostream>  // std::cout ...
 #include <sstream>   // ostringstream type
-#include <cstdlib>   // rand()
+#include <cstdlib>   // rand(), posix_memalign()
+#include <cstring>   // memset()
+#include <cstdio>    // sscanf()
 #include <time.h>    // for random seed
 
 /*****************************************************************************/
-/* Policy about L2 inclusion of L1's content                                 */
+/* Policy about L2 inclusion of L1's content (the default of INCLUSION)      */
 /*****************************************************************************/
 #ifndef L2_INCLUSIVE
 #  define L2_INCLUSIVE 1
@@ -37,7 +41,7 @@ typedef UINT64 CACHE_STATS; // type of cache hit/miss counters
 /**
  * decimal - string conversion
  **/
-static string dec2str(UINT64 v, UINT32 w)
+static inline string dec2str(UINT64 v, UINT32 w)
 {
     ostringstream o;
     o.width(w);
@@ -90,209 +94,3939 @@ class CACHE_TAG
 };
 CACHE_TAG INVALID_TAG(-1);
 
+/**
+ * Allocates an array of `n` elements aligned to a host cache line, so that
+ * a whole cache set (or its metadata) never straddles more lines than needed.
+ * Release with free().
+ **/
+#define HOST_CACHE_LINE 64
+template <class T>
+static T *AlignedAlloc(UINT64 n)
+{
+    VOID *ptr = NULL;
+    if (n == 0) n = 1;
+    if (posix_memalign(&ptr, HOST_CACHE_LINE, n * sizeof(T)) != 0)
+        ptr = NULL;
+    ASSERTX(ptr != NULL);
+    return static_cast<T *>(ptr);
+}
+
+/*****************************************************************************/
+/* Vectorized tag matching                                                   */
+/*****************************************************************************/
+// The SIMD kernels compare 64-bit tags and need per-function target
+// attributes, so they are only built on x86-64 with gcc >= 4.9 / clang.
+#if defined(__x86_64__) && (defined(__clang__) || __GNUC__ > 4 || \
+                            (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#  define CACHE_SIMD 1
+#  include <immintrin.h>
+#  include <cpuid.h>
+#else
+#  define CACHE_SIMD 0
+#endif
+
+/**
+ * Tag comparison kernels. Each one returns the index of the first of the
+ * `n` tags in `ways` equal to `tag`, or -1. The vector kernels compare a
+ * whole set of up to 16 ways before branching, collecting one movemask bit
+ * per way. The best kernel is picked once at startup through CPUID.
+ * A non-zero template argument N fixes the number of ways at compile time
+ * (and `n` is ignored) so that the compare loops are fully unrolled.
+ **/
+namespace TAG_MATCH
+{
+    typedef enum {
+        SCALAR = 0,
+        SSE42,
+        AVX2,
+        ISA_NUM
+    } ISA;
+
+    static inline const char *IsaName(ISA isa)
+    {
+        static const char *names[ISA_NUM] = { "scalar", "sse4.2", "avx2" };
+        return names[isa];
+    }
+
+    template <UINT32 N>
+    static inline INT32 FindScalar(const CACHE_TAG *ways, UINT32 n, CACHE_TAG tag)
+    {
+        if (N) n = N;
+        for (UINT32 w = 0; w < n; w++)
+            if (ways[w] == tag)
+                return w;
+        return -1;
+    }
+
+#if CACHE_SIMD
+    // n must be a multiple of 2
+    template <UINT32 N>
+    __attribute__((target("sse4.2")))
+    static INT32 FindSse42(const CACHE_TAG *ways, UINT32 n, CACHE_TAG tag)
+    {
+        if (N) n = N;
+        const __m128i key = _mm_set1_epi64x((long long)ADDRINT(tag));
+        for (UINT32 base = 0; base < n; base += 16) {
+            const UINT32 end = std::min(n, base + 16);
+            UINT32 mask = 0;
+            for (UINT32 w = base; w < end; w += 2) {
+                __m128i v = _mm_loadu_si128((const __m128i *)(ways + w));
+                __m128i eq = _mm_cmpeq_epi64(v, key);
+                mask |= (UINT32)_mm_movemask_pd(_mm_castsi128_pd(eq)) << (w - base);
+            }
+            if (mask)
+                return base + __builtin_ctz(mask);
+        }
+        return -1;
+    }
+
+    // n must be a multiple of 4
+    template <UINT32 N>
+    __attribute__((target("avx2")))
+    static INT32 FindAvx2(const CACHE_TAG *ways, UINT32 n, CACHE_TAG tag)
+    {
+        if (N) n = N;
+        const __m256i key = _mm256_set1_epi64x((long long)ADDRINT(tag));
+        for (UINT32 base = 0; base < n; base += 16) {
+            const UINT32 end = std::min(n, base + 16);
+            UINT32 mask = 0;
+            for (UINT32 w = base; w < end; w += 4) {
+                __m256i v = _mm256_loadu_si256((const __m256i *)(ways + w));
+                __m256i eq = _mm256_cmpeq_epi64(v, key);
+                mask |= (UINT32)_mm256_movemask_pd(_mm256_castsi256_pd(eq)) << (w - base);
+            }
+            if (mask)
+                return base + __builtin_ctz(mask);
+        }
+        return -1;
+    }
+
+    static inline ISA DetectIsa()
+    {
+        UINT32 eax, ebx, ecx, edx;
+        if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+            return SCALAR;
+
+        const bool sse42 = ecx & bit_SSE4_2;
+        const bool osxsave = ecx & bit_OSXSAVE;
+        const bool avx = ecx & bit_AVX;
+        if (!sse42)
+            return SCALAR;
+        if (!osxsave || !avx || __get_cpuid_max(0, NULL) < 7)
+            return SSE42;
+
+        // The OS must save the YMM state for AVX2 to be usable
+        UINT32 xcr0, xcr0_hi;
+        __asm__ ("xgetbv" : "=a" (xcr0), "=d" (xcr0_hi) : "c" (0));
+        if ((xcr0 & 0x6) != 0x6)
+            return SSE42;
+
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        return (ebx & bit_AVX2) ? AVX2 : SSE42;
+    }
+#else
+    static inline ISA DetectIsa() { return SCALAR; }
+#endif
+
+    // Best instruction set supported by the host, probed on first use
+    static inline ISA HostIsa()
+    {
+        static const ISA isa = DetectIsa();
+        return isa;
+    }
+
+    // Best kernel usable by `isa` for sets of `associativity` ways
+    static inline ISA Select(ISA isa, UINT32 associativity)
+    {
+        if (isa >= AVX2 && associativity % 4 == 0)
+            return AVX2;
+        if (isa >= SSE42 && associativity % 2 == 0)
+            return SSE42;
+        return SCALAR;
+    }
+
+    template <UINT32 N>
+    static inline INT32 Find(ISA kernel, const CACHE_TAG *ways, UINT32 n,
+                             CACHE_TAG tag)
+    {
+        switch (kernel) {
+#if CACHE_SIMD
+            case AVX2:  return FindAvx2<N>(ways, n, tag);
+            case SSE42: return FindSse42<N>(ways, n, tag);
+#endif
+            default:    return FindScalar<N>(ways, n, tag);
+        }
+    }
+} // namespace TAG_MATCH
+
 /**
  * Everything related to cache sets
+ *
+ * A SET policy object holds all the sets of one cache level. Tags live in a
+ * single flat array (see TAG_STORE) and every policy keeps its per-way
+ * replacement metadata in compact arrays parallel to it.
+ *
+ * Every policy is a class template over ASSOC, the associativity fixed at
+ * compile time (0 means it is only known at runtime), with a typedef for
+ * the runtime version (e.g. `typedef LRU_T<> LRU`) and a `rebind<A>::type`
+ * member that TWO_LEVEL_CACHE uses to specialize it. Policies provide:
+ *   VOID      Init(UINT32 numSets, UINT32 associativity);
+ *   UINT32    Find(UINT32 set, CACHE_TAG tag);    // hit? (updates metadata)
+ *   CACHE_TAG Replace(UINT32 set, CACHE_TAG tag); // returns victim or INVALID_TAG
+ *   VOID      DeleteIfPresent(UINT32 set, CACHE_TAG tag);
+ *   INT32     Way(UINT32 set, CACHE_TAG tag);     // way of tag, -1 if absent
+ *   string    Name() const;
+ *   UINT32    GetAssociativity() const;
+ * TAG_STORE supplies defaults for the optional members, which PC-aware
+ * policies and policies with state shared by all their sets (e.g. DRRIP's
+ * PSEL) override:
+ *   VOID      SetPc(ADDRINT pc);  // instruction of the next Find/Replace
+ *   VOID      ResetStats();
+ *   VOID      AddStats(const POLICY &other);
+ *   string    StatsLong(const string &prefix, const string &level) const;
+ *   static bool SetsIndependent(); // may the sets be simulated apart?
+ *   static bool Supports(UINT32 associativity); // can it have that many ways?
  **/
 namespace CACHE_SET
 {
 
-    class LRU
+    /**
+     * Flat tag storage shared by all policies. Set `s` occupies the
+     * `associativity` consecutive slots starting at `s * associativity` of
+     * one cache-line-aligned array. Empty ways hold INVALID_TAG.
+     **/
+    template <UINT32 ASSOC = 0>
+    class TAG_STORE
+    {
+        protected:
+        CACHE_TAG *_tags;
+        UINT32 _numSets;
+        UINT32 _associativity;
+        TAG_MATCH::ISA _match; // tag compare kernel for this associativity
+
+        TAG_STORE()
+            : _tags(NULL), _numSets(0), _associativity(0),
+              _match(TAG_MATCH::SCALAR) {}
+        ~TAG_STORE() { free(_tags); }
+
+        VOID Init(UINT32 numSets, UINT32 associativity)
+        {
+            ASSERTX(ASSOC == 0 || ASSOC == associativity);
+            free(_tags);
+            _numSets = numSets;
+            _associativity = associativity;
+            _match = TAG_MATCH::Select(TAG_MATCH::HostIsa(), associativity);
+            _tags = AlignedAlloc<CACHE_TAG>((UINT64)numSets * associativity);
+            for (UINT64 i = 0; i < (UINT64)numSets * associativity; i++)
+                _tags[i] = INVALID_TAG;
+        }
+
+        // Ways per set; a constant when the associativity is static.
+        UINT32 Ways() const { return ASSOC ? ASSOC : _associativity; }
+        UINT32 Base(UINT32 set) const { return set * Ways(); }
+
+        // Returns the way of `set` holding `tag`, -1 if not present.
+        INT32 FindWay(UINT32 set, CACHE_TAG tag) const
+        {
+            return TAG_MATCH::Find<ASSOC>(_match, _tags + Base(set), _associativity, tag);
+        }
+
+        // Returns the first empty way of `set`, -1 if the set is full.
+        INT32 FindInvalidWay(UINT32 set) const
+        {
+            return FindWay(set, INVALID_TAG);
+        }
+
+        private:
+        TAG_STORE(const TAG_STORE &);            // not copyable
+        TAG_STORE &operator=(const TAG_STORE &);
+
+        public:
+        UINT32 GetAssociativity() const { return Ways(); }
+        UINT32 NumSets() const { return _numSets; }
+
+        VOID SetPc(ADDRINT) {}
+        VOID ResetStats() {}
+        VOID AddStats(const TAG_STORE &) {}
+        string StatsLong(const string &, const string &) const { return ""; }
+        static bool SetsIndependent() { return true; }
+        static bool Supports(UINT32) { return true; }
+
+        // For per-line state kept outside the policy (no metadata update)
+        INT32 Way(UINT32 set, CACHE_TAG tag) const { return FindWay(set, tag); }
+        CACHE_TAG TagAt(UINT32 set, UINT32 way) const { return _tags[Base(set) + way]; }
+        const char *MatchKernel() const { return TAG_MATCH::IsaName(_match); }
+    };
+
+    /**
+     * True LRU. Each way carries its recency rank (0 = MRU,
+     * associativity - 1 = LRU) in one byte; the ranks of a set are always
+     * a permutation and empty ways are kept older than all valid ones.
+     **/
+    template <UINT32 ASSOC = 0>
+    class LRU_T : public TAG_STORE<ASSOC>
+    {
+        protected:
+        typedef TAG_STORE<ASSOC> STORE;
+        using STORE::_tags;
+        using STORE::Ways;
+        using STORE::Base;
+        using STORE::FindWay;
+        using STORE::FindInvalidWay;
+        UINT8 *_ages;
+
+        // Locals keep the byte stores from aliasing the member fields.
+        VOID Touch(UINT32 base, UINT32 way)
+        {
+            UINT8 *ages = _ages + base;
+            const UINT32 associativity = Ways();
+            const UINT8 age = ages[way];
+            for (UINT32 w = 0; w < associativity; w++)
+                ages[w] += (ages[w] < age);
+            ages[way] = 0;
+        }
+
+        public:
+        template <UINT32 A> struct rebind { typedef LRU_T<A> type; };
+
+        LRU_T() : _ages(NULL) {}
+        ~LRU_T() { free(_ages); }
+
+        // The ages are bytes
+        static bool Supports(UINT32 associativity) { return associativity <= 256; }
+
+        VOID Init(UINT32 numSets, UINT32 associativity)
+        {
+            ASSERTX(Supports(associativity));
+            STORE::Init(numSets, associativity);
+            free(_ages);
+            _ages = AlignedAlloc<UINT8>((UINT64)numSets * associativity);
+            for (UINT32 s = 0; s < numSets; s++)
+                for (UINT32 w = 0; w < associativity; w++)
+                    _ages[Base(s) + w] = w;
+        }
+
+        string Name() const { return "LRU"; }
+
+        UINT32 Find(UINT32 set, CACHE_TAG tag)
+        {
+            INT32 way = FindWay(set, tag);
+            if (way < 0)
+                return false;
+            Touch(Base(set), way); // Tag found, lets make it MRU
+            return true;
+        }
+
+        CACHE_TAG Replace(UINT32 set, CACHE_TAG tag)
+        {
+            // Ranks are a permutation, so exactly one way is the LRU one.
+            const UINT32 base = Base(set);
+            const UINT32 associativity = Ways();
+            const UINT8 *ages = _ages + base;
+            UINT32 victim = 0;
+            for (UINT32 w = 0; w < associativity; w++)
+                victim |= (ages[w] == associativity - 1) * w;
+
+            CACHE_TAG ret = _tags[base + victim];
+            _tags[base + victim] = tag;
+            Touch(base, victim);
+            return ret;
+        }
+
+        VOID DeleteIfPresent(UINT32 set, CACHE_TAG tag)
+        {
+            INT32 way = FindWay(set, tag);
+            if (way < 0)
+                return;
+
+            // Make the freed way the LRU one
+            const UINT32 base = Base(set);
+            const UINT32 associativity = Ways();
+            UINT8 *ages = _ages + base;
+            const UINT8 age = ages[way];
+            for (UINT32 w = 0; w < associativity; w++)
+                ages[w] -= (ages[w] > age);
+            ages[way] = associativity - 1;
+            _tags[base + way] = INVALID_TAG;
+        }
+    };
+
+    template <UINT32 ASSOC = 0>
+    class RANDOM_T : public TAG_STORE<ASSOC>
+    {
+        protected:
+        typedef TAG_STORE<ASSOC> STORE;
+        using STORE::_tags;
+        using STORE::Ways;
+        using STORE::Base;
+        using STORE::FindWay;
+        using STORE::FindInvalidWay;
+
+        public:
+        template <UINT32 A> struct rebind { typedef RANDOM_T<A> type; };
+
+        VOID Init(UINT32 numSets, UINT32 associativity)
+        {
+            STORE::Init(numSets, associativity);
+            /* initialize random seed: */
+            srand(time(NULL));
+        }
+
+        string Name() const { return "RANDOM"; }
+
+        UINT32 Find(UINT32 set, CACHE_TAG tag)
+        {
+            return FindWay(set, tag) >= 0;
+        }
+
+        CACHE_TAG Replace(UINT32 set, CACHE_TAG tag)
+        {
+            INT32 way = FindInvalidWay(set);
+            if (way < 0)
+                way = rand() % Ways();
+
+            CACHE_TAG ret = _tags[Base(set) + way];
+            _tags[Base(set) + way] = tag;
+            return ret;
+        }
+
+        VOID DeleteIfPresent(UINT32 set, CACHE_TAG tag)
+        {
+            INT32 way = FindWay(set, tag);
+            if (way >= 0)
+                _tags[Base(set) + way] = INVALID_TAG;
+        }
+    };
+
+    /**
+     * Frequency based replacement in O(1) per access (Shah et al., "An O(1)
+     * algorithm for implementing the LFU cache eviction scheme"). The ways
+     * of a set sit in buckets of equal access count, kept in a list sorted
+     * by count; within a bucket they are ordered by last access. A hit moves
+     * its way to the newest end of the next bucket (count + 1), the victim
+     * is the oldest way of the first bucket and empty ways wait in a bucket
+     * of count 0 in front. A set never has more buckets than ways, so each
+     * set owns a fixed pool of `associativity` bucket nodes, and all links
+     * are way/bucket numbers within the set.
+     *
+     * Every AGING accesses per way to a set halve its counts (valid lines
+     * keep at least 1), so lines that were hot long ago do not stay pinned
+     * forever. Halving keeps the order, merging the buckets 2c and 2c + 1.
+     * LFU ages the counts every 16 accesses per way; LRFU every access per
+     * way, so a count weighs each access by 2^(-age / associativity) like the
+     * combined recency-frequency value of LRFU (Lee et al., 2001) and the
+     * policy sits between LFU and LRU.
+     **/
+    template <UINT32 ASSOC, UINT32 AGING>
+    class FREQUENCY_T : public TAG_STORE<ASSOC>
+    {
+        protected:
+        typedef TAG_STORE<ASSOC> STORE;
+        using STORE::_tags;
+        using STORE::_numSets;
+        using STORE::Ways;
+        using STORE::Base;
+        using STORE::FindWay;
+
+        static const UINT8 NIL = 0xff;
+        static const UINT16 MAX_COUNT = 0xffff;
+
+        /**
+         * Node i of a set is both way i (prev/next in its bucket, from old
+         * to new, and the bucket) and bucket node i (its count, its
+         * neighbours by count and its oldest and newest ways). Free bucket
+         * nodes are chained through bucketNext.
+         **/
+        struct NODE
+        {
+            UINT16 count;
+            UINT8 bucketPrev, bucketNext;
+            UINT8 head, tail;
+            UINT8 prev, next, bucket;
+        };
+
+        struct SET_STATE
+        {
+            UINT32 accesses;   // since the last aging
+            UINT8 first, free; // bucket with the lowest count, free nodes
+        };
+
+        NODE *_nodes;
+        SET_STATE *_sets;
+
+        UINT8 NewBucket(NODE *n, SET_STATE &s, UINT16 count, UINT8 after)
+        {
+            const UINT8 b = s.free;
+            ASSERTX(b != NIL);
+            s.free = n[b].bucketNext;
+            n[b].count = count;
+            n[b].head = n[b].tail = NIL;
+            n[b].bucketPrev = after;
+            n[b].bucketNext = after == NIL ? s.first : n[after].bucketNext;
+            if (n[b].bucketNext != NIL)
+                n[n[b].bucketNext].bucketPrev = b;
+            (after == NIL ? s.first : n[after].bucketNext) = b;
+            return b;
+        }
+
+        // Takes `way` out of its bucket, freeing the bucket if it empties
+        VOID UnlinkWay(NODE *n, SET_STATE &s, UINT8 way)
+        {
+            const UINT8 b = n[way].bucket;
+            (n[way].prev == NIL ? n[b].head : n[n[way].prev].next) = n[way].next;
+            (n[way].next == NIL ? n[b].tail : n[n[way].next].prev) = n[way].prev;
+            if (n[b].head != NIL)
+                return;
+            (n[b].bucketPrev == NIL ? s.first : n[n[b].bucketPrev].bucketNext) = n[b].bucketNext;
+            if (n[b].bucketNext != NIL)
+                n[n[b].bucketNext].bucketPrev = n[b].bucketPrev;
+            n[b].bucketNext = s.free;
+            s.free = b;
+        }
+
+        // Adds `way` as the newest (or oldest) way of bucket `b`
+        VOID LinkWay(NODE *n, UINT8 b, UINT8 way, bool oldest)
+        {
+            n[way].bucket = b;
+            if (oldest) {
+                n[way].prev = NIL;
+                n[way].next = n[b].head;
+                (n[b].head == NIL ? n[b].tail : n[n[b].head].prev) = way;
+                n[b].head = way;
+            } else {
+                n[way].next = NIL;
+                n[way].prev = n[b].tail;
+                (n[b].tail == NIL ? n[b].head : n[n[b].tail].next) = way;
+                n[b].tail = way;
+            }
+        }
+
+        /**
+         * Makes `way` the newest way of count `count`, which no bucket
+         * lies between it and the way's current bucket.
+         **/
+        VOID SetCount(NODE *n, SET_STATE &s, UINT8 way, UINT16 count)
+        {
+            const UINT8 b = n[way].bucket;
+            const bool alone = n[b].head == n[b].tail;
+            UINT8 target = b;
+            if (n[b].count != count) {
+                const bool up = count > n[b].count;
+                const UINT8 neighbour = up ? n[b].bucketNext : n[b].bucketPrev;
+                if (neighbour != NIL && n[neighbour].count == count) {
+                    target = neighbour;
+                } else if (alone) {
+                    n[b].count = count; // the bucket keeps its place
+                    return;
+                } else {
+                    target = NewBucket(n, s, count, up ? b : n[b].bucketPrev);
+                }
+            } else if (alone) {
+                return;
+            }
+            UnlinkWay(n, s, way);
+            LinkWay(n, target, way, false);
+        }
+
+        // Halves the counts of a set and rebuilds its buckets
+        VOID Age(NODE *n, SET_STATE &s)
+        {
+            UINT8 order[256];
+            UINT16 counts[256];
+            UINT32 numWays = 0;
+            for (UINT8 b = s.first; b != NIL; b = n[b].bucketNext)
+                for (UINT8 w = n[b].head; w != NIL; w = n[w].next) {
+                    order[numWays] = w;
+                    counts[numWays++] = n[b].count ? std::max(n[b].count >> 1, 1) : 0;
+                }
+
+            const UINT32 associativity = Ways();
+            for (UINT32 i = 0; i < associativity; i++)
+                n[i].bucketNext = i + 1 < associativity ? i + 1 : NIL;
+            s.first = NIL;
+            s.free = 0;
+            UINT8 last = NIL;
+            for (UINT32 i = 0; i < numWays; i++) {
+                if (last == NIL || n[last].count != counts[i])
+                    last = NewBucket(n, s, counts[i], last);
+                LinkWay(n, last, order[i], false);
+            }
+        }
+
+        VOID Accessed(UINT32 set)
+        {
+            if (++_sets[set].accesses >= AGING * Ways()) {
+                _sets[set].accesses = 0;
+                Age(_nodes + Base(set), _sets[set]);
+            }
+        }
+
+        public:
+        FREQUENCY_T() : _nodes(NULL), _sets(NULL) {}
+        ~FREQUENCY_T()
+        {
+            free(_nodes);
+            free(_sets);
+        }
+
+        // Ways are byte links, NIL excluded
+        static bool Supports(UINT32 associativity) { return associativity < NIL; }
+
+        VOID Init(UINT32 numSets, UINT32 associativity)
+        {
+            ASSERTX(Supports(associativity));
+            STORE::Init(numSets, associativity);
+            free(_nodes);
+            free(_sets);
+            _nodes = AlignedAlloc<NODE>((UINT64)numSets * associativity);
+            _sets = AlignedAlloc<SET_STATE>(numSets);
+
+            // All ways empty, in one bucket of count 0
+            for (UINT32 set = 0; set < numSets; set++) {
+                NODE *n = _nodes + Base(set);
+                SET_STATE &s = _sets[set];
+                s.accesses = 0;
+                for (UINT32 i = 0; i < associativity; i++)
+                    n[i].bucketNext = i + 1 < associativity ? i + 1 : NIL;
+                s.first = NIL;
+                s.free = 0;
+                const UINT8 b = NewBucket(n, s, 0, NIL);
+                for (UINT32 w = 0; w < associativity; w++)
+                    LinkWay(n, b, w, false);
+            }
+        }
+
+        UINT32 Find(UINT32 set, CACHE_TAG tag)
+        {
+            INT32 way = FindWay(set, tag);
+            if (way < 0)
+                return false;
+            NODE *n = _nodes + Base(set);
+            const UINT16 count = n[n[way].bucket].count;
+            SetCount(n, _sets[set], way, count < MAX_COUNT ? count + 1 : count);
+            Accessed(set);
+            return true;
+        }
+
+        CACHE_TAG Replace(UINT32 set, CACHE_TAG tag)
+        {
+            // Empty ways are the oldest of count 0, so they go first
+            NODE *n = _nodes + Base(set);
+            const UINT8 way = n[_sets[set].first].head;
+
+            CACHE_TAG ret = _tags[Base(set) + way];
+            _tags[Base(set) + way] = tag;
+            SetCount(n, _sets[set], way, 1);
+            Accessed(set);
+            return ret;
+        }
+
+        VOID DeleteIfPresent(UINT32 set, CACHE_TAG tag)
+        {
+            INT32 way = FindWay(set, tag);
+            if (way < 0)
+                return;
+            _tags[Base(set) + way] = INVALID_TAG;
+
+            NODE *n = _nodes + Base(set);
+            SET_STATE &s = _sets[set];
+            UnlinkWay(n, s, way);
+            UINT8 b = s.first;
+            if (b == NIL || n[b].count != 0)
+                b = NewBucket(n, s, 0, NIL);
+            LinkWay(n, b, way, true);
+        }
+    };
+
+    template <UINT32 ASSOC = 0>
+    class LFU_T : public FREQUENCY_T<ASSOC, 16>
+    {
+        public:
+        template <UINT32 A> struct rebind { typedef LFU_T<A> type; };
+
+        string Name() const { return "LFU"; }
+    };
+
+    template <UINT32 ASSOC = 0>
+    class LRFU_T : public FREQUENCY_T<ASSOC, 1>
+    {
+        public:
+        template <UINT32 A> struct rebind { typedef LRFU_T<A> type; };
+
+        string Name() const { return "LRFU"; }
+    };
+
+    /**
+     * Tree pseudo-LRU. The associativity - 1 (a power of two, at most 64)
+     * node bits of a set's binary tree live in one UINT64, node i at bit i
+     * with its children at 2i and 2i + 1 and way w at leaf associativity + w.
+     * A node bit points to the half holding the next victim (0 = left); a
+     * hit turns the bits on the way's path away from it, which for way w
+     * is the precomputed _pathMask[w] / _pathBits[w] pair, and the victim
+     * is found by following the bits from the root.
+     **/
+    template <UINT32 ASSOC = 0>
+    class PLRU_T : public TAG_STORE<ASSOC>
+    {
+        protected:
+        typedef TAG_STORE<ASSOC> STORE;
+        using STORE::_tags;
+        using STORE::Ways;
+        using STORE::Base;
+        using STORE::FindWay;
+        using STORE::FindInvalidWay;
+
+        static const UINT32 MAX_WAYS = 64;
+
+        UINT64 *_trees;
+        UINT64 _pathMask[MAX_WAYS];  // node bits on the path of each way
+        UINT64 _pathBits[MAX_WAYS];  // their values pointing away from it
+
+        VOID Touch(UINT32 set, UINT32 way)
+        {
+            _trees[set] = (_trees[set] & ~_pathMask[way]) | _pathBits[way];
+        }
+
+        UINT32 Victim(UINT32 set) const
+        {
+            const UINT64 tree = _trees[set];
+            UINT32 node = 1;
+            while (node < Ways())
+                node = 2 * node + ((tree >> node) & 1);
+            return node - Ways();
+        }
+
+        public:
+        template <UINT32 A> struct rebind { typedef PLRU_T<A> type; };
+
+        PLRU_T() : _trees(NULL) {}
+        ~PLRU_T() { free(_trees); }
+
+        // A full binary tree of at most MAX_WAYS leaves
+        static bool Supports(UINT32 associativity)
+        {
+            return associativity <= MAX_WAYS && (associativity & (associativity - 1)) == 0;
+        }
+
+        VOID Init(UINT32 numSets, UINT32 associativity)
+        {
+            ASSERTX(Supports(associativity));
+            STORE::Init(numSets, associativity);
+            for (UINT32 w = 0; w < associativity; w++) {
+                _pathMask[w] = _pathBits[w] = 0;
+                for (UINT32 node = associativity + w; node > 1; node >>= 1) {
+                    _pathMask[w] |= UINT64(1) << (node >> 1);
+                    _pathBits[w] |= UINT64(~node & 1) << (node >> 1);
+                }
+            }
+            free(_trees);
+            _trees = AlignedAlloc<UINT64>(numSets);
+            for (UINT32 s = 0; s < numSets; s++)
+                _trees[s] = 0;
+        }
+
+        string Name() const { return "PLRU"; }
+
+        UINT32 Find(UINT32 set, CACHE_TAG tag)
+        {
+            INT32 way = FindWay(set, tag);
+            if (way < 0)
+                return false;
+            Touch(set, way);
+            return true;
+        }
+
+        CACHE_TAG Replace(UINT32 set, CACHE_TAG tag)
+        {
+            INT32 way = FindInvalidWay(set);
+            if (way < 0)
+                way = Victim(set);
+
+            CACHE_TAG ret = _tags[Base(set) + way];
+            _tags[Base(set) + way] = tag;
+            Touch(set, way);
+            return ret;
+        }
+
+        VOID DeleteIfPresent(UINT32 set, CACHE_TAG tag)
+        {
+            INT32 way = FindWay(set, tag);
+            if (way < 0)
+                return;
+            // Point the path at the freed way
+            _tags[Base(set) + way] = INVALID_TAG;
+            _trees[set] = (_trees[set] & ~_pathMask[way]) | (_pathMask[way] & ~_pathBits[way]);
+        }
+    };
+
+    /**
+     * Not recently used: one reference bit per way (at most 64) in a UINT64
+     * per set. Hits and fills set the way's bit, clearing all the others
+     * when it was the last one clear; the victim is the first way whose bit
+     * is clear.
+     **/
+    template <UINT32 ASSOC = 0>
+    class NRU_T : public TAG_STORE<ASSOC>
+    {
+        protected:
+        typedef TAG_STORE<ASSOC> STORE;
+        using STORE::_tags;
+        using STORE::Ways;
+        using STORE::Base;
+        using STORE::FindWay;
+        using STORE::FindInvalidWay;
+
+        static const UINT32 MAX_WAYS = 64;
+
+        UINT64 *_referenced;
+        UINT64 _allWays;
+
+        VOID Touch(UINT32 set, UINT32 way)
+        {
+            const UINT64 bit = UINT64(1) << way;
+            const UINT64 referenced = _referenced[set] | bit;
+            _referenced[set] = referenced == _allWays ? bit : referenced;
+        }
+
+        public:
+        template <UINT32 A> struct rebind { typedef NRU_T<A> type; };
+
+        NRU_T() : _referenced(NULL), _allWays(0) {}
+        ~NRU_T() { free(_referenced); }
+
+        // One bit per way in a UINT64
+        static bool Supports(UINT32 associativity) { return associativity <= MAX_WAYS; }
+
+        VOID Init(UINT32 numSets, UINT32 associativity)
+        {
+            ASSERTX(Supports(associativity));
+            STORE::Init(numSets, associativity);
+            _allWays = associativity == MAX_WAYS ? ~UINT64(0) :
+                       (UINT64(1) << associativity) - 1;
+            free(_referenced);
+            _referenced = AlignedAlloc<UINT64>(numSets);
+            for (UINT32 s = 0; s < numSets; s++)
+                _referenced[s] = 0;
+        }
+
+        string Name() const { return "NRU"; }
+
+        UINT32 Find(UINT32 set, CACHE_TAG tag)
+        {
+            INT32 way = FindWay(set, tag);
+            if (way < 0)
+                return false;
+            Touch(set, way);
+            return true;
+        }
+
+        CACHE_TAG Replace(UINT32 set, CACHE_TAG tag)
+        {
+            // Touch() leaves a bit clear, unless the set has a single way
+            INT32 way = FindInvalidWay(set);
+            if (way < 0)
+                way = __builtin_ctzll(~_referenced[set] | (UINT64(1) << (Ways() - 1)));
+
+            CACHE_TAG ret = _tags[Base(set) + way];
+            _tags[Base(set) + way] = tag;
+            Touch(set, way);
+            return ret;
+        }
+
+        VOID DeleteIfPresent(UINT32 set, CACHE_TAG tag)
+        {
+            INT32 way = FindWay(set, tag);
+            if (way < 0)
+                return;
+            _tags[Base(set) + way] = INVALID_TAG;
+            _referenced[set] &= ~(UINT64(1) << way);
+        }
+    };
+
+    /**
+     * Re-reference interval prediction (Jaleel et al., ISCA 2010). Every
+     * way has a 2-bit RRPV, 0 = re-referenced soon, 3 = distant; hits set
+     * it to 0, the victim is the first way at 3 (after aging the whole set
+     * until one is), and INSERTION chooses the RRPV of new blocks:
+     *   SRRIP: always 2 ("long"), so a scan cannot flush reused blocks,
+     *   BRRIP: 3, but 2 once every BIMODAL_PERIOD insertions, so part of a
+     *          working set larger than the cache survives,
+     *   DRRIP: SRRIP or BRRIP by set dueling: LEADER_SETS sets always
+     *          insert as SRRIP and as many as BRRIP, a miss in an SRRIP
+     *          leader counts PSEL up, one in a BRRIP leader down, and the
+     *          other (follower) sets insert as BRRIP while PSEL is in its
+     *          upper half. Caches with fewer than 4 * LEADER_SETS sets have
+     *          one leader of each kind every 4 sets.
+     * The RRPVs of 32 ways pack into one UINT64, so finding and aging the
+     * victim are a few word operations per 32 ways. The bimodal counter and
+     * PSEL are shared by all sets; MULTI_CORE_CACHE updates them without a
+     * lock, where a lost update only delays the duel.
+     **/
+    typedef enum
+    {
+        RRIP_SRRIP,
+        RRIP_BRRIP,
+        RRIP_DRRIP
+    } RRIP_INSERTION;
+
+    template <UINT32 ASSOC, RRIP_INSERTION INSERTION>
+    class RRIP_T : public TAG_STORE<ASSOC>
+    {
+        protected:
+        typedef TAG_STORE<ASSOC> STORE;
+        using STORE::_tags;
+        using STORE::Ways;
+        using STORE::Base;
+        using STORE::FindWay;
+        using STORE::FindInvalidWay;
+
+        static const UINT32 RRPV_LONG = 2;
+        static const UINT32 RRPV_DISTANT = 3;
+        static const UINT32 BIMODAL_PERIOD = 32;
+        static const UINT32 LEADER_SETS = 32;
+        static const UINT32 PSEL_MAX = 1023; // 10 bits
+        static const UINT32 WAYS_PER_WORD = 32;
+        static const UINT64 LOW_BITS = 0x5555555555555555ULL; // bit 0 of each RRPV
+
+        UINT64 *_rrpvs;
+        UINT32 _words;          // per set, runtime copy of Words()
+        UINT64 _lastLow;        // LOW_BITS of the ways in a set's last word
+        UINT32 _bimodal;        // BRRIP insertions since the last long one
+        UINT32 _psel;
+        UINT32 _region;         // sets per pair of leaders
+
+        struct DUEL_STATS
+        {
+            CACHE_STATS leaderMisses[2];   // [SRRIP, BRRIP]
+            CACHE_STATS followerFills[2];
+        } _duel;
+
+        UINT32 Words() const
+        {
+            return ASSOC ? (ASSOC + WAYS_PER_WORD - 1) / WAYS_PER_WORD : _words;
+        }
+
+        VOID SetRrpv(UINT32 set, UINT32 way, UINT64 rrpv)
+        {
+            UINT64 &word = _rrpvs[set * Words() + way / WAYS_PER_WORD];
+            const UINT32 shift = 2 * (way % WAYS_PER_WORD);
+            word = (word & ~(UINT64(3) << shift)) | (rrpv << shift);
+        }
+
+        UINT32 Victim(UINT32 set)
+        {
+            UINT64 *words = _rrpvs + set * Words();
+            const UINT32 last = Words() - 1;
+            for (;;) {
+                for (UINT32 i = 0; i <= last; i++) {
+                    const UINT64 distant = words[i] & (words[i] >> 1) & LOW_BITS;
+                    if (distant)
+                        return i * WAYS_PER_WORD + __builtin_ctzll(distant) / 2;
+                }
+                // No RRPV is 3, so adding 1 to each cannot carry
+                for (UINT32 i = 0; i < last; i++)
+                    words[i] += LOW_BITS;
+                words[last] += _lastLow;
+            }
+        }
+
+        UINT32 BimodalRrpv()
+        {
+            if (++_bimodal < BIMODAL_PERIOD)
+                return RRPV_DISTANT;
+            _bimodal = 0;
+            return RRPV_LONG;
+        }
+
+        // RRPV of a block filled into `set` after a miss
+        UINT32 InsertionRrpv(UINT32 set)
+        {
+            if (INSERTION == RRIP_SRRIP)
+                return RRPV_LONG;
+            if (INSERTION == RRIP_BRRIP)
+                return BimodalRrpv();
+
+            const UINT32 offset = set % _region;
+            bool bimodal;
+            if (offset == 0 || offset == _region / 2) {
+                bimodal = offset != 0;
+                _duel.leaderMisses[bimodal]++;
+                if (bimodal)
+                    _psel -= (_psel > 0);
+                else
+                    _psel += (_psel < PSEL_MAX);
+            } else {
+                bimodal = _psel > PSEL_MAX / 2;
+                _duel.followerFills[bimodal]++;
+            }
+            return bimodal ? BimodalRrpv() : RRPV_LONG;
+        }
+
+        public:
+        RRIP_T()
+            : _rrpvs(NULL), _words(0), _lastLow(0), _bimodal(0), _psel(0), _region(4)
+        {
+            ResetStats();
+        }
+        ~RRIP_T() { free(_rrpvs); }
+
+        VOID Init(UINT32 numSets, UINT32 associativity)
+        {
+            STORE::Init(numSets, associativity);
+            _words = (associativity + WAYS_PER_WORD - 1) / WAYS_PER_WORD;
+            const UINT32 lastWays = associativity - (_words - 1) * WAYS_PER_WORD;
+            _lastLow = lastWays == WAYS_PER_WORD ? LOW_BITS :
+                       LOW_BITS & ((UINT64(1) << (2 * lastWays)) - 1);
+            _bimodal = 0;
+            _psel = (PSEL_MAX + 1) / 2;
+            _region = std::max(numSets / LEADER_SETS, 4u);
+
+            // Empty ways are distant; unused RRPVs of the last word stay 0
+            free(_rrpvs);
+            _rrpvs = AlignedAlloc<UINT64>((UINT64)numSets * _words);
+            for (UINT64 i = 0; i < (UINT64)numSets * _words; i++)
+                _rrpvs[i] = 3 * ((i + 1) % _words ? LOW_BITS : _lastLow);
+        }
+
+        string Name() const
+        {
+            return INSERTION == RRIP_SRRIP ? "SRRIP" : INSERTION == RRIP_BRRIP ? "BRRIP" : "DRRIP";
+        }
+
+        UINT32 Find(UINT32 set, CACHE_TAG tag)
+        {
+            INT32 way = FindWay(set, tag);
+            if (way < 0)
+                return false;
+            SetRrpv(set, way, 0);
+            return true;
+        }
+
+        CACHE_TAG Replace(UINT32 set, CACHE_TAG tag)
+        {
+            const UINT32 rrpv = InsertionRrpv(set);
+            INT32 way = FindInvalidWay(set);
+            if (way < 0)
+                way = Victim(set);
+
+            CACHE_TAG ret = _tags[Base(set) + way];
+            _tags[Base(set) + way] = tag;
+            SetRrpv(set, way, rrpv);
+            return ret;
+        }
+
+        VOID DeleteIfPresent(UINT32 set, CACHE_TAG tag)
+        {
+            INT32 way = FindWay(set, tag);
+            if (way < 0)
+                return;
+            _tags[Base(set) + way] = INVALID_TAG;
+            SetRrpv(set, way, RRPV_DISTANT);
+        }
+
+        static bool SetsIndependent() { return INSERTION == RRIP_SRRIP; }
+
+        VOID ResetStats() { memset(&_duel, 0, sizeof(_duel)); }
+
+        VOID AddStats(const RRIP_T &other)
+        {
+            for (UINT32 side = 0; side < 2; side++) {
+                _duel.leaderMisses[side] += other._duel.leaderMisses[side];
+                _duel.followerFills[side] += other._duel.followerFills[side];
+            }
+        }
+
+        // How often the duel chose each side, DRRIP only
+        string StatsLong(const string &prefix, const string &level) const
+        {
+            if (INSERTION != RRIP_DRRIP)
+                return "";
+
+            const UINT32 headerWidth = 27;
+            const UINT32 numberWidth = 12;
+            const char *sides[2] = { "SRRIP", "BRRIP" };
+            const CACHE_STATS fills = _duel.followerFills[0] + _duel.followerFills[1];
+            string out;
+
+            out += prefix + level + " DRRIP Duel:\n";
+            for (UINT32 side = 0; side < 2; side++)
+                out += prefix + ljstr(level + "-" + sides[side] + "-Leader-Misses:", headerWidth)
+                    + dec2str(_duel.leaderMisses[side], numberWidth) + "\n";
+            for (UINT32 side = 0; side < 2; side++)
+                out += prefix + ljstr(level + "-" + sides[side] + "-Follower-Fills:", headerWidth)
+                    + dec2str(_duel.followerFills[side], numberWidth) + "  "
+                    + fltstr(fills ? 100.0 * _duel.followerFills[side] / fills : 0.0, 2, 6) + "%\n";
+            out += prefix + ljstr(level + "-PSEL:", headerWidth)
+                + dec2str(_psel, numberWidth) + "\n";
+            out += prefix + "\n";
+
+            return out;
+        }
+    };
+
+    template <UINT32 ASSOC = 0>
+    class SRRIP_T : public RRIP_T<ASSOC, RRIP_SRRIP>
+    {
+        public:
+        template <UINT32 A> struct rebind { typedef SRRIP_T<A> type; };
+    };
+
+    template <UINT32 ASSOC = 0>
+    class BRRIP_T : public RRIP_T<ASSOC, RRIP_BRRIP>
+    {
+        public:
+        template <UINT32 A> struct rebind { typedef BRRIP_T<A> type; };
+    };
+
+    template <UINT32 ASSOC = 0>
+    class DRRIP_T : public RRIP_T<ASSOC, RRIP_DRRIP>
+    {
+        public:
+        template <UINT32 A> struct rebind { typedef DRRIP_T<A> type; };
+    };
+
+    // Hash of an instruction address into a `bits`-bit signature
+    static inline UINT32 PcSignature(ADDRINT pc, UINT32 bits)
+    {
+        const UINT64 h = UINT64(pc) * 0x9e3779b97f4a7c15ULL;
+        return UINT32(h >> (64 - bits));
+    }
+
+    /**
+     * SHiP-PC (Wu et al., MICRO 2011) on top of SRRIP. A table of 3-bit
+     * counters (SHCT) indexed by the signature of the filling instruction
+     * learns whether its blocks get reused: hits count the signature of the
+     * line up, evictions of never reused lines count it down, and blocks of
+     * a signature at 0 are inserted distant instead of long. Every line
+     * keeps its signature and a reused bit in a UINT16.
+     **/
+    template <UINT32 ASSOC = 0>
+    class SHIP_T : public RRIP_T<ASSOC, RRIP_SRRIP>
+    {
+        protected:
+        typedef RRIP_T<ASSOC, RRIP_SRRIP> RRIP;
+        using RRIP::_tags;
+        using RRIP::Base;
+        using RRIP::FindWay;
+        using RRIP::FindInvalidWay;
+        using RRIP::SetRrpv;
+        using RRIP::Victim;
+
+        static const UINT32 SIGNATURE_BITS = 14;
+        static const UINT32 SHCT_ENTRIES = 1 << SIGNATURE_BITS;
+        static const UINT8 SHCT_MAX = 7;
+        static const UINT16 REUSED = 0x8000;
+
+        UINT8 _shct[SHCT_ENTRIES];
+        UINT16 *_lines;         // per line: signature | REUSED
+        ADDRINT _pc;
+        CACHE_STATS _fills[2];  // [long, distant]
+
+        public:
+        template <UINT32 A> struct rebind { typedef SHIP_T<A> type; };
+
+        SHIP_T() : _lines(NULL), _pc(0) { ResetStats(); }
+        ~SHIP_T() { free(_lines); }
+
+        VOID Init(UINT32 numSets, UINT32 associativity)
+        {
+            RRIP::Init(numSets, associativity);
+            // Weakly reused, so new signatures start out as SRRIP
+            memset(_shct, 1, sizeof(_shct));
+            free(_lines);
+            _lines = AlignedAlloc<UINT16>((UINT64)numSets * associativity);
+            memset(_lines, 0, (UINT64)numSets * associativity * sizeof(UINT16));
+        }
+
+        string Name() const { return "SHiP"; }
+
+        VOID SetPc(ADDRINT pc) { _pc = pc; }
+
+        UINT32 Find(UINT32 set, CACHE_TAG tag)
+        {
+            INT32 way = FindWay(set, tag);
+            if (way < 0)
+                return false;
+            UINT16 &line = _lines[Base(set) + way];
+            UINT8 &counter = _shct[line & ~REUSED];
+            counter += (counter < SHCT_MAX);
+            line |= REUSED;
+            SetRrpv(set, way, 0);
+            return true;
+        }
+
+        CACHE_TAG Replace(UINT32 set, CACHE_TAG tag)
+        {
+            INT32 way = FindInvalidWay(set);
+            if (way < 0) {
+                way = Victim(set);
+                const UINT16 victim = _lines[Base(set) + way];
+                if (!(victim & REUSED))
+                    _shct[victim] -= (_shct[victim] > 0);
+            }
+
+            const UINT32 signature = PcSignature(_pc, SIGNATURE_BITS);
+            const bool distant = _shct[signature] == 0;
+            _fills[distant]++;
+
+            CACHE_TAG ret = _tags[Base(set) + way];
+            _tags[Base(set) + way] = tag;
+            _lines[Base(set) + way] = signature;
+            SetRrpv(set, way, distant ? UINT64(RRIP::RRPV_DISTANT) : UINT64(RRIP::RRPV_LONG));
+            return ret;
+        }
+
+        VOID DeleteIfPresent(UINT32 set, CACHE_TAG tag)
+        {
+            INT32 way = FindWay(set, tag);
+            if (way < 0)
+                return;
+            _tags[Base(set) + way] = INVALID_TAG;
+            _lines[Base(set) + way] = 0;
+            SetRrpv(set, way, RRIP::RRPV_DISTANT);
+        }
+
+        static bool SetsIndependent() { return false; }
+
+        VOID ResetStats() { _fills[0] = _fills[1] = 0; }
+
+        VOID AddStats(const SHIP_T &other)
+        {
+            _fills[0] += other._fills[0];
+            _fills[1] += other._fills[1];
+        }
+
+        string StatsLong(const string &prefix, const string &level) const
+        {
+            const UINT32 headerWidth = 27;
+            const UINT32 numberWidth = 12;
+            const CACHE_STATS fills = _fills[0] + _fills[1];
+            string out;
+
+            out += prefix + level + " SHiP Insertions:\n";
+            out += prefix + ljstr(level + "-Long-Fills:", headerWidth)
+                + dec2str(_fills[0], numberWidth) + "  "
+                + fltstr(fills ? 100.0 * _fills[0] / fills : 0.0, 2, 6) + "%\n";
+            out += prefix + ljstr(level + "-Distant-Fills:", headerWidth)
+                + dec2str(_fills[1], numberWidth) + "  "
+                + fltstr(fills ? 100.0 * _fills[1] / fills : 0.0, 2, 6) + "%\n";
+            out += prefix + "\n";
+
+            return out;
+        }
+    };
+
+    /**
+     * Hawkeye (Jain and Lin, ISCA 2016). OPTgen replays the accesses of
+     * SAMPLED_SETS sets against Belady's MIN over a history of
+     * HISTORY_PER_WAY * associativity accesses per set: a reuse hits under
+     * MIN iff the occupancy of the set stayed below the associativity over
+     * the whole interval since the previous access. Each verdict trains a
+     * 3-bit counter of the PC of that previous access, as does a sampled
+     * line leaving the history unused (a MIN miss).
+     *
+     * Lines of PCs predicted cache-friendly are inserted and hit at RRPV 0,
+     * aging the other friendly lines on a fill; cache-averse lines get the
+     * highest RRPV, 7, and go first. Evicting a friendly line instead
+     * detrains its PC. RRPVs are one byte and signatures a UINT16 per line.
+     **/
+    template <UINT32 ASSOC = 0>
+    class HAWKEYE_T : public TAG_STORE<ASSOC>
+    {
+        protected:
+        typedef TAG_STORE<ASSOC> STORE;
+        using STORE::_tags;
+        using STORE::Ways;
+        using STORE::Base;
+        using STORE::FindWay;
+        using STORE::FindInvalidWay;
+
+        static const UINT8 RRPV_MAX = 7;
+        static const UINT32 SIGNATURE_BITS = 13;
+        static const UINT32 PREDICTOR_ENTRIES = 1 << SIGNATURE_BITS;
+        static const UINT8 COUNTER_MAX = 7;
+        static const UINT32 SAMPLED_SETS = 64;
+        static const UINT32 HISTORY_PER_WAY = 8;
+
+        // An access of a sampled set still in the OPTgen history
+        struct SAMPLE
+        {
+            CACHE_TAG tag;
+            UINT32 time;
+            UINT16 signature;
+        };
+
+        UINT8 *_rrpvs;
+        UINT16 *_signatures;
+        UINT8 _predictor[PREDICTOR_ENTRIES];
+        ADDRINT _pc;
+
+        UINT32 _sampleStride;   // every _sampleStride-th set is sampled
+        UINT32 _history;        // accesses of a sampled set OPTgen looks back
+        std::vector<SAMPLE> _samples;     // _history per sampled set
+        std::vector<UINT8> _occupancy;    // ditto, a ring indexed by time
+        std::vector<UINT32> _clock;       // accesses of each sampled set
+
+        struct HAWKEYE_STATS
+        {
+            CACHE_STATS optHits, optMisses; // of the sampled accesses
+            CACHE_STATS friendlyFills, averseFills;
+            CACHE_STATS detrains;
+        } _hawkeye;
+
+        bool Friendly(UINT32 signature) const { return _predictor[signature] > COUNTER_MAX / 2; }
+
+        VOID Train(UINT32 signature, bool hit)
+        {
+            UINT8 &counter = _predictor[signature];
+            if (hit)
+                counter += (counter < COUNTER_MAX);
+            else
+                counter -= (counter > 0);
+            _hawkeye.optHits += hit;
+            _hawkeye.optMisses += !hit;
+        }
+
+        VOID OptGen(UINT32 sampled, CACHE_TAG tag, UINT32 signature)
+        {
+            const UINT32 now = _clock[sampled]++;
+            const UINT32 associativity = Ways();
+            SAMPLE *samples = &_samples[sampled * _history];
+            UINT8 *occupancy = &_occupancy[sampled * _history];
+            occupancy[now % _history] = 0;
+
+            // The sample of `tag`, else an empty one or the oldest
+            SAMPLE *entry = NULL, *victim = samples;
+            for (UINT32 i = 0; i < _history; i++) {
+                if (samples[i].tag == tag) {
+                    entry = &samples[i];
+                    break;
+                }
+                if (victim->tag != INVALID_TAG &&
+                    (samples[i].tag == INVALID_TAG || samples[i].time < victim->time))
+                    victim = &samples[i];
+            }
+
+            if (entry) {
+                bool hit = now - entry->time < _history;
+                for (UINT32 t = entry->time; hit && t != now; t++)
+                    hit = occupancy[t % _history] < associativity;
+                if (hit)
+                    for (UINT32 t = entry->time; t != now; t++)
+                        occupancy[t % _history]++;
+                Train(entry->signature, hit);
+            } else {
+                // The oldest sample has left the history unused
+                entry = victim;
+                if (entry->tag != INVALID_TAG)
+                    Train(entry->signature, false);
+                entry->tag = tag;
+            }
+            entry->time = now;
+            entry->signature = signature;
+        }
+
+        UINT32 Victim(UINT32 set)
+        {
+            const UINT32 base = Base(set);
+            UINT32 victim = 0;
+            for (UINT32 w = 0; w < Ways(); w++) {
+                if (_rrpvs[base + w] == RRPV_MAX)
+                    return w;
+                if (_rrpvs[base + w] > _rrpvs[base + victim])
+                    victim = w;
+            }
+            // Evicting a line predicted friendly
+            UINT8 &counter = _predictor[_signatures[base + victim]];
+            counter -= (counter > 0);
+            _hawkeye.detrains++;
+            return victim;
+        }
+
+        public:
+        template <UINT32 A> struct rebind { typedef HAWKEYE_T<A> type; };
+
+        HAWKEYE_T()
+            : _rrpvs(NULL), _signatures(NULL), _pc(0), _sampleStride(1), _history(0)
+        {
+            ResetStats();
+        }
+        ~HAWKEYE_T()
+        {
+            free(_rrpvs);
+            free(_signatures);
+        }
+
+        VOID Init(UINT32 numSets, UINT32 associativity)
+        {
+            STORE::Init(numSets, associativity);
+            const UINT64 lines = (UINT64)numSets * associativity;
+            free(_rrpvs);
+            free(_signatures);
+            _rrpvs = AlignedAlloc<UINT8>(lines);
+            _signatures = AlignedAlloc<UINT16>(lines);
+            memset(_rrpvs, RRPV_MAX, lines);
+            memset(_signatures, 0, lines * sizeof(UINT16));
+            // Weakly friendly
+            memset(_predictor, (COUNTER_MAX + 1) / 2, sizeof(_predictor));
+
+            _sampleStride = std::max(numSets / SAMPLED_SETS, 1u);
+            _history = HISTORY_PER_WAY * associativity;
+            const UINT32 sampledSets = (numSets + _sampleStride - 1) / _sampleStride;
+            SAMPLE empty = { INVALID_TAG, 0, 0 };
+            _samples.assign(sampledSets * _history, empty);
+            _occupancy.assign(sampledSets * _history, 0);
+            _clock.assign(sampledSets, 0);
+        }
+
+        string Name() const { return "Hawkeye"; }
+
+        VOID SetPc(ADDRINT pc) { _pc = pc; }
+
+        UINT32 Find(UINT32 set, CACHE_TAG tag)
+        {
+            const UINT32 signature = PcSignature(_pc, SIGNATURE_BITS);
+            if (set % _sampleStride == 0)
+                OptGen(set / _sampleStride, tag, signature);
+
+            INT32 way = FindWay(set, tag);
+            if (way < 0)
+                return false;
+            _rrpvs[Base(set) + way] = Friendly(signature) ? 0 : RRPV_MAX;
+            _signatures[Base(set) + way] = signature;
+            return true;
+        }
+
+        CACHE_TAG Replace(UINT32 set, CACHE_TAG tag)
+        {
+            const UINT32 base = Base(set);
+            INT32 way = FindInvalidWay(set);
+            if (way < 0)
+                way = Victim(set);
+
+            const UINT32 signature = PcSignature(_pc, SIGNATURE_BITS);
+            UINT8 rrpv = RRPV_MAX;
+            if (Friendly(signature)) {
+                // Age the friendly lines, unless one is already the oldest
+                bool saturated = false;
+                for (UINT32 w = 0; w < Ways(); w++)
+                    saturated |= (_rrpvs[base + w] == RRPV_MAX - 1);
+                for (UINT32 w = 0; w < Ways() && !saturated; w++)
+                    _rrpvs[base + w] += (_rrpvs[base + w] < RRPV_MAX - 1);
+                rrpv = 0;
+                _hawkeye.friendlyFills++;
+            } else {
+                _hawkeye.averseFills++;
+            }
+
+            CACHE_TAG ret = _tags[base + way];
+            _tags[base + way] = tag;
+            _rrpvs[base + way] = rrpv;
+            _signatures[base + way] = signature;
+            return ret;
+        }
+
+        VOID DeleteIfPresent(UINT32 set, CACHE_TAG tag)
+        {
+            INT32 way = FindWay(set, tag);
+            if (way < 0)
+                return;
+            _tags[Base(set) + way] = INVALID_TAG;
+            _rrpvs[Base(set) + way] = RRPV_MAX;
+        }
+
+        static bool SetsIndependent() { return false; }
+
+        VOID ResetStats() { memset(&_hawkeye, 0, sizeof(_hawkeye)); }
+
+        VOID AddStats(const HAWKEYE_T &other)
+        {
+            _hawkeye.optHits += other._hawkeye.optHits;
+            _hawkeye.optMisses += other._hawkeye.optMisses;
+            _hawkeye.friendlyFills += other._hawkeye.friendlyFills;
+            _hawkeye.averseFills += other._hawkeye.averseFills;
+            _hawkeye.detrains += other._hawkeye.detrains;
+        }
+
+        string StatsLong(const string &prefix, const string &level) const
+        {
+            const UINT32 headerWidth = 27;
+            const UINT32 numberWidth = 12;
+            const CACHE_STATS sampled = _hawkeye.optHits + _hawkeye.optMisses;
+            const CACHE_STATS fills = _hawkeye.friendlyFills + _hawkeye.averseFills;
+            string out;
+
+            out += prefix + level + " Hawkeye:\n";
+            out += prefix + ljstr(level + "-OPTgen-Hits:", headerWidth)
+                + dec2str(_hawkeye.optHits, numberWidth) + "  "
+                + fltstr(sampled ? 100.0 * _hawkeye.optHits / sampled : 0.0, 2, 6) + "%\n";
+            out += prefix + ljstr(level + "-OPTgen-Misses:", headerWidth)
+                + dec2str(_hawkeye.optMisses, numberWidth) + "  "
+                + fltstr(sampled ? 100.0 * _hawkeye.optMisses / sampled : 0.0, 2, 6) + "%\n";
+            out += prefix + ljstr(level + "-Friendly-Fills:", headerWidth)
+                + dec2str(_hawkeye.friendlyFills, numberWidth) + "  "
+                + fltstr(fills ? 100.0 * _hawkeye.friendlyFills / fills : 0.0, 2, 6) + "%\n";
+            out += prefix + ljstr(level + "-Averse-Fills:", headerWidth)
+                + dec2str(_hawkeye.averseFills, numberWidth) + "  "
+                + fltstr(fills ? 100.0 * _hawkeye.averseFills / fills : 0.0, 2, 6) + "%\n";
+            out += prefix + ljstr(level + "-Friendly-Evictions:", headerWidth)
+                + dec2str(_hawkeye.detrains, numberWidth) + "\n";
+            out += prefix + "\n";
+
+            return out;
+        }
+    };
+
+    typedef LRU_T<> LRU;
+    typedef RANDOM_T<> RANDOM;
+    typedef LFU_T<> LFU;
+    typedef LRFU_T<> LRFU;
+    typedef PLRU_T<> PLRU;
+    typedef NRU_T<> NRU;
+    typedef SRRIP_T<> SRRIP;
+    typedef BRRIP_T<> BRRIP;
+    typedef DRRIP_T<> DRRIP;
+    typedef SHIP_T<> SHIP;
+    typedef HAWKEYE_T<> HAWKEYE;
+
+} // namespace CACHE_SET
+
+// X(NAME) for every CACHE_SET::NAME policy, e.g. to dispatch on them
+#define CACHE_SET_TABLE(X) \
+    X(LRU) X(RANDOM) X(LFU) X(LRFU) X(PLRU) X(NRU) \
+    X(SRRIP) X(BRRIP) X(DRRIP) X(SHIP) X(HAWKEYE)
+
+/**
+ * Map from block number to VALUE, value-initialized for blocks never seen.
+ * Open addressing with linear probing, kept at most half full; blocks are
+ * never removed.
+ **/
+template <class VALUE>
+class BLOCK_MAP
+{
+    static const ADDRINT EMPTY = ADDRINT(-1);
+    std::vector<ADDRINT> _blocks;
+    std::vector<VALUE> _values;
+    UINT64 _size;
+
+    UINT64 Slot(ADDRINT block) const
+    {
+        const UINT64 mask = _blocks.size() - 1;
+        UINT64 i = ((block * 0x9e3779b97f4a7c15ULL) >> 32) & mask;
+        while (_blocks[i] != block && _blocks[i] != EMPTY)
+            i = (i + 1) & mask;
+        return i;
+    }
+
+    VOID Grow()
+    {
+        std::vector<ADDRINT> blocks(2 * _blocks.size(), EMPTY);
+        std::vector<VALUE> values(2 * _values.size(), VALUE());
+        _blocks.swap(blocks);
+        _values.swap(values);
+        for (UINT64 i = 0; i < blocks.size(); i++)
+            if (blocks[i] != EMPTY) {
+                const UINT64 j = Slot(blocks[i]);
+                _blocks[j] = blocks[i];
+                _values[j] = values[i];
+            }
+    }
+
+    public:
+    BLOCK_MAP() : _blocks(1 << 16, EMPTY), _values(1 << 16, VALUE()), _size(0) {}
+
+    // Inserts unseen blocks; the reference is valid until the next insertion
+    VALUE &operator[](ADDRINT block)
+    {
+        UINT64 i = Slot(block);
+        if (_blocks[i] == EMPTY) {
+            if (2 * (_size + 1) > _blocks.size()) {
+                Grow();
+                i = Slot(block);
+            }
+            _blocks[i] = block;
+            _size++;
+        }
+        return _values[i];
+    }
+};
+
+/**
+ * Single-pass LRU stack distance analysis (Mattson et al.) of one cache
+ * level with a given block size and number of sets.
+ *
+ * LRU has the inclusion property: a set with associativity A holds exactly
+ * the A most recently used blocks mapped to it. So an access hits in every
+ * A-way cache of this geometry iff its stack distance (the number of
+ * distinct blocks of the same set referenced since the previous access to
+ * its block) is smaller than A, and one pass yields the exact misses of all
+ * associativities, i.e. all cache sizes numSets * A * blockSize.
+ *
+ * Each set numbers its accesses; a Fenwick tree marks the timestamps that
+ * are the latest access of some block, so the distance is a prefix sum and
+ * every access costs O(log n). The timestamps are renumbered when a set
+ * runs out of them.
+ *
+ * Accesses beyond distance maxAssoc share one histogram bucket; accesses
+ * to never seen blocks are cold misses. Provides the Access/PrintCache/
+ * StatsLong interface of TWO_LEVEL_CACHE (Access always returns 0 cycles).
+ **/
+class STACK_DISTANCE
+{
+    public:
+    typedef enum
+    {
+        ACCESS_TYPE_LOAD,
+        ACCESS_TYPE_STORE,
+        ACCESS_TYPE_NUM
+    } ACCESS_TYPE;
+
+    private:
+    /**
+     * block -> timestamp (in its set) of its latest access, 0 for blocks
+     * never seen.
+     **/
+    typedef BLOCK_MAP<UINT32> LAST_ACCESS;
+
+    /**
+     * Accesses of one set are numbered 1..now. The Fenwick tree marks the
+     * timestamps that are still the latest access of their block, so the
+     * stack distance of a block last accessed at t is the number of marks
+     * after t.
+     **/
+    struct SET_STACK
+    {
+        std::vector<UINT32> tree;    // Fenwick tree over timestamps
+        std::vector<ADDRINT> blocks; // block accessed at each timestamp
+        UINT32 now;
+        UINT32 live;                 // marked timestamps
+
+        SET_STACK() : tree(64, 0), blocks(64), now(0), live(0) {}
+
+        VOID Add(UINT32 i, UINT32 v)
+        {
+            for (; i < tree.size(); i += i & -i)
+                tree[i] += v;
+        }
+
+        UINT32 Sum(UINT32 i) const
+        {
+            UINT32 sum = 0;
+            for (; i > 0; i -= i & -i)
+                sum += tree[i];
+            return sum;
+        }
+
+        // Renumbers the marked timestamps to 1..live, leaving room for
+        // as many more accesses
+        VOID Compact(LAST_ACCESS &lastAccess)
+        {
+            std::vector<ADDRINT> compacted(std::max(64U, 2 * (live + 1)));
+            UINT32 n = 0;
+            for (UINT32 t = 1; t <= now; t++) {
+                UINT32 &last = lastAccess[blocks[t]];
+                if (last == t) {
+                    last = ++n;
+                    compacted[n] = blocks[t];
+                }
+            }
+            ASSERTX(n == live);
+            blocks.swap(compacted);
+            now = n;
+
+            // All of 1..n are marked: node i covers (i - lowbit(i), i]
+            tree.assign(blocks.size(), 0);
+            for (UINT32 i = 1; i < tree.size(); i++) {
+                const UINT32 lo = i - (i & -i);
+                tree[i] = std::min(i, n) > lo ? std::min(i, n) - lo : 0;
+            }
+        }
+
+        // Returns the stack distance of `block`, -1 if it was never seen.
+        INT64 Access(ADDRINT block, UINT32 &last, LAST_ACCESS &lastAccess)
+        {
+            INT64 distance = -1;
+            if (last) {
+                distance = live - Sum(last);
+                Add(last, UINT32(-1));
+                live--;
+                last = 0;
+            }
+
+            if (now + 1 >= tree.size())
+                Compact(lastAccess);
+            last = ++now;
+            blocks[now] = block;
+            Add(now, 1);
+            live++;
+            return distance;
+        }
+    };
+
+    const std::string _name;
+    const UINT32 _blockSize;
+    const UINT32 _numSets;
+    const UINT32 _maxAssoc;
+    const UINT32 _lineShift;
+    std::vector<SET_STACK> _sets;
+    LAST_ACCESS _lastAccess;
+
+    // _histogram[type][d] for d < maxAssoc, [type][maxAssoc] for the rest
+    std::vector<CACHE_STATS> _histogram[ACCESS_TYPE_NUM];
+    CACHE_STATS _cold[ACCESS_TYPE_NUM];
+
+    public:
+    STACK_DISTANCE(std::string name, UINT32 blockSize, UINT32 numSets, UINT32 maxAssoc)
+        : _name(name), _blockSize(blockSize), _numSets(numSets),
+          _maxAssoc(maxAssoc), _lineShift(FloorLog2(blockSize)), _sets(numSets)
+    {
+        ASSERTX(IsPowerOf2(blockSize) && IsPowerOf2(numSets));
+        ASSERTX(maxAssoc > 0);
+        for (UINT32 i = 0; i < ACCESS_TYPE_NUM; i++) {
+            _histogram[i].assign(maxAssoc + 1, 0);
+            _cold[i] = 0;
+        }
+    }
+
+    UINT32 BlockSize() const { return _blockSize; }
+    UINT32 NumSets() const { return _numSets; }
+    UINT32 MaxAssociativity() const { return _maxAssoc; }
+
+    CACHE_STATS Accesses(ACCESS_TYPE accessType) const
+    {
+        CACHE_STATS sum = _cold[accessType];
+        for (UINT32 d = 0; d <= _maxAssoc; d++)
+            sum += _histogram[accessType][d];
+        return sum;
+    }
+    CACHE_STATS Accesses() const
+    {
+        return Accesses(ACCESS_TYPE_LOAD) + Accesses(ACCESS_TYPE_STORE);
+    }
+
+    // Misses of an LRU cache with this geometry and `associativity` ways
+    CACHE_STATS Misses(ACCESS_TYPE accessType, UINT32 associativity) const
+    {
+        ASSERTX(associativity > 0 && associativity <= _maxAssoc);
+        CACHE_STATS sum = _cold[accessType];
+        for (UINT32 d = associativity; d <= _maxAssoc; d++)
+            sum += _histogram[accessType][d];
+        return sum;
+    }
+    CACHE_STATS Misses(UINT32 associativity) const
+    {
+        return Misses(ACCESS_TYPE_LOAD, associativity) +
+               Misses(ACCESS_TYPE_STORE, associativity);
+    }
+
+    UINT32 Access(ADDRINT addr, ACCESS_TYPE accessType, ADDRINT = 0, UINT32 = 0)
+    {
+        const ADDRINT block = addr >> _lineShift;
+        const INT64 distance = _sets[block & (_numSets - 1)].Access(
+            block, _lastAccess[block], _lastAccess);
+        if (distance < 0)
+            _cold[accessType]++;
+        else
+            _histogram[accessType][std::min<UINT64>(distance, _maxAssoc)]++;
+        return 0;
+    }
+
+    string PrintCache(string prefix = "") const
+    {
+        string out;
+        out += prefix + _name + ":\n";
+        out += prefix + "  Block Size(B):  " + dec2str(_blockSize, 5) + "\n";
+        out += prefix + "  Sets:           " + dec2str(_numSets, 5) + "\n";
+        out += prefix + "  Max Assoc:      " + dec2str(_maxAssoc, 5) + "\n";
+        out += "\n";
+        return out;
+    }
+
+    string StatsLong(string prefix = "") const
+    {
+        const UINT32 numberWidth = 12;
+        string out;
+
+        out += prefix + "Reuse Distance Histogram:\n";
+        out += prefix + "    Distance        Loads       Stores\n";
+        for (UINT32 d = 0; d <= _maxAssoc; d++)
+            out += prefix + (d < _maxAssoc ? "  " + dec2str(d, 10) : "  >=" + dec2str(d, 8))
+                + dec2str(_histogram[ACCESS_TYPE_LOAD][d], 13)
+                + dec2str(_histogram[ACCESS_TYPE_STORE][d], 13) + "\n";
+        out += prefix + "        cold"
+            + dec2str(_cold[ACCESS_TYPE_LOAD], 13)
+            + dec2str(_cold[ACCESS_TYPE_STORE], 13) + "\n";
+        out += prefix + "\n";
+
+        out += prefix + "Miss Ratio Curve:\n";
+        out += prefix + "  Assoc  Size(KB)  Load-Misses Store-Misses Total-Misses  Miss-Rate\n";
+        for (UINT32 a = 1; a <= _maxAssoc; a++)
+            out += prefix + dec2str(a, 7)
+                + fltstr((double)a * _numSets * _blockSize / KILO, 1, 10)
+                + dec2str(Misses(ACCESS_TYPE_LOAD, a), numberWidth + 1)
+                + dec2str(Misses(ACCESS_TYPE_STORE, a), numberWidth + 1)
+                + dec2str(Misses(a), numberWidth + 1)
+                + "  " + fltstr(100.0 * Misses(a) / Accesses(), 2, 6) + "%\n";
+        out += prefix + "\n";
+
+        return out;
+    }
+};
+
+/**
+ * Compile-time log2 of a power of 2
+ **/
+template <UINT32 N> struct LOG2 { static const UINT32 value = 1 + LOG2<N / 2>::value; };
+template <> struct LOG2<1> { static const UINT32 value = 0; };
+
+/**
+ * Geometry of a cache level: block size, number of sets, associativity and
+ * the shifts/masks derived from them.
+ * DYNAMIC computes them from the runtime parameters. STATIC takes them as
+ * template arguments, so address splitting folds to constant shifts and
+ * masks and, through rebind, the set policies see a constant associativity.
+ **/
+namespace CACHE_GEOMETRY
+{
+    class DYNAMIC
+    {
+        private:
+        UINT32 _cacheSize;
+        UINT32 _blockSize;
+        UINT32 _associativity;
+        UINT32 _lineShift;    // i.e. no of block offset bits
+        UINT32 _setIndexMask; // mask applied to get the set index
+        UINT32 _setShift;     // i.e. no of set index bits
+
+        public:
+        static const UINT32 ASSOC = 0;
+        static bool IsStatic() { return false; }
+
+        VOID Init(UINT32 cacheSize, UINT32 blockSize, UINT32 associativity)
+        {
+            _cacheSize = cacheSize;
+            _blockSize = blockSize;
+            _associativity = associativity;
+            _lineShift = FloorLog2(blockSize);
+            _setIndexMask = (cacheSize / (associativity * blockSize)) - 1;
+            _setShift = FloorLog2(_setIndexMask + 1);
+
+            // They all need to be power of 2
+            ASSERTX(IsPowerOf2(_blockSize));
+            ASSERTX(IsPowerOf2(_setIndexMask + 1));
+        }
+
+        UINT32 CacheSize() const { return _cacheSize; }
+        UINT32 BlockSize() const { return _blockSize; }
+        UINT32 Associativity() const { return _associativity; }
+        UINT32 NumSets() const { return _setIndexMask + 1; }
+        UINT32 LineShift() const { return _lineShift; }
+        UINT32 SetIndexMask() const { return _setIndexMask; }
+        UINT32 SetShift() const { return _setShift; }
+    };
+
+    template <UINT32 BLOCK_SIZE, UINT32 NUM_SETS, UINT32 ASSOCIATIVITY>
+    class STATIC
+    {
+        private:
+        // They all need to be power of 2 (array size -1 fails the build)
+        typedef char POWER_OF_2_CHECK[
+            ((BLOCK_SIZE & (BLOCK_SIZE - 1)) == 0 &&
+             (NUM_SETS & (NUM_SETS - 1)) == 0) ? 1 : -1];
+
+        public:
+        static const UINT32 ASSOC = ASSOCIATIVITY;
+        static bool IsStatic() { return true; }
+
+        VOID Init(UINT32 cacheSize, UINT32 blockSize, UINT32 associativity)
+        {
+            ASSERTX(cacheSize == CacheSize());
+            ASSERTX(blockSize == BLOCK_SIZE);
+            ASSERTX(associativity == ASSOCIATIVITY);
+        }
+
+        UINT32 CacheSize() const { return BLOCK_SIZE * NUM_SETS * ASSOCIATIVITY; }
+        UINT32 BlockSize() const { return BLOCK_SIZE; }
+        UINT32 Associativity() const { return ASSOCIATIVITY; }
+        UINT32 NumSets() const { return NUM_SETS; }
+        UINT32 LineShift() const { return LOG2<BLOCK_SIZE>::value; }
+        UINT32 SetIndexMask() const { return NUM_SETS - 1; }
+        UINT32 SetShift() const { return LOG2<NUM_SETS>::value; }
+    };
+
+} // namespace CACHE_GEOMETRY
+
+/*****************************************************************************/
+/* Hardware prefetchers                                                      */
+/*****************************************************************************/
+
+/**
+ * A prefetch engine of one cache level, chosen at runtime. It works on
+ * block numbers (address >> line shift) and is trained with the demand
+ * accesses of its level:
+ *   NEXT_LINE  on a trigger, the next `degree` blocks;
+ *   STRIDE     a PC-indexed table of last address and stride with 2-bit
+ *              confidence; when confident, `degree` strides ahead;
+ *   STREAM     up to STREAMS ascending or descending miss streams; once a
+ *              stream is confirmed (two triggers in a row in the same
+ *              direction within WINDOW blocks), each trigger advances it
+ *              by up to `degree` blocks, staying `distance` blocks ahead.
+ * Triggers are demand misses and first hits to prefetched lines, so that
+ * useful prefetches keep their stream going.
+ **/
+class PREFETCHER
+{
+    public:
+    typedef enum
+    {
+        NONE = 0,
+        NEXT_LINE,
+        STRIDE,
+        STREAM
+    } KIND;
+
+    static const UINT32 MAX_DEGREE = 16;
+
+    private:
+    static const UINT32 STRIDE_ENTRIES = 256;
+    static const UINT32 STREAMS = 16;
+    static const INT64 WINDOW = 16;
+
+    struct STRIDE_ENTRY
+    {
+        ADDRINT pc;
+        ADDRINT last;       // byte address, strides may be sub-block
+        INT64 stride;
+        UINT32 confidence;
+    };
+
+    struct STREAM_ENTRY
+    {
+        INT64 last;         // last trigger block
+        INT64 next;         // next block to prefetch
+        INT32 direction;    // 0 until known
+        UINT32 confidence;
+        UINT64 lru;
+    };
+
+    KIND _kind;
+    UINT32 _degree;
+    UINT32 _distance;
+    UINT32 _lineShift;
+    std::vector<STRIDE_ENTRY> _strides;
+    std::vector<STREAM_ENTRY> _streams;
+    UINT64 _time;
+
+    UINT32 TrainStride(ADDRINT pc, ADDRINT addr, ADDRINT *blocks)
+    {
+        if (pc == 0)
+            return 0;
+        STRIDE_ENTRY &entry = _strides[(pc ^ (pc >> 8)) % STRIDE_ENTRIES];
+        if (entry.pc != pc) {
+            entry.pc = pc;
+            entry.last = addr;
+            entry.stride = 0;
+            entry.confidence = 0;
+            return 0;
+        }
+
+        const INT64 stride = INT64(addr - entry.last);
+        entry.last = addr;
+        if (stride != 0 && stride == entry.stride) {
+            entry.confidence += (entry.confidence < 3);
+        } else {
+            if (entry.confidence > 0)
+                entry.confidence--;
+            else
+                entry.stride = stride;
+            return 0;
+        }
+        if (entry.confidence < 2)
+            return 0;
+
+        UINT32 n = 0;
+        ADDRINT prev = addr >> _lineShift;
+        for (UINT32 k = 1; k <= _degree; k++) {
+            const ADDRINT block = (addr + k * entry.stride) >> _lineShift;
+            if (block != prev)
+                blocks[n++] = prev = block;
+        }
+        return n;
+    }
+
+    UINT32 TrainStream(INT64 block, ADDRINT *blocks)
+    {
+        STREAM_ENTRY *stream = NULL, *victim = &_streams[0];
+        for (UINT32 i = 0; i < STREAMS; i++) {
+            STREAM_ENTRY &s = _streams[i];
+            const INT64 delta = block - s.last;
+            if (s.lru && delta != 0 && delta >= -WINDOW && delta <= WINDOW &&
+                (s.direction == 0 || (delta > 0) == (s.direction > 0))) {
+                stream = &s;
+                break;
+            }
+            if (s.lru < victim->lru)
+                victim = &s;
+        }
+        if (!stream) {
+            victim->last = victim->next = block;
+            victim->direction = 0;
+            victim->confidence = 0;
+            victim->lru = ++_time;
+            return 0;
+        }
+
+        const INT32 direction = block > stream->last ? 1 : -1;
+        if (stream->direction == 0) {
+            stream->direction = direction;
+            stream->next = block + direction;
+        }
+        stream->confidence += (stream->confidence < 3);
+        stream->last = block;
+        stream->lru = ++_time;
+        if (stream->confidence < 2)
+            return 0;
+
+        // Restart a stream that fell behind its triggers
+        if ((stream->next - block) * direction <= 0)
+            stream->next = block + direction;
+
+        UINT32 n = 0;
+        while (n < _degree && (stream->next - block) * direction <= (INT64)_distance) {
+            blocks[n++] = stream->next;
+            stream->next += direction;
+        }
+        return n;
+    }
+
+    public:
+    PREFETCHER() : _kind(NONE), _degree(0), _distance(0), _lineShift(0), _time(0) {}
+
+    VOID Init(KIND kind, UINT32 degree, UINT32 distance, UINT32 lineShift)
+    {
+        _kind = kind;
+        _degree = std::min(std::max(degree, 1u), MAX_DEGREE);
+        _distance = std::max(distance, _degree);
+        _lineShift = lineShift;
+        _strides.assign(kind == STRIDE ? STRIDE_ENTRIES : 0, STRIDE_ENTRY());
+        _streams.assign(kind == STREAM ? STREAMS : 0, STREAM_ENTRY());
+        for (UINT32 i = 0; i < _strides.size(); i++)
+            _strides[i].pc = 0;
+        for (UINT32 i = 0; i < _streams.size(); i++)
+            _streams[i].lru = 0;
+    }
+
+    bool Enabled() const { return _kind != NONE; }
+    UINT32 Degree() const { return _degree; }
+    UINT32 Distance() const { return _distance; }
+
+    static string Name(KIND kind)
+    {
+        switch (kind) {
+            case NEXT_LINE: return "next_line";
+            case STRIDE: return "stride";
+            case STREAM: return "stream";
+            default: return "none";
+        }
+    }
+    string Name() const { return Name(_kind); }
+
+    static bool Parse(const string &name, KIND &kind)
+    {
+        for (UINT32 k = NONE; k <= STREAM; k++)
+            if (name == Name(KIND(k))) {
+                kind = KIND(k);
+                return true;
+            }
+        return false;
+    }
+
+    /**
+     * Trains on a demand access of `pc` to `addr` (`trigger`: a miss or a
+     * first hit to a prefetched line). Writes the blocks to prefetch to
+     * `blocks` (room for MAX_DEGREE) and returns how many.
+     **/
+    UINT32 Train(ADDRINT pc, ADDRINT addr, bool trigger, ADDRINT *blocks)
+    {
+        switch (_kind) {
+            case NEXT_LINE:
+                if (!trigger)
+                    return 0;
+                for (UINT32 k = 0; k < _degree; k++)
+                    blocks[k] = (addr >> _lineShift) + k + 1;
+                return _degree;
+            case STRIDE:
+                return TrainStride(pc, addr, blocks);
+            case STREAM:
+                return trigger ? TrainStream(addr >> _lineShift, blocks) : 0;
+            default:
+                return 0;
+        }
+    }
+};
+
+// Counters of the prefetches of one level
+struct PREFETCH_STATS
+{
+    CACHE_STATS issued;     // fills of blocks not already in the level
+    CACHE_STATS useful;     // later hit by a demand access
+    CACHE_STATS late;       // useful, but hit before the fill completed
+    CACHE_STATS useless;    // evicted without a demand hit
+
+    VOID Add(const PREFETCH_STATS &other)
+    {
+        issued += other.issued;
+        useful += other.useful;
+        late += other.late;
+        useless += other.useless;
+    }
+};
+
+// `part` as a percentage of `whole`, 0 when there is no whole (a
+// prefetcher that issued nothing, a TLB never looked up)
+static inline double Percent(CACHE_STATS part, CACHE_STATS whole)
+{
+    return whole ? 100.0 * part / whole : 0.0;
+}
+
+/**
+ * The "<level> Cache Stats" block of StatsLong, from hit/miss counters
+ * indexed [ACCESS_TYPE_LOAD/STORE][hit].
+ **/
+static inline string LevelStatsLong(const string &prefix, const string &level,
+                                    const CACHE_STATS access[][2])
+{
+    const UINT32 headerWidth = 19;
+    const UINT32 numberWidth = 12;
+
+    CACHE_STATS total[2] = { 0, 0 };
+    string out;
+
+    out += prefix + level + " Cache Stats:" + "\n";
+
+    for (UINT32 accessType = 0; accessType < 2; accessType++)
+    {
+        const std::string type(level + (accessType == 0 ? "-Load" : "-Store"));
+        const CACHE_STATS hits = access[accessType][true];
+        const CACHE_STATS misses = access[accessType][false];
+        const CACHE_STATS accesses = hits + misses;
+        total[true] += hits;
+        total[false] += misses;
+
+        out += prefix + ljstr(type + "-Hits:      ", headerWidth)
+            + dec2str(hits, numberWidth)  +
+            "  " +fltstr(100.0 * hits / accesses, 2, 6) + "%\n";
+
+        out += prefix + ljstr(type + "-Misses:    ", headerWidth)
+            + dec2str(misses, numberWidth) +
+            "  " +fltstr(100.0 * misses / accesses, 2, 6) + "%\n";
+
+        out += prefix + ljstr(type + "-Accesses:  ", headerWidth)
+            + dec2str(accesses, numberWidth) +
+            "  " +fltstr(100.0 * accesses / accesses, 2, 6) + "%\n";
+
+        out += prefix + "\n";
+    }
+
+    const CACHE_STATS accesses = total[true] + total[false];
+
+    out += prefix + ljstr(level + "-Total-Hits:      ", headerWidth)
+        + dec2str(total[true], numberWidth) +
+        "  " +fltstr(100.0 * total[true] / accesses, 2, 6) + "%\n";
+
+    out += prefix + ljstr(level + "-Total-Misses:    ", headerWidth)
+        + dec2str(total[false], numberWidth) +
+        "  " +fltstr(100.0 * total[false] / accesses, 2, 6) + "%\n";
+
+    out += prefix + ljstr(level + "-Total-Accesses:  ", headerWidth)
+        + dec2str(accesses, numberWidth) +
+        "  " +fltstr(100.0 * accesses / accesses, 2, 6) + "%\n";
+    out += prefix + "\n";
+
+    return out;
+}
+
+/**
+ * The "<level> Prefetcher Stats" block of StatsLong. Coverage is the share
+ * of the would-be demand misses (`misses` plus the useful prefetches)
+ * that prefetching removed, timeliness the share of useful prefetches
+ * that completed before their first use.
+ **/
+static inline string PrefetchStatsLong(const string &prefix, const string &level,
+                                       const PREFETCH_STATS &stats, CACHE_STATS misses)
+{
+    const UINT32 headerWidth = 27;
+    const UINT32 numberWidth = 12;
+    string out;
+
+    out += prefix + level + " Prefetcher Stats:\n";
+    out += prefix + ljstr(level + "-Prefetch-Issued:", headerWidth)
+        + dec2str(stats.issued, numberWidth) + "\n";
+    out += prefix + ljstr(level + "-Prefetch-Useful:", headerWidth)
+        + dec2str(stats.useful, numberWidth) + "\n";
+    out += prefix + ljstr(level + "-Prefetch-Late:", headerWidth)
+        + dec2str(stats.late, numberWidth) + "\n";
+    out += prefix + ljstr(level + "-Prefetch-Useless:", headerWidth)
+        + dec2str(stats.useless, numberWidth) + "\n";
+    out += prefix + ljstr(level + "-Prefetch-Accuracy:", headerWidth)
+        + fltstr(Percent(stats.useful, stats.issued), 2, numberWidth) + "%\n";
+    out += prefix + ljstr(level + "-Prefetch-Coverage:", headerWidth)
+        + fltstr(Percent(stats.useful, stats.useful + misses), 2, numberWidth) + "%\n";
+    out += prefix + ljstr(level + "-Prefetch-Timeliness:", headerWidth)
+        + fltstr(Percent(stats.useful - stats.late, stats.useful), 2, numberWidth) + "%\n";
+    out += prefix + "\n";
+
+    return out;
+}
+
+/**
+ * The "<level> Fetch Stats" block of StatsLong: hits and misses of
+ * instruction fetches indexed [hit], and their misses per thousand of the
+ * `instructions` fetched.
+ **/
+static inline string FetchStatsLong(const string &prefix, const string &level,
+                                    const CACHE_STATS fetch[2], CACHE_STATS instructions)
+{
+    const UINT32 headerWidth = 21;
+    const UINT32 numberWidth = 12;
+    const string type(level + "-Fetch");
+    const CACHE_STATS accesses = fetch[true] + fetch[false];
+    string out;
+
+    out += prefix + level + " Fetch Stats:\n";
+    out += prefix + ljstr(type + "-Hits:", headerWidth) + dec2str(fetch[true], numberWidth)
+        + "  " + fltstr(Percent(fetch[true], accesses), 2, 6) + "%\n";
+    out += prefix + ljstr(type + "-Misses:", headerWidth) + dec2str(fetch[false], numberWidth)
+        + "  " + fltstr(Percent(fetch[false], accesses), 2, 6) + "%\n";
+    out += prefix + ljstr(type + "-Accesses:", headerWidth) + dec2str(accesses, numberWidth)
+        + "  " + fltstr(Percent(accesses, accesses), 2, 6) + "%\n";
+    out += prefix + ljstr(type + "-MPKI:", headerWidth)
+        + fltstr(instructions ? 1000.0 * fetch[false] / instructions : 0.0, 3, numberWidth) + "\n";
+    out += prefix + "\n";
+
+    return out;
+}
+
+/**
+ * Optional L1 instruction cache in front of the unified L2 of a hierarchy
+ * (see TWO_LEVEL_CACHE::Fetch). It is fed whole basic blocks, one lookup
+ * per cache line they span, and counts their instructions for the MPKI.
+ * Hits are free (a pipelined front end hides them), misses cost what the
+ * levels below take. Code is never written, so the inclusive L2 only has
+ * to drop the blocks it evicts from it.
+ **/
+template <class SET>
+class INSTRUCTION_CACHE
+{
+    private:
+    CACHE_GEOMETRY::DYNAMIC _geometry;
+    SET _sets;
+    bool _enabled;
+    CACHE_STATS _access[2]; // [hit]
+    CACHE_STATS _instructions;
+
+    public:
+    INSTRUCTION_CACHE() : _enabled(false) { ResetStats(); }
+
+    VOID Init(UINT32 cacheSize, UINT32 blockSize, UINT32 associativity)
+    {
+        _geometry.Init(cacheSize, blockSize, associativity);
+        _sets.Init(_geometry.NumSets(), associativity);
+        _enabled = true;
+    }
+
+    bool Enabled() const { return _enabled; }
+    UINT32 BlockSize() const { return _geometry.BlockSize(); }
+    UINT32 LineShift() const { return _geometry.LineShift(); }
+    CACHE_STATS Instructions() const { return _instructions; }
+
+    VOID CountInstructions(UINT32 numInstructions) { _instructions += numInstructions; }
+
+    // Looks up the line of `addr`, allocating it on a miss; true on a hit
+    bool Access(ADDRINT addr)
+    {
+        CACHE_TAG tag = addr >> _geometry.LineShift();
+        const UINT32 setIndex = tag & _geometry.SetIndexMask();
+        tag = tag >> _geometry.SetShift();
+        _sets.SetPc(addr);
+        const bool hit = _sets.Find(setIndex, tag);
+        _access[hit]++;
+        if (!hit)
+            _sets.Replace(setIndex, tag);
+        return hit;
+    }
+
+    // Drops the lines of the `size` bytes at `addr`
+    VOID Invalidate(ADDRINT addr, UINT32 size)
+    {
+        for (UINT32 i = 0; i < size; i += _geometry.BlockSize()) {
+            CACHE_TAG tag = (addr + i) >> _geometry.LineShift();
+            const UINT32 setIndex = tag & _geometry.SetIndexMask();
+            _sets.DeleteIfPresent(setIndex, tag >> _geometry.SetShift());
+        }
+    }
+
+    VOID ResetStats()
+    {
+        _access[false] = _access[true] = 0;
+        _instructions = 0;
+        _sets.ResetStats();
+    }
+
+    VOID AddStats(const INSTRUCTION_CACHE &other)
+    {
+        _access[false] += other._access[false];
+        _access[true] += other._access[true];
+        _instructions += other._instructions;
+        _sets.AddStats(other._sets);
+    }
+
+    string PrintCache(const string &prefix) const
+    {
+        string out;
+        out += prefix + "  L1-Instruction Cache:\n";
+        out += prefix + "    Size(KB):       " + dec2str(_geometry.CacheSize()/KILO, 5) + "\n";
+        out += prefix + "    Block Size(B):  " + dec2str(_geometry.BlockSize(), 5) + "\n";
+        out += prefix + "    Associativity:  " + dec2str(_geometry.Associativity(), 5) + "\n";
+        out += prefix + "\n";
+        return out;
+    }
+
+    string SetsName(const string &prefix) const
+    {
+        return prefix + "L1I-Sets: " + _sets.Name() + " assoc: " +
+            dec2str(_sets.GetAssociativity(), 3) + "\n";
+    }
+
+    string StatsLong(const string &prefix) const
+    {
+        return FetchStatsLong(prefix, "L1I", _access, _instructions);
+    }
+
+    string PolicyStatsLong(const string &prefix) const
+    {
+        return _sets.StatsLong(prefix, "L1I");
+    }
+};
+
+/*****************************************************************************/
+/* Data TLB                                                                  */
+/*****************************************************************************/
+
+static const UINT32 TLB_MAX_HUGE_RANGES = 16;
+
+/**
+ * Geometry of the data TLBs, entries and associativity of each: an L1
+ * DTLB for 4KB pages, one for 2MB pages and a second level STLB shared by
+ * both sizes. Written as `<4KB>:<2MB>:<STLB>`, each `<entries>_<assoc>`,
+ * e.g. `64_4:32_4:1536_12` (Skylake). Zero-initialized there is no TLB.
+ **/
+struct TLB_CONFIG
+{
+    UINT32 l1Entries, l1Assoc;
+    UINT32 l1HugeEntries, l1HugeAssoc;
+    UINT32 l2Entries, l2Assoc;
+    // Address ranges [hugeStart, hugeEnd) mapped with 2MB pages
+    ADDRINT hugeStart[TLB_MAX_HUGE_RANGES], hugeEnd[TLB_MAX_HUGE_RANGES];
+    UINT32 numHuge;
+
+    bool Enabled() const { return l1Entries != 0; }
+
+    bool Parse(const string &str)
+    {
+        return sscanf(str.c_str(), "%u_%u:%u_%u:%u_%u", &l1Entries, &l1Assoc,
+                      &l1HugeEntries, &l1HugeAssoc, &l2Entries, &l2Assoc) == 6 && Valid();
+    }
+
+    // `<start>-<end>` in hex, or `all`
+    bool AddHugeRange(const string &str)
+    {
+        if (numHuge == TLB_MAX_HUGE_RANGES)
+            return false;
+        unsigned long long start = 0, end = ~0ULL;
+        if (str != "all" && (sscanf(str.c_str(), "%llx-%llx", &start, &end) != 2 || start >= end))
+            return false;
+        hugeStart[numHuge] = start;
+        hugeEnd[numHuge++] = end;
+        return true;
+    }
+
+    bool Valid() const
+    {
+        const UINT32 entries[3] = { l1Entries, l1HugeEntries, l2Entries };
+        const UINT32 assoc[3] = { l1Assoc, l1HugeAssoc, l2Assoc };
+        for (UINT32 i = 0; i < 3; i++)
+            if (!assoc[i] || entries[i] % assoc[i] || !IsPowerOf2(entries[i] / assoc[i]))
+                return false;
+        return true;
+    }
+};
+
+// One level of TLB: set-associative, LRU, tagged by page number
+class TLB_LEVEL
+{
+    private:
+    CACHE_SET::LRU _entries;
+    UINT32 _numEntries, _setMask, _setShift;
+
+    public:
+    CACHE_STATS access[2]; // [hit]
+
+    VOID Init(UINT32 numEntries, UINT32 associativity)
+    {
+        const UINT32 numSets = numEntries / associativity;
+        _entries.Init(numSets, associativity);
+        _numEntries = numEntries;
+        _setMask = numSets - 1;
+        _setShift = FloorLog2(numSets);
+    }
+
+    // Looks up `page`, allocating it on a miss; true on a hit
+    bool Access(ADDRINT page)
+    {
+        const UINT32 set = page & _setMask;
+        const CACHE_TAG tag(page >> _setShift);
+        const bool hit = _entries.Find(set, tag);
+        access[hit]++;
+        if (!hit)
+            _entries.Replace(set, tag);
+        return hit;
+    }
+
+    string Print() const
+    {
+        return dec2str(_numEntries, 1) + "x" + dec2str(_entries.GetAssociativity(), 1);
+    }
+};
+
+/**
+ * Data TLBs in front of a cache hierarchy (see TWO_LEVEL_CACHE::SetTlb).
+ * An L1 DTLB hit is free, as it overlaps with the L1 cache lookup; an
+ * STLB lookup costs STLB_LATENCY, and an STLB miss walks the x86-64 page
+ * table: a load per level, PML4 to PT (to PD for a 2MB page), through the
+ * data caches. Those loads are counted apart from the demand accesses
+ * and neither train the prefetchers nor set the PC of the replacement
+ * policies (see CACHE_HIERARCHY::WalkAccess). The page tables are laid out as flat arrays of 8-byte
+ * entries, one per level, far above user space, so that neighbouring
+ * pages share the cache lines of their entries as they do in a real
+ * radix tree. Both TLB levels fill on a miss.
+ **/
+class DATA_TLB
+{
+    public:
+    static const UINT32 STLB_LATENCY = 9;
+
+    private:
+    static const UINT32 PAGE_SHIFT = 12;
+    static const UINT32 HUGE_PAGE_SHIFT = 21;
+
+    TLB_CONFIG _config;
+    TLB_LEVEL _l1, _l1Huge, _stlb;
+    CACHE_STATS _walks, _walkCycles;
+
+    bool IsHuge(ADDRINT addr) const
+    {
+        for (UINT32 i = 0; i < _config.numHuge; i++)
+            if (addr >= _config.hugeStart[i] && addr < _config.hugeEnd[i])
+                return true;
+        return false;
+    }
+
+    // Address of the entry translating `addr` in page table level `level`, 0 for PML4
+    static ADDRINT EntryAddress(ADDRINT addr, UINT32 level)
+    {
+        const UINT32 shift = 39 - 9 * level;
+        return (ADDRINT(0xfff0 + level) << 44) + ((addr & ((1ULL << 48) - 1)) >> shift) * 8;
+    }
+
+    string Stats(const string &prefix, const string &name, const TLB_LEVEL &level,
+                 UINT64 instructions) const
+    {
+        const UINT32 headerWidth = 21;
+        const UINT32 numberWidth = 12;
+        const CACHE_STATS accesses = level.access[false] + level.access[true];
+        string out;
+        out += prefix + ljstr(name + "-Hits:", headerWidth) + dec2str(level.access[true], numberWidth)
+            + "  " + fltstr(Percent(level.access[true], accesses), 2, 6) + "%\n";
+        out += prefix + ljstr(name + "-Misses:", headerWidth) + dec2str(level.access[false], numberWidth)
+            + "  " + fltstr(Percent(level.access[false], accesses), 2, 6) + "%\n";
+        if (instructions)
+            out += prefix + ljstr(name + "-MPKI:", headerWidth)
+                + fltstr(1000.0 * level.access[false] / instructions, 3, numberWidth) + "\n";
+        return out;
+    }
+
+    public:
+    DATA_TLB() { memset(&_config, 0, sizeof(_config)); }
+
+    VOID Init(const TLB_CONFIG &config)
+    {
+        ASSERTX(config.Valid());
+        _config = config;
+        _l1.Init(config.l1Entries, config.l1Assoc);
+        _l1Huge.Init(config.l1HugeEntries, config.l1HugeAssoc);
+        _stlb.Init(config.l2Entries, config.l2Assoc);
+        ResetStats();
+    }
+
+    bool Enabled() const { return _config.Enabled(); }
+
+    /**
+     * Returns the cycles to translate `addr`, walking the page table with
+     * `cache.WalkAccess(entryAddress)` on an STLB miss.
+     **/
+    template <class CACHE>
+    UINT32 Translate(ADDRINT addr, CACHE &cache)
+    {
+        const bool huge = IsHuge(addr);
+        const ADDRINT page = addr >> (huge ? HUGE_PAGE_SHIFT : PAGE_SHIFT);
+        if ((huge ? _l1Huge : _l1).Access(page))
+            return 0;
+
+        // The page size is part of the STLB tag
+        UINT32 cycles = STLB_LATENCY;
+        if (_stlb.Access((page << 1) | huge))
+            return cycles;
+
+        UINT32 walkCycles = 0;
+        for (UINT32 level = 0; level < (huge ? 3U : 4U); level++)
+            walkCycles += cache.WalkAccess(EntryAddress(addr, level));
+        _walks++;
+        _walkCycles += walkCycles;
+        return cycles + walkCycles;
+    }
+
+    VOID ResetStats()
+    {
+        _l1.access[false] = _l1.access[true] = 0;
+        _l1Huge.access[false] = _l1Huge.access[true] = 0;
+        _stlb.access[false] = _stlb.access[true] = 0;
+        _walks = _walkCycles = 0;
+    }
+
+    VOID AddStats(const DATA_TLB &other)
+    {
+        for (UINT32 hit = 0; hit < 2; hit++) {
+            _l1.access[hit] += other._l1.access[hit];
+            _l1Huge.access[hit] += other._l1Huge.access[hit];
+            _stlb.access[hit] += other._stlb.access[hit];
+        }
+        _walks += other._walks;
+        _walkCycles += other._walkCycles;
+    }
+
+    // The PrintCache line of the TLBs
+    string Print(const string &prefix) const
+    {
+        string out = prefix + "DTLB: 4KB " + _l1.Print() + " 2MB " + _l1Huge.Print() +
+            " STLB " + _stlb.Print() + " latency: " + dec2str(STLB_LATENCY, 1) + "\n";
+        out += prefix + "Huge_pages:";
+        if (!_config.numHuge)
+            out += " none";
+        for (UINT32 i = 0; i < _config.numHuge; i++)
+            out += " " + hexstr(_config.hugeStart[i]) + "-" + hexstr(_config.hugeEnd[i]);
+        return out + "\n";
+    }
+
+    // MPKI over `instructions`, if given; `walks` are the hit/miss lines of
+    // the walk loads in the caches
+    string StatsLong(const string &prefix, UINT64 instructions, const string &walks) const
+    {
+        const UINT32 headerWidth = 21;
+        const UINT32 numberWidth = 12;
+        string out = prefix + "DTLB Stats:\n";
+        out += Stats(prefix, "L1-DTLB-4KB", _l1, instructions);
+        out += Stats(prefix, "L1-DTLB-2MB", _l1Huge, instructions);
+        out += Stats(prefix, "STLB", _stlb, instructions);
+        out += prefix + ljstr("Page-Walks:", headerWidth) + dec2str(_walks, numberWidth) + "\n";
+        out += prefix + ljstr("Walk-Cycles:", headerWidth) + dec2str(_walkCycles, numberWidth)
+            + "  " + fltstr(_walks ? (double)_walkCycles / _walks : 0.0, 2, 6) + " per walk\n";
+        out += walks;
+        out += prefix + "\n";
+        return out;
+    }
+};
+
+/*****************************************************************************/
+/* Writes                                                                    */
+/*****************************************************************************/
+
+typedef enum
+{
+    WRITE_BACK = 0,
+    WRITE_THROUGH
+} WRITE_POLICY;
+
+/**
+ * Write handling of a TWO_LEVEL_CACHE (see SetWrites): store allocation,
+ * the write policy of each level and the write buffer below L1.
+ * Zero-initialized it is off: stores allocate as STORE_ALLOCATION says,
+ * and neither dirty lines nor traffic are tracked.
+ **/
+struct WRITE_CONFIG
+{
+    bool enabled;
+    bool storeAllocate;
+    WRITE_POLICY l1Policy, l2Policy;
+    UINT32 bufferEntries; // 0 for no write buffer
+
+    // `wb` or `wt`
+    static bool ParsePolicy(const string &str, WRITE_POLICY &policy)
+    {
+        if (str == "wb")
+            policy = WRITE_BACK;
+        else if (str == "wt")
+            policy = WRITE_THROUGH;
+        else
+            return false;
+        return true;
+    }
+
+    static const char *PolicyName(WRITE_POLICY policy)
+    {
+        return policy == WRITE_BACK ? "write-back" : "write-through";
+    }
+};
+
+/**
+ * Coalescing write buffer between L1 and L2: a FIFO of L1 blocks, each
+ * with a mask of the bytes stores wrote to it. A store to a block already
+ * buffered merges into it; one to a new block when the buffer is full
+ * drains the oldest block to L2, as many bytes as it has written. The
+ * caches see a store that crosses the end of its block as an access to
+ * that block alone, so only its bytes in that block count.
+ **/
+class WRITE_BUFFER
+{
+    public:
+    static const UINT32 MAX_ENTRIES = 64;
+    static const UINT32 MAX_BLOCK_SIZE = 512;
+
+    private:
+    static const UINT32 MASK_WORDS = MAX_BLOCK_SIZE / 64;
+    ADDRINT _block[MAX_ENTRIES];
+    UINT64 _bytes[MAX_ENTRIES][MASK_WORDS];  // written bytes of each block
+    UINT32 _head, _num, _entries;
+    UINT32 _lineShift;
+
+    // Sets bits [first, last) of `mask`
+    static VOID SetBytes(UINT64 *mask, UINT32 first, UINT32 last)
+    {
+        while (first < last) {
+            const UINT32 bit = first % 64;
+            const UINT32 n = std::min(64 - bit, last - first);
+            mask[first / 64] |= (n == 64 ? ~0ULL : ((1ULL << n) - 1) << bit);
+            first += n;
+        }
+    }
+
+    public:
+    CACHE_STATS writes, coalesced;
+
+    WRITE_BUFFER() : _head(0), _num(0), _entries(0), _lineShift(0) {}
+
+    VOID Init(UINT32 entries, UINT32 lineShift)
+    {
+        ASSERTX(entries <= MAX_ENTRIES && (1U << lineShift) <= MAX_BLOCK_SIZE);
+        _entries = entries;
+        _lineShift = lineShift;
+        _head = _num = 0;
+    }
+
+    UINT32 Entries() const { return _entries; }
+
+    /**
+     * Buffers a store of `size` bytes to `addr`. Returns the bytes written
+     * to L2 as a result, those of the store itself without a buffer, with
+     * `drainedAddr` their block.
+     **/
+    UINT32 Write(ADDRINT addr, UINT32 size, ADDRINT &drainedAddr)
+    {
+        writes++;
+        const ADDRINT block = addr >> _lineShift;
+        const UINT32 blockSize = 1U << _lineShift;
+        const UINT32 first = addr & (blockSize - 1);
+        const UINT32 last = std::min(first + size, blockSize);
+        if (!_entries) {
+            drainedAddr = addr;
+            return last - first;
+        }
+
+        for (UINT32 i = 0; i < _num; i++) {
+            const UINT32 e = (_head + i) % _entries;
+            if (_block[e] == block) {
+                coalesced++;
+                SetBytes(_bytes[e], first, last);
+                return 0;
+            }
+        }
+
+        UINT32 bytes = 0;
+        if (_num == _entries) {
+            drainedAddr = _block[_head] << _lineShift;
+            for (UINT32 w = 0; w < MASK_WORDS; w++)
+                bytes += __builtin_popcountll(_bytes[_head][w]);
+            _head = (_head + 1) % _entries;
+            _num--;
+        }
+        const UINT32 tail = (_head + _num++) % _entries;
+        _block[tail] = block;
+        memset(_bytes[tail], 0, sizeof(_bytes[tail]));
+        SetBytes(_bytes[tail], first, last);
+        return bytes;
+    }
+
+    VOID ResetStats() { writes = coalesced = 0; }
+};
+
+/*****************************************************************************/
+/* Inclusion                                                                 */
+/*****************************************************************************/
+
+/**
+ * What a level of a CACHE_HIERARCHY (e.g. the L2 of a TWO_LEVEL_CACHE)
+ * holds of the content of the levels above:
+ *   INCLUSIVE  all of it: its evictions back-invalidate them;
+ *   EXCLUSIVE  none of it: its hits move the block up to the level above,
+ *              misses fill that level only, and it is filled by that
+ *              level's victims (clean or dirty);
+ *   NINE       whatever is left (non-inclusive, non-exclusive): the levels
+ *              fill on a miss and evict independently.
+ * Each CACHE_LEVEL_CONFIG carries the policy of its level; an INCLUSION
+ * (see CACHE_CONFIG) picks the one of L2 at runtime. Without one,
+ * L2_INCLUSIVE decides between INCLUSIVE and NINE.
+ **/
+struct INCLUSION
+{
+    typedef enum
+    {
+        INCLUSIVE = 0,
+        EXCLUSIVE,
+        NINE
+    } KIND;
+
+    static const KIND BUILD_DEFAULT = L2_INCLUSIVE == 1 ? INCLUSIVE : NINE;
+
+    bool enabled; // picked at runtime, reported in "Inclusion Stats"
+    KIND kind;
+
+    KIND Kind() const
+    {
+        if (enabled)
+            return kind;
+        return BUILD_DEFAULT;
+    }
+
+    static string Name(KIND kind)
+    {
+        switch (kind) {
+            case INCLUSIVE: return "inclusive";
+            case EXCLUSIVE: return "exclusive";
+            default: return "nine";
+        }
+    }
+
+    static bool Parse(const string &name, KIND &kind)
+    {
+        for (UINT32 k = INCLUSIVE; k <= NINE; k++)
+            if (name == Name(KIND(k))) {
+                kind = KIND(k);
+                return true;
+            }
+        return false;
+    }
+};
+
+/*****************************************************************************/
+/* Cache hierarchy                                                           */
+/*****************************************************************************/
+
+/**
+ * Geometry, hit latency and inclusion of one CACHE_HIERARCHY level.
+ **/
+struct CACHE_LEVEL_CONFIG
+{
+    UINT32 cacheSize;     // in bytes
+    UINT32 blockSize;
+    UINT32 associativity;
+    UINT32 latency;       // cycles added by every access that reaches the level
+    INCLUSION::KIND inclusion; // of the levels above; ignored for L1
+};
+
+static const UINT32 CACHE_HIERARCHY_MAX_LEVELS = 8;
+
+/**
+ * How a level reaches the levels above it, whose types it does not know:
+ * `invalidate(owner, addr, size, level)` drops the `size` bytes at `addr`,
+ * evicted by the inclusive `level`, from every level above it and from the
+ * L1I, and returns the bytes of dirty copies that left with them.
+ **/
+struct CACHE_ABOVE
+{
+    VOID *owner;
+    UINT32 (*invalidate)(VOID *owner, ADDRINT addr, UINT32 size, UINT32 level);
+};
+
+// One demand access or instruction fetch on its way down a CACHE_LEVEL chain
+struct CACHE_REQUEST
+{
+    UINT64 now;        // cycle it was issued at, for prefetch fill times
+    UINT32 served;     // 1 for L1, the number of levels + 1 for memory
+    UINT32 triggers;   // bit `level`: it triggers that level's prefetcher
+    bool allocated;    // the level above allocated the block
+    UINT8 dirty;       // of a block moving up from an EXCLUSIVE level
+};
+
+// The PrintCache lines of a CACHE_LEVEL chain, section by section
+struct CACHE_PRINT
+{
+    string geometry, latencies, sets, writes, inclusion, prefetchers, degree;
+};
+
+// The end of a CACHE_LEVEL chain: whatever reaches it goes to memory
+class MAIN_MEMORY
+{
+    private:
+    UINT32 _latency;
+    UINT32 _level;  // below the last cache level
+    CACHE_STATS _prefetch_requests;
+
+    public:
+    static const UINT32 DEPTH = 0;
+
+    VOID Init(const CACHE_LEVEL_CONFIG *, UINT32 level, UINT32 latency, const CACHE_ABOVE &)
+    {
+        _level = level;
+        _latency = latency;
+        _prefetch_requests = 0;
+    }
+
+    static bool IsStatic() { return true; }
+    bool Exclusive() const { return false; }
+    string Name() const { return "Memory"; }
+    UINT32 Latency() const { return _latency; }
+
+    VOID SetPc(ADDRINT) {}
+    VOID SetPrefetchers(const PREFETCHER::KIND *, UINT32, UINT32, bool) {}
+    VOID SetWrites(const WRITE_POLICY *, bool) {}
+
+    UINT32 Access(ADDRINT, UINT32, CACHE_REQUEST &request)
+    {
+        request.served = _level;
+        return _latency;
+    }
+
+    UINT64 PrefetchFill(ADDRINT, UINT64 ready, UINT64 &)
+    {
+        _prefetch_requests++;
+        return ready + _latency;
+    }
+
+    VOID Prefetch(ADDRINT, ADDRINT, const CACHE_REQUEST &, UINT32) {}
+    VOID CountPrefetch(bool) {}
+    VOID Write(ADDRINT, UINT32) {}
+    VOID VictimFill(ADDRINT, UINT8) {}
+    UINT32 Invalidate(ADDRINT, UINT32, UINT32) { return 0; }
+    bool Holds(ADDRINT) const { return false; }
+    VOID Occupancy(UINT64 *, UINT64 &) const {}
+    UINT64 CacheSize() const { return 0; }
+
+    VOID ResetStats() { _prefetch_requests = 0; }
+    VOID AddStats(const MAIN_MEMORY &other) { _prefetch_requests += other._prefetch_requests; }
+    CACHE_STATS Misses(UINT32) const { return 0; }
+    CACHE_STATS BackInvalidations() const { return 0; }
+    CACHE_STATS VictimFills() const { return 0; }
+    string LevelStats(const string &, const CACHE_STATS *) const { return ""; }
+    string PolicyStats(const string &) const { return ""; }
+    string WalkStats(const string &) const { return ""; }
+    string PrefetchStats(const string &) const { return ""; }
+
+    string PrefetchTraffic(const string &prefix, CACHE_STATS demand) const
+    {
+        return prefix + ljstr("Memory-Prefetch-Requests:", 27)
+            + dec2str(_prefetch_requests, 12) + "  "
+            + fltstr(Percent(_prefetch_requests, demand), 2, 6) + "% of demand\n";
+    }
+
+    string Writebacks(const string &) const { return ""; }
+    string WriteTraffic(const string &) const { return ""; }
+    VOID Print(const string &, CACHE_PRINT &) const {}
+};
+
+/**
+ * One level of a CACHE_HIERARCHY, with replacement policy SET and a
+ * runtime or compile-time GEOMETRY, in front of NEXT (the rest of the
+ * levels). Misses go down the chain through plain member calls, which the
+ * compiler inlines into one function per hierarchy.
+ *
+ * On a miss the level allocates before asking the levels below, so that
+ * their back-invalidations may free its ways. L1 allocates stores as
+ * STORE_ALLOCATION (or SetWrites) says, the others always allocate, unless
+ * they are EXCLUSIVE and the level above took the block. Instruction
+ * fetches (ACCESS_FETCH) only reach the levels below L1, are counted apart
+ * and see every level as NINE. TLB walk loads (ACCESS_WALK) are loads
+ * counted apart.
+ *
+ * The prefetcher, the per-line prefetch fill times and dirty bits, the
+ * writebacks and the traffic to and from the level below are the level's
+ * own; CACHE_HIERARCHY turns them on.
+ **/
+template <class SET, class NEXT = MAIN_MEMORY, class GEOMETRY = CACHE_GEOMETRY::DYNAMIC>
+class CACHE_LEVEL
+{
+    public:
+    typedef SET POLICY;
+    static const UINT32 DEPTH = NEXT::DEPTH + 1;
+    static const UINT32 ACCESS_FETCH = 2;
+    static const UINT32 ACCESS_WALK = 3;  // a page table load of a TLB walk
+
+    private:
+    static const UINT32 ACCESS_STORE = 1;
+    static const UINT32 ACCESS_KIND_NUM = 4;
+    static const UINT32 HIT_MISS_NUM = 2;
+    CACHE_STATS _access[ACCESS_KIND_NUM][HIT_MISS_NUM]; // [load/store/fetch/walk][hit]
+
+    typedef typename SET::template rebind<GEOMETRY::ASSOC>::type LEVEL_SET;
+    GEOMETRY _geometry;
+    LEVEL_SET _sets;
+    NEXT _next;
+    CACHE_ABOVE _above;
+    UINT32 _level;                        // 1 for L1
+    UINT32 _latency;
+    INCLUSION::KIND _inclusion;
+    bool _store_allocate;
+
+    // Prefetching; the per-line array is only allocated when enabled
+    PREFETCHER _prefetcher;
+    UINT64 *_prefetched;    // per line: fill completion + 1, 0 if not an unused prefetch
+    // In _prefetched: the prefetch took over an unused one of the level
+    // below, which is useful or useless with it
+    static const UINT64 FROM_NEXT = 1ULL << 63;
+    PREFETCH_STATS _prefetch;
+    CACHE_STATS _prefetch_requests;       // prefetches of the levels above looked up here
+
+    // Writes; the per-line dirty bits are only allocated when tracked
+    WRITE_POLICY _write_policy;
+    UINT8 *_dirty;
+    CACHE_STATS _writebacks;
+    CACHE_STATS _fill_bytes, _write_bytes; // from the level below, to it
+
+    CACHE_STATS _back_invalidations;      // blocks dropped by evictions below
+    CACHE_STATS _victim_fills;            // victims of the level above moved here
+
+    CACHE_LEVEL(const CACHE_LEVEL &);            // not copyable
+    CACHE_LEVEL &operator=(const CACHE_LEVEL &);
+
+    VOID SplitAddress(ADDRINT addr, CACHE_TAG &tag, UINT32 &setIndex) const
+    {
+        tag = addr >> _geometry.LineShift();
+        setIndex = tag & _geometry.SetIndexMask();
+        tag = tag >> _geometry.SetShift();
+    }
+
+    ADDRINT Address(UINT32 set, CACHE_TAG tag) const
+    {
+        return ((ADDRINT(tag) << _geometry.SetShift()) | set) << _geometry.LineShift();
+    }
+
+    UINT32 Line(UINT32 set, CACHE_TAG tag) const { return set * _geometry.Associativity() + _sets.Way(set, tag); }
+    UINT64 NumLines() const { return (UINT64)_geometry.NumSets() * _geometry.Associativity(); }
+
+    /**
+     * A demand hit on `line`: if the line is an unused prefetch, counts it
+     * as useful (waiting for its fill if needed) and returns true, a
+     * prefetcher trigger.
+     **/
+    bool UsePrefetch(UINT32 line, const CACHE_REQUEST &request, UINT32 &cycles)
+    {
+        const UINT64 entry = _prefetched[line];
+        if (!entry)
+            return false;
+        _prefetched[line] = 0;
+        _prefetch.useful++;
+        if (entry & FROM_NEXT)
+            _next.CountPrefetch(true);
+        const UINT64 ready = (entry & ~FROM_NEXT) - 1;
+        if (ready > request.now) {
+            _prefetch.late++;
+            cycles += ready - request.now;
+        }
+        return true;
+    }
+
+    // `line` gets a new block; `entry` as in _prefetched
+    VOID Refill(UINT32 line, UINT64 entry)
+    {
+        if (_prefetched[line]) {
+            _prefetch.useless++;
+            if (_prefetched[line] & FROM_NEXT)
+                _next.CountPrefetch(false);
+        }
+        _prefetched[line] = entry;
+    }
+
+    // `bytes` of the block of `addr` leave for the level below
+    VOID WriteBelow(ADDRINT addr, UINT32 bytes)
+    {
+        _write_bytes += bytes;
+        _next.Write(addr, bytes);
+    }
+
+    /**
+     * Allocates the block (set, tag), a prefetch if `entry` (as in
+     * _prefetched), and returns the tag it replaced. A dirty victim is
+     * written back, after an inclusive level has dropped it from the levels
+     * above (whose dirty copies leave with it). Above an EXCLUSIVE level,
+     * Exchange() does the write accounting instead.
+     **/
+    CACHE_TAG Fill(UINT32 set, CACHE_TAG tag, UINT64 entry)
+    {
+        const CACHE_TAG replaced = _sets.Replace(set, tag);
+        if (_prefetched)
+            Refill(Line(set, tag), entry);
+
+        bool writeback = false;
+        if (_dirty && !_next.Exclusive()) {
+            UINT8 &dirty = _dirty[Line(set, tag)];
+            writeback = dirty;
+            dirty = 0;
+            _fill_bytes += _geometry.BlockSize();
+        }
+
+        if (replaced == INVALID_TAG)
+            return replaced;
+        const ADDRINT replacedAddr = Address(set, replaced);
+        if (_inclusion == INCLUSION::INCLUSIVE) {
+            const UINT32 dirtyBytes = _above.invalidate(_above.owner, replacedAddr,
+                                                        _geometry.BlockSize(), _level);
+            if (dirtyBytes && _write_policy == WRITE_BACK)
+                writeback = true;
+            else if (dirtyBytes)
+                WriteBelow(replacedAddr, dirtyBytes);
+        }
+        if (writeback) {
+            _writebacks++;
+            WriteBelow(replacedAddr, _geometry.BlockSize());
+        }
+        return replaced;
+    }
+
+    /**
+     * The level below is EXCLUSIVE: the block allocated at (set, tag),
+     * which replaced `replaced`, came up from it `dirty` or not, or
+     * straight through from further down, and the victim moves down.
+     **/
+    VOID Exchange(UINT32 set, CACHE_TAG tag, CACHE_TAG replaced, UINT8 dirty)
+    {
+        UINT8 victimDirty = 0;
+        if (_dirty) {
+            UINT8 &lineDirty = _dirty[Line(set, tag)];
+            victimDirty = lineDirty;
+            lineDirty = dirty;
+            _fill_bytes += _geometry.BlockSize();
+        }
+        if (replaced == INVALID_TAG)
+            return;
+        if (_dirty) {
+            _writebacks += victimDirty;
+            _write_bytes += _geometry.BlockSize();
+        }
+        _next.VictimFill(Address(set, replaced), victimDirty);
+    }
+
+    public:
+    CACHE_LEVEL() : _prefetched(NULL), _dirty(NULL) {}
+    ~CACHE_LEVEL()
+    {
+        free(_prefetched);
+        free(_dirty);
+    }
+
+    VOID Init(const CACHE_LEVEL_CONFIG *configs, UINT32 level, UINT32 memoryLatency,
+              const CACHE_ABOVE &above)
+    {
+        const CACHE_LEVEL_CONFIG &config = configs[0];
+        _geometry.Init(config.cacheSize, config.blockSize, config.associativity);
+        _sets.Init(_geometry.NumSets(), config.associativity);
+        _above = above;
+        _level = level;
+        _latency = config.latency;
+        _inclusion = level > 1 ? config.inclusion : INCLUSION::NINE;
+        _store_allocate = level > 1 || STORE_ALLOCATION == STORE_ALLOCATE;
+        _write_policy = WRITE_BACK;
+        if (DEPTH > 1) {
+            const CACHE_LEVEL_CONFIG &below = configs[1];
+            ASSERTX(config.cacheSize <= below.cacheSize && config.blockSize <= below.blockSize);
+            ASSERTX(below.inclusion != INCLUSION::EXCLUSIVE || config.blockSize == below.blockSize);
+        }
+        _next.Init(configs + 1, level + 1, memoryLatency, above);
+        ResetStats();
+    }
+
+    /**
+     * Gives each level from this one down the prefetcher of `kinds` (one
+     * per level), and the per-line fill times if `track`.
+     **/
+    VOID SetPrefetchers(const PREFETCHER::KIND *kinds, UINT32 degree, UINT32 distance, bool track)
+    {
+        ASSERTX(!track || _inclusion != INCLUSION::EXCLUSIVE);
+        _prefetcher.Init(kinds[0], degree, distance, _geometry.LineShift());
+        free(_prefetched);
+        _prefetched = NULL;
+        if (track) {
+            _prefetched = AlignedAlloc<UINT64>(NumLines());
+            std::fill(_prefetched, _prefetched + NumLines(), 0);
+        }
+        _next.SetPrefetchers(kinds + 1, degree, distance, track);
+    }
+
+    // Starts tracking dirty lines, with the write policies of `policies`
+    VOID SetWrites(const WRITE_POLICY *policies, bool storeAllocate)
+    {
+        _write_policy = policies[0];
+        if (_level == 1)
+            _store_allocate = storeAllocate;
+        free(_dirty);
+        _dirty = AlignedAlloc<UINT8>(NumLines());
+        std::fill(_dirty, _dirty + NumLines(), 0);
+        _next.SetWrites(policies + 1, storeAllocate);
+    }
+
+    VOID SetPc(ADDRINT pc)
+    {
+        _sets.SetPc(pc);
+        _next.SetPc(pc);
+    }
+
+    /**
+     * Returns the cycles to serve `addr` from this level down, and notes in
+     * `request` where it was served and which prefetchers it triggers.
+     **/
+    UINT32 Access(ADDRINT addr, UINT32 accessType, CACHE_REQUEST &request)
+    {
+        CACHE_TAG tag;
+        UINT32 setIndex;
+        SplitAddress(addr, tag, setIndex);
+        const bool hit = _sets.Find(setIndex, tag);
+        _access[accessType][hit]++;
+        UINT32 cycles = _latency;
+        // An EXCLUSIVE level gives the level above its data blocks
+        const bool moveUp = _inclusion == INCLUSION::EXCLUSIVE && accessType != ACCESS_FETCH &&
+            request.allocated;
+
+        if (hit) {
+            request.served = _level;
+            if (_prefetched && UsePrefetch(Line(setIndex, tag), request, cycles))
+                request.triggers |= 1U << _level;
+            if (moveUp) {
+                if (_dirty) {
+                    UINT8 &dirty = _dirty[Line(setIndex, tag)];
+                    request.dirty = dirty;
+                    dirty = 0;
+                }
+                _sets.DeleteIfPresent(setIndex, tag);
+            }
+            return cycles;
+        }
+        request.triggers |= 1U << _level;
+
+        const bool allocate = (accessType != ACCESS_STORE || _store_allocate) && !moveUp;
+        CACHE_TAG replaced = INVALID_TAG;
+        if (allocate)
+            replaced = Fill(setIndex, tag, 0);
+        else if (moveUp && _dirty)
+            _fill_bytes += _geometry.BlockSize(); // straight through to the level above
+
+        request.allocated = allocate;
+        cycles += _next.Access(addr, accessType, request);
+        if (allocate && _next.Exclusive())
+            Exchange(setIndex, tag, replaced, request.dirty);
+        return cycles;
+    }
+
+    /**
+     * Trains the prefetchers of this level and the ones below it that
+     * `request` reached with its access to `addr`, which took `cycles`,
+     * and issues their prefetches, the lowest level's first. Prefetches do
+     * not cross the 4KB page of the access.
+     **/
+    VOID Prefetch(ADDRINT addr, ADDRINT pc, const CACHE_REQUEST &request, UINT32 cycles)
+    {
+        _next.Prefetch(addr, pc, request, cycles);
+        if (request.served < _level || !_prefetcher.Enabled())
+            return;
+
+        ADDRINT blocks[PREFETCHER::MAX_DEGREE];
+        const ADDRINT page = addr >> 12;
+        const bool trigger = (request.triggers >> _level) & 1;
+        const UINT32 n = _prefetcher.Train(pc, addr, trigger, blocks);
+        for (UINT32 i = 0; i < n; i++) {
+            const ADDRINT blockAddr = blocks[i] << _geometry.LineShift();
+            if (blockAddr >> 12 != page)
+                continue;
+            CACHE_TAG tag;
+            UINT32 setIndex;
+            SplitAddress(blockAddr, tag, setIndex);
+            if (_sets.Way(setIndex, tag) >= 0)
+                continue;
+            _prefetch.issued++;
+            UINT64 fromNext = 0;
+            const UINT64 ready = _next.PrefetchFill(blockAddr, request.now + cycles, fromNext);
+            Fill(setIndex, tag, (ready + 1) | fromNext);
+        }
+    }
+
+    /**
+     * A prefetch of the level above, issued at cycle `ready`, looks up
+     * `addr` here, allocating it on a miss. Returns when its data is here
+     * and sets `fromNext` if it takes over an unused prefetch.
+     **/
+    UINT64 PrefetchFill(ADDRINT addr, UINT64 ready, UINT64 &fromNext)
+    {
+        CACHE_TAG tag;
+        UINT32 setIndex;
+        SplitAddress(addr, tag, setIndex);
+        _prefetch_requests++;
+        ready += _latency;
+        if (!_sets.Find(setIndex, tag)) {
+            UINT64 fromBelow = 0;
+            ready = _next.PrefetchFill(addr, ready, fromBelow);
+            // Only the level above uses the block, useful to the one below
+            if (fromBelow)
+                _next.CountPrefetch(true);
+            Fill(setIndex, tag, 0);
+            return ready;
+        }
+
+        // An unused prefetch moves up, the fill above waits for it
+        UINT64 &entry = _prefetched[Line(setIndex, tag)];
+        if (entry) {
+            ready = std::max(ready, (entry & ~FROM_NEXT) - 1 + _latency);
+            if (entry & FROM_NEXT)
+                _next.CountPrefetch(true);
+            fromNext = FROM_NEXT;
+            entry = 0;
+        }
+        return ready;
+    }
+
+    // A prefetch of this level that the level above took over was `useful` or not
+    VOID CountPrefetch(bool useful)
+    {
+        if (useful)
+            _prefetch.useful++;
+        else
+            _prefetch.useless++;
+    }
+
+    // `bytes` written to the block of `addr`, by the level above or the write buffer
+    VOID Write(ADDRINT addr, UINT32 bytes)
+    {
+        CACHE_TAG tag;
+        UINT32 setIndex;
+        SplitAddress(addr, tag, setIndex);
+        const INT32 way = _sets.Way(setIndex, tag);
+        if (way >= 0 && _write_policy == WRITE_BACK)
+            _dirty[setIndex * _geometry.Associativity() + way] = 1;
+        else // through or around this level
+            WriteBelow(addr, bytes);
+    }
+
+    // The data of a store to `addr`, whose block this level holds
+    VOID MarkDirty(ADDRINT addr)
+    {
+        CACHE_TAG tag;
+        UINT32 setIndex;
+        SplitAddress(addr, tag, setIndex);
+        _dirty[Line(setIndex, tag)] = 1;
+    }
+
+    // `bytes` of a write (buffer) below L1 go to the level below
+    VOID WriteFromBuffer(ADDRINT addr, UINT32 bytes) { WriteBelow(addr, bytes); }
+
+    // An instruction cache next to this level got `bytes` from the level below
+    VOID CountInstructionFill(UINT32 bytes) { _fill_bytes += bytes; }
+
+    // EXCLUSIVE: a victim of the level above, `dirty` or not, moves down here
+    VOID VictimFill(ADDRINT addr, UINT8 dirty)
+    {
+        CACHE_TAG tag;
+        UINT32 setIndex;
+        SplitAddress(addr, tag, setIndex);
+        _victim_fills++;
+        // Unless an instruction fetch brought it in meanwhile
+        const bool present = _sets.Way(setIndex, tag) >= 0;
+        CACHE_TAG replaced = INVALID_TAG;
+        if (!present)
+            replaced = _sets.Replace(setIndex, tag);
+        if (!_dirty)
+            return;
+
+        UINT8 &lineDirty = _dirty[Line(setIndex, tag)];
+        if (!present && lineDirty) {
+            // Of the block it evicted
+            _writebacks++;
+            WriteBelow(Address(setIndex, replaced), _geometry.BlockSize());
+        }
+        if (!present)
+            lineDirty = 0;
+        if (dirty) {
+            if (_write_policy == WRITE_BACK)
+                lineDirty = 1;
+            else
+                WriteBelow(addr, _geometry.BlockSize());
+        }
+    }
+
+    /**
+     * Drops the `size` bytes at `addr`, evicted by the inclusive `level`,
+     * from this level and the ones below it above `level`. Returns the
+     * bytes of the dirty copies, written back with the evicted block.
+     **/
+    UINT32 Invalidate(ADDRINT addr, UINT32 size, UINT32 level)
+    {
+        if (_level >= level)
+            return 0;
+        UINT32 dirtyBytes = 0;
+        for (UINT32 i = 0; i < size; i += _geometry.BlockSize()) {
+            CACHE_TAG tag;
+            UINT32 setIndex;
+            SplitAddress(addr | i, tag, setIndex);
+            if (_sets.Way(setIndex, tag) < 0)
+                continue;
+            _back_invalidations++;
+            if (_prefetched || _dirty) {
+                const UINT32 line = Line(setIndex, tag);
+                if (_prefetched)
+                    Refill(line, 0);
+                if (_dirty && _dirty[line]) {
+                    _dirty[line] = 0;
+                    _writebacks++;
+                    _write_bytes += _geometry.BlockSize();
+                    dirtyBytes += _geometry.BlockSize();
+                }
+            }
+            _sets.DeleteIfPresent(setIndex, tag);
+        }
+        return dirtyBytes + _next.Invalidate(addr, size, level);
+    }
+
+    // Whether this level or one below it holds the block of `addr`
+    bool Holds(ADDRINT addr) const
+    {
+        CACHE_TAG tag;
+        UINT32 setIndex;
+        SplitAddress(addr, tag, setIndex);
+        return _sets.Way(setIndex, tag) >= 0 || _next.Holds(addr);
+    }
+
+    /**
+     * The bytes each level from this one down holds, in bytes[level - 1],
+     * added to `unique` for the blocks no level below holds too.
+     **/
+    VOID Occupancy(UINT64 *bytes, UINT64 &unique) const
+    {
+        UINT64 lines = 0, uniqueLines = 0;
+        for (UINT32 set = 0; set < _geometry.NumSets(); set++)
+            for (UINT32 way = 0; way < _geometry.Associativity(); way++) {
+                const CACHE_TAG tag = _sets.TagAt(set, way);
+                if (tag == INVALID_TAG)
+                    continue;
+                lines++;
+                uniqueLines += !_next.Holds(Address(set, tag));
+            }
+        bytes[_level - 1] = lines * _geometry.BlockSize();
+        unique += uniqueLines * _geometry.BlockSize();
+        _next.Occupancy(bytes, unique);
+    }
+
+    NEXT &Next() { return _next; }
+    const NEXT &Next() const { return _next; }
+    static bool IsStatic() { return GEOMETRY::IsStatic() && NEXT::IsStatic(); }
+    bool Exclusive() const { return _inclusion == INCLUSION::EXCLUSIVE; }
+    INCLUSION::KIND Inclusion() const { return _inclusion; }
+    bool StoreAllocate() const { return _store_allocate; }
+    UINT32 BlockSize() const { return _geometry.BlockSize(); }
+    UINT32 LineShift() const { return _geometry.LineShift(); }
+    UINT64 CacheSize() const { return _geometry.CacheSize() + _next.CacheSize(); } // from here down
+    string Name() const { return "L" + dec2str(_level, 1); }
+
+    VOID ResetStats()
+    {
+        memset(_access, 0, sizeof(_access));
+        _sets.ResetStats();
+        memset(&_prefetch, 0, sizeof(_prefetch));
+        _prefetch_requests = 0;
+        _writebacks = _fill_bytes = _write_bytes = 0;
+        _back_invalidations = _victim_fills = 0;
+        _next.ResetStats();
+    }
+
+    VOID AddStats(const CACHE_LEVEL &other)
+    {
+        for (UINT32 accessType = 0; accessType < ACCESS_KIND_NUM; accessType++)
+            for (UINT32 hit = 0; hit < HIT_MISS_NUM; hit++)
+                _access[accessType][hit] += other._access[accessType][hit];
+        _sets.AddStats(other._sets);
+        _prefetch.Add(other._prefetch);
+        _prefetch_requests += other._prefetch_requests;
+        _writebacks += other._writebacks;
+        _fill_bytes += other._fill_bytes;
+        _write_bytes += other._write_bytes;
+        _back_invalidations += other._back_invalidations;
+        _victim_fills += other._victim_fills;
+        _next.AddStats(other._next);
+    }
+
+    CACHE_STATS Misses(UINT32 level) const
+    {
+        if (level != _level)
+            return _next.Misses(level);
+        return _access[0][false] + _access[1][false];
+    }
+
+    CACHE_STATS BackInvalidations() const { return _back_invalidations + _next.BackInvalidations(); }
+    CACHE_STATS VictimFills() const { return _victim_fills + _next.VictimFills(); }
+
+    // With the fetch stats of the levels below L1 if `instructions` (fetched) is given
+    string LevelStats(const string &prefix, const CACHE_STATS *instructions) const
+    {
+        string out = LevelStatsLong(prefix, Name(), _access);
+        if (instructions && _level > 1)
+            out += FetchStatsLong(prefix, Name(), _access[ACCESS_FETCH], *instructions);
+        return out + _next.LevelStats(prefix, instructions);
+    }
+
+    string PolicyStats(const string &prefix) const
+    {
+        return _sets.StatsLong(prefix, Name()) + _next.PolicyStats(prefix);
+    }
+
+    // The DTLB Stats lines of the TLB walk loads that reached each level
+    string WalkStats(const string &prefix) const
+    {
+        const UINT32 headerWidth = 21;
+        const UINT32 numberWidth = 12;
+        const CACHE_STATS *walk = _access[ACCESS_WALK];
+        const CACHE_STATS accesses = walk[true] + walk[false];
+        return prefix + ljstr(Name() + "-Walk-Hits:", headerWidth) + dec2str(walk[true], numberWidth)
+            + "  " + fltstr(Percent(walk[true], accesses), 2, 6) + "%\n"
+            + prefix + ljstr(Name() + "-Walk-Misses:", headerWidth) + dec2str(walk[false], numberWidth)
+            + "  " + fltstr(Percent(walk[false], accesses), 2, 6) + "%\n"
+            + _next.WalkStats(prefix);
+    }
+
+    string PrefetchStats(const string &prefix) const
+    {
+        string out;
+        if (_prefetcher.Enabled())
+            out = PrefetchStatsLong(prefix, Name(), _prefetch, Misses(_level));
+        return out + _next.PrefetchStats(prefix);
+    }
+
+    // The prefetch requests of the levels above that reached each level
+    // below L1 and memory, against the demand accesses that did
+    string PrefetchTraffic(const string &prefix, CACHE_STATS) const
+    {
+        string out;
+        if (_level > 1)
+            out = prefix + ljstr(Name() + "-Prefetch-Requests:", 27)
+                + dec2str(_prefetch_requests, 12) + "  "
+                + fltstr(Percent(_prefetch_requests, _access[0][true] + _access[0][false] +
+                                 _access[1][true] + _access[1][false]), 2, 6) + "% of demand\n";
+        return out + _next.PrefetchTraffic(prefix, Misses(_level));
+    }
+
+    string Writebacks(const string &prefix) const
+    {
+        return prefix + ljstr(Name() + "-Writebacks:", 24) + dec2str(_writebacks, 14) + "\n" +
+            _next.Writebacks(prefix);
+    }
+
+    // The bytes from the level below and to it
+    string WriteTraffic(const string &prefix) const
+    {
+        return prefix + ljstr(_next.Name() + "-to-" + Name() + "-Bytes:", 24)
+            + dec2str(_fill_bytes, 14) + "\n"
+            + prefix + ljstr(Name() + "-to-" + _next.Name() + "-Bytes:", 24)
+            + dec2str(_write_bytes, 14) + "\n" + _next.WriteTraffic(prefix);
+    }
+
+    // Appends this level and the ones below to the PrintCache sections
+    VOID Print(const string &prefix, CACHE_PRINT &print) const
+    {
+        print.geometry += prefix + "  " + Name() + "-Data Cache:\n";
+        print.geometry += prefix + "    Size(KB):       " + dec2str(_geometry.CacheSize()/KILO, 5) + "\n";
+        print.geometry += prefix + "    Block Size(B):  " + dec2str(_geometry.BlockSize(), 5) + "\n";
+        print.geometry += prefix + "    Associativity:  " + dec2str(_geometry.Associativity(), 5) + "\n";
+        print.geometry += prefix + "\n";
+        print.latencies += " " + dec2str(_latency, 4);
+        print.sets += prefix + Name() + "-Sets: " + _sets.Name() + " assoc: " +
+            dec2str(_sets.GetAssociativity(), 3) + "\n";
+        print.writes += " " + Name() + " " + WRITE_CONFIG::PolicyName(_write_policy);
+        if (_level > 1)
+            print.inclusion += prefix + Name() + "_inclusive: " +
+                (_inclusion == INCLUSION::INCLUSIVE ? "Yes" :
+                 _inclusion == INCLUSION::EXCLUSIVE ? "Exclusive" : "No") + "\n";
+        print.prefetchers += " " + Name() + " " + _prefetcher.Name();
+        if (_prefetcher.Enabled() && print.degree.empty())
+            print.degree = " degree: " + dec2str(_prefetcher.Degree(), 2) + " distance: " +
+                dec2str(_prefetcher.Distance(), 3);
+        _next.Print(prefix, print);
+    }
+
+    UINT32 Latency() const { return _next.Latency(); } // of memory
+};
+
+/**
+ * Cache hierarchy of any depth: LEVELS is a chain of CACHE_LEVELs, e.g.
+ *   CACHE_HIERARCHY<CACHE_LEVEL<LRU, CACHE_LEVEL<LRU, CACHE_LEVEL<SRRIP> > > >
+ * for an L1 and an L2 with LRU and an SRRIP L3, each level configured at
+ * runtime by a CACHE_LEVEL_CONFIG. TWO_LEVEL_CACHE is the two level one.
+ *
+ * Each level may have a PREFETCHER (SetPrefetchers). Prefetches are
+ * fetched through the levels below (allocating there on a miss), those of
+ * the last level from memory. Prefetched lines remember when their fill
+ * completes, counted in the cycles returned by Access(): a demand hit
+ * before that waits for the rest and counts as late.
+ *
+ * An L1 instruction cache may sit next to the L1 data cache
+ * (SetInstructionCache), fed by Fetch(); its misses go to L2, counted apart
+ * from the data accesses. Data TLBs (SetTlb) translate every access first,
+ * their page walks loading through the caches.
+ *
+ * SetWrites() sets store allocation and the write policies of L1 and L2
+ * (the levels below are write-back) at runtime and tracks dirty lines,
+ * writebacks and the bytes that cross each level boundary. Writes are off
+ * the critical path (write buffer, writeback buffers), so they do not
+ * change the cycles returned by Access().
+ *
+ * An EXCLUSIVE level needs the block size of the level above and no
+ * prefetchers; the instruction cache is outside the exclusion, its misses
+ * fill the level as with NINE. ReportInclusion() adds the back
+ * invalidations, victim fills and unique capacity of the levels to the
+ * stats. Neither MSHRs nor contention are modelled; mlp.h adds MSHRs on
+ * top of ServedBy().
+ **/
+template <class LEVELS>
+class CACHE_HIERARCHY
+{
+    public:
+    typedef enum
+    {
+        ACCESS_TYPE_LOAD,
+        ACCESS_TYPE_STORE,
+        ACCESS_TYPE_NUM
+    } ACCESS_TYPE;
+
+    private:
+    LEVELS _levels;
+    INSTRUCTION_CACHE<typename LEVELS::POLICY::template rebind<0>::type> _l1i;
+    DATA_TLB _tlb;
+    const std::string _name;
+    UINT64 _now;     // cycles returned so far, with prefetchers
+    UINT32 _served;  // see ServedBy()
+    bool _prefetching;
+
+    WRITE_CONFIG _writes;
+    WRITE_BUFFER _write_buffer;
+
+    bool _report_inclusion;
+    // Per level, then of distinct blocks, of the caches AddStats() summed
+    UINT64 _added_occupancy[CACHE_HIERARCHY_MAX_LEVELS + 1];
+
+    CACHE_HIERARCHY(const CACHE_HIERARCHY &);            // not copyable
+    CACHE_HIERARCHY &operator=(const CACHE_HIERARCHY &);
+
+    // See CACHE_ABOVE
+    static UINT32 InvalidateAbove(VOID *owner, ADDRINT addr, UINT32 size, UINT32 level)
+    {
+        CACHE_HIERARCHY &self = *static_cast<CACHE_HIERARCHY *>(owner);
+        if (self._l1i.Enabled())
+            self._l1i.Invalidate(addr, size);
+        return self._levels.Invalidate(addr, size, level);
+    }
+
+    // The bytes each level holds, then those of distinct blocks
+    VOID Occupancy(UINT64 bytes[CACHE_HIERARCHY_MAX_LEVELS + 1]) const
+    {
+        UINT64 unique = 0;
+        _levels.Occupancy(bytes, unique);
+        bytes[LEVELS::DEPTH] = unique;
+    }
+
+    // The counters of `other`, without its occupancy
+    VOID AddCounts(const CACHE_HIERARCHY &other)
+    {
+        _levels.AddStats(other._levels);
+        _l1i.AddStats(other._l1i);
+        _tlb.AddStats(other._tlb);
+        _write_buffer.writes += other._write_buffer.writes;
+        _write_buffer.coalesced += other._write_buffer.coalesced;
+    }
+
+    // The `size` bytes of a store to `addr`, whose L1 block is `present` or not
+    VOID WriteData(ADDRINT addr, UINT32 size, bool present)
+    {
+        if (present && _writes.l1Policy == WRITE_BACK) {
+            _levels.MarkDirty(addr);
+            return;
+        }
+        ADDRINT drainedAddr;
+        const UINT32 bytes = _write_buffer.Write(addr, size, drainedAddr);
+        if (bytes)
+            _levels.WriteFromBuffer(drainedAddr, bytes);
+    }
+
+    // Returns the cycles to serve the (translated) request.
+    UINT32 AccessData(ADDRINT addr, ACCESS_TYPE accessType, ADDRINT pc, UINT32 size)
     {
-        protected:
-        std::vector<CACHE_TAG> _tags;
-        UINT32 _associativity;
+        CACHE_REQUEST request = { _now, 1, 0, false, 0 };
+        _levels.SetPc(pc);
+        const UINT32 cycles = _levels.Access(addr, accessType, request);
+        _served = request.served;
 
-        public:
-        LRU(UINT32 associativity = 8)
-        {
-            _associativity = associativity;
-            _tags.clear();
-        }
+        if (_writes.enabled && accessType == ACCESS_TYPE_STORE)
+            WriteData(addr, size, request.served == 1 || _writes.storeAllocate);
 
-        VOID SetAssociativity(UINT32 associativity)
-        {
-            _associativity = associativity;
-            _tags.clear();
+        if (_prefetching) {
+            _levels.Prefetch(addr, pc, request, cycles);
+            _now += cycles;
         }
-        UINT32 GetAssociativity() { return _associativity; }
+        return cycles;
+    }
 
-        string Name() { return "LRU"; }
+    public:
+    // `levels` lists the configurations from L1 down, one per CACHE_LEVEL
+    CACHE_HIERARCHY(std::string name, const std::vector<CACHE_LEVEL_CONFIG> &levels,
+                    UINT32 memoryLatency = 150)
+        : _name(name), _now(0), _served(1), _prefetching(false), _report_inclusion(false)
+    {
+        ASSERTX(levels.size() == LEVELS::DEPTH && LEVELS::DEPTH <= CACHE_HIERARCHY_MAX_LEVELS);
+        memset(&_writes, 0, sizeof(_writes));
+        memset(_added_occupancy, 0, sizeof(_added_occupancy));
+        const CACHE_ABOVE above = { this, InvalidateAbove };
+        _levels.Init(&levels[0], 1, memoryLatency, above);
+        ResetStats();
+    }
 
-        UINT32 Find(CACHE_TAG tag)
-        {
-            for (std::vector<CACHE_TAG>::iterator it = _tags.begin();
-                 it != _tags.end(); ++it)
-            {
-                if (*it == tag) { // Tag found, lets make it MRU
-                    _tags.erase(it);
-                    _tags.push_back(tag);
-                    return true;
-                }
-            }
+    static bool IsStatic() { return LEVELS::IsStatic(); }
 
-            return false;
-        }
+    /**
+     * Attaches prefetchers to L1 and L2 (PREFETCHER::NONE for none).
+     * `degree` is the most blocks per trigger, `distance` how far ahead
+     * of the triggers a stream may run.
+     **/
+    VOID SetPrefetchers(PREFETCHER::KIND l1Kind, PREFETCHER::KIND l2Kind,
+                        UINT32 degree, UINT32 distance)
+    {
+        PREFETCHER::KIND kinds[CACHE_HIERARCHY_MAX_LEVELS] = { l1Kind, l2Kind };
+        // All levels track fill times, so that fills and evictions stay tracked
+        _prefetching = l1Kind != PREFETCHER::NONE || l2Kind != PREFETCHER::NONE;
+        _levels.SetPrefetchers(kinds, degree, distance, _prefetching);
+    }
 
-        CACHE_TAG Replace(CACHE_TAG tag)
-        {
-            CACHE_TAG ret = INVALID_TAG;
-            _tags.push_back(tag);
-            if (_tags.size() > _associativity) {
-                ret = *_tags.begin();
-                _tags.erase(_tags.begin());
-            }
-            return ret;
-        }
+    // Adds an L1 instruction cache next to the L1 data cache, with the L1
+    // policy, whose blocks may not exceed L2's
+    VOID SetInstructionCache(UINT32 cacheSize, UINT32 blockSize, UINT32 associativity)
+    {
+        ASSERTX(LEVELS::DEPTH > 1 && blockSize <= _levels.Next().BlockSize());
+        _l1i.Init(cacheSize, blockSize, associativity);
+    }
 
-        VOID DeleteIfPresent(CACHE_TAG tag)
-        {
-            for (std::vector<CACHE_TAG>::iterator it = _tags.begin();
-                 it != _tags.end(); ++it)
-            {
-                if (*it == tag) { // Tag found, lets make it MRU
-                    _tags.erase(it);
-                    break;
-                }
-            }
-        }
-    };
+    VOID SetTlb(const TLB_CONFIG &config) { _tlb.Init(config); }
+    const DATA_TLB &Tlb() const { return _tlb; }
 
-    class RANDOM
+    // Overrides STORE_ALLOCATION and starts tracking writes
+    VOID SetWrites(const WRITE_CONFIG &config)
     {
-        protected:
-        std::vector<CACHE_TAG> _tags;
-        UINT32 _associativity;
+        WRITE_POLICY policies[CACHE_HIERARCHY_MAX_LEVELS] = { config.l1Policy, config.l2Policy };
+        _writes = config;
+        _write_buffer.Init(config.bufferEntries, _levels.LineShift());
+        _levels.SetWrites(policies, config.storeAllocate);
+    }
 
-        public:
-        RANDOM(UINT32 associativity = 8)
-        {
-            _associativity = associativity;
-            _tags.clear();
-        }
+    VOID ReportInclusion() { _report_inclusion = true; }
 
-        VOID SetAssociativity(UINT32 associativity)
-        {
-            _associativity = associativity;
-            _tags.clear();
+    // `pc` of the accessing instruction trains the stride prefetcher and
+    // the PC-aware set policies (SHIP, HAWKEYE); a store writes `size`
+    // bytes, which SetWrites() tracks
+    UINT32 Access(ADDRINT addr, ACCESS_TYPE accessType, ADDRINT pc = 0, UINT32 size = 8)
+    {
+        if (_tlb.Enabled()) {
+            // The walk goes first, through the caches, on behalf of `pc`
+            _levels.SetPc(pc);
+            const UINT32 cycles = _tlb.Translate(addr, *this);
+            return cycles + AccessData(addr, accessType, pc, size);
         }
-        UINT32 GetAssociativity() { return _associativity; }
+        return AccessData(addr, accessType, pc, size);
+    }
 
-        string Name() { return "RANDOM"; }
+    /**
+     * The level that had the data of the last Access(): 1 for L1, 2 for
+     * L2, LEVELS::DEPTH + 1 for memory. TLB walks and prefetches do not
+     * count, even when their cycles are part of the latency.
+     **/
+    UINT32 ServedBy() const { return _served; }
 
-        UINT32 Find(CACHE_TAG tag)
-        {
-            for (std::vector<CACHE_TAG>::iterator it = _tags.begin();
-                 it != _tags.end(); ++it)
-            {
-                if (*it == tag) { // Tag found, lets make it MRU
-                    return true;
-                }
-            }
+    /**
+     * A page table load of a TLB walk, already physical. It is counted
+     * apart from the demand loads (WalkStatsLong), does not train the
+     * prefetchers and leaves the policies the PC of the access it
+     * translates.
+     **/
+    UINT32 WalkAccess(ADDRINT addr)
+    {
+        CACHE_REQUEST request = { _now, 1, 0, false, 0 };
+        const UINT32 cycles = _levels.Access(addr, LEVELS::ACCESS_WALK, request);
+        if (_prefetching)
+            _now += cycles;
+        return cycles;
+    }
 
-            return false;
-        }
+    // The lines of the walk loads in "DTLB Stats"
+    string WalkStatsLong(const string &prefix) const { return _levels.WalkStats(prefix); }
 
-        CACHE_TAG Replace(CACHE_TAG tag)
-        {
-            CACHE_TAG ret = INVALID_TAG;
-            _tags.push_back(tag);
-            if (_tags.size() > _associativity) {
-                /* initialize random seed: */
-                srand(time(NULL));
-                UINT32 randomIndex = rand() % _tags.size();
-                ret = _tags[randomIndex];
-                _tags.erase(_tags.begin() + randomIndex);
-            }
-            return ret;
-        }
+    /**
+     * Fetches `numInstructions` instructions, the `size` bytes of code at
+     * `addr`, through the instruction cache. Returns the cycles the front
+     * end stalls: 0 when all their lines hit.
+     **/
+    UINT32 Fetch(ADDRINT addr, UINT32 size, UINT32 numInstructions)
+    {
+        UINT32 cycles = 0;
+        _l1i.CountInstructions(numInstructions);
 
-        VOID DeleteIfPresent(CACHE_TAG tag)
-        {
-            for (std::vector<CACHE_TAG>::iterator it = _tags.begin();
-                 it != _tags.end(); ++it)
-            {
-                if (*it == tag) { // Tag found, lets make it MRU
-                    _tags.erase(it);
-                    break;
-                }
-            }
+        // One lookup per line the code spans; L1I hits are free
+        const UINT32 shift = _l1i.LineShift();
+        const ADDRINT last = (addr + std::max(size, 1U) - 1) >> shift;
+        for (ADDRINT line = addr >> shift; line <= last; line++) {
+            const ADDRINT lineAddr = line << shift;
+            if (_l1i.Access(lineAddr))
+                continue;
+            if (_writes.enabled)
+                _levels.CountInstructionFill(_l1i.BlockSize());
+            CACHE_REQUEST request = { _now, 2, 0, false, 0 };
+            _levels.Next().SetPc(lineAddr);
+            cycles += _levels.Next().Access(lineAddr, LEVELS::ACCESS_FETCH, request);
         }
-    };
 
-    class LFU
+        if (_prefetching)
+            _now += cycles;
+        return cycles;
+    }
+
+    VOID ResetStats()
     {
-        protected:
-        std::vector<CACHE_TAG> _tags;
-        std::vector<UINT32> _frequencies;
-        UINT32 _associativity;
+        _levels.ResetStats();
+        _l1i.ResetStats();
+        _tlb.ResetStats();
+        _write_buffer.ResetStats();
+    }
 
-        public:
-        LFU(UINT32 associativity = 8)
-        {
-            _associativity = associativity;
-            _tags.clear();
-            _frequencies.clear();
-        }
+    // Adds the stats of `other`, e.g. a copy fed with a disjoint subset of
+    // the sets (see cache_replay): counts and occupancy add up
+    VOID AddStats(const CACHE_HIERARCHY &other)
+    {
+        AddCounts(other);
+        UINT64 occupancy[CACHE_HIERARCHY_MAX_LEVELS + 1];
+        other.Occupancy(occupancy);
+        for (UINT32 i = 0; i <= LEVELS::DEPTH; i++)
+            _added_occupancy[i] += occupancy[i];
+    }
 
-        VOID SetAssociativity(UINT32 associativity)
-        {
-            _associativity = associativity;
-            _tags.clear();
-            _frequencies.clear();
-        }
-        UINT32 GetAssociativity() { return _associativity; }
+    /**
+     * Adds the stats of a detailed window of `other`, the sampled cache
+     * (see cslab_cache -sample): the counts add up, but the occupancy is
+     * a snapshot, that of `other` at the end of the window.
+     **/
+    VOID AddWindowStats(const CACHE_HIERARCHY &other)
+    {
+        AddCounts(other);
+        other.Occupancy(_added_occupancy);
+    }
 
-        string Name() { return "LFU"; }
+    CACHE_STATS Misses(UINT32 level) const { return _levels.Misses(level); }
+    CACHE_STATS L1Misses() const { return Misses(1); }
+    CACHE_STATS L2Misses() const { return Misses(2); }
 
-        UINT32 Find(CACHE_TAG tag)
-        {
-            for (std::vector<CACHE_TAG>::iterator it = _tags.begin();
-                 it != _tags.end(); ++it)
-            {
-                if (*it == tag) {
-                    UINT32 index = it - _tags.begin();
-                    _frequencies[index]++;
-                    return true;
-                }
-            }
-            return false;
+    string StatsLong(string prefix = "") const;
+    string PrintCache(string prefix = "") const;
+};
+
+template <class LEVELS>
+    string CACHE_HIERARCHY<LEVELS>::StatsLong(string prefix) const
+    {
+        string out;
+        if (_l1i.Enabled()) {
+            const CACHE_STATS instructions = _l1i.Instructions();
+            out = _levels.LevelStats(prefix, &instructions) + _l1i.StatsLong(prefix) +
+                _l1i.PolicyStatsLong(prefix);
+        } else {
+            out = _levels.LevelStats(prefix, NULL);
+        }
+        out += _levels.PolicyStats(prefix);
+        if (_prefetching) {
+            out += _levels.PrefetchStats(prefix);
+            out += prefix + "Prefetch Traffic:\n";
+            out += _levels.PrefetchTraffic(prefix, 0);
+            out += prefix + "\n";
+        }
+        if (_writes.enabled) {
+            const UINT32 headerWidth = 24;
+            const UINT32 numberWidth = 14;
+            out += prefix + "Write Traffic:\n";
+            out += _levels.Writebacks(prefix);
+            out += prefix + ljstr("Write-Buffer-Stores:", headerWidth)
+                + dec2str(_write_buffer.writes, numberWidth) + "\n";
+            out += prefix + ljstr("Write-Buffer-Coalesced:", headerWidth)
+                + dec2str(_write_buffer.coalesced, numberWidth) + "  "
+                + fltstr(Percent(_write_buffer.coalesced, _write_buffer.writes), 2, 6) + "%\n";
+            out += _levels.WriteTraffic(prefix);
+            out += prefix + "\n";
+        }
+        if (_report_inclusion) {
+            const UINT32 headerWidth = 24;
+            const UINT32 numberWidth = 14;
+            UINT64 occupancy[CACHE_HIERARCHY_MAX_LEVELS + 1];
+            Occupancy(occupancy);
+            string levels;
+            for (UINT32 i = 0; i <= LEVELS::DEPTH; i++)
+                occupancy[i] += _added_occupancy[i];
+            for (UINT32 level = 1; level <= LEVELS::DEPTH; level++)
+                levels += (level > 1 ? "+L" : "L") + dec2str(level, 1);
+            out += prefix + "Inclusion Stats:\n";
+            out += prefix + ljstr("Policy:", headerWidth) + INCLUSION::Name(_levels.Next().Inclusion()) + "\n";
+            out += prefix + ljstr("Back-Invalidations:", headerWidth)
+                + dec2str(_levels.BackInvalidations(), numberWidth) + "\n";
+            out += prefix + ljstr("Victim-Fills:", headerWidth)
+                + dec2str(_levels.VictimFills(), numberWidth) + "\n";
+            for (UINT32 level = 1; level <= LEVELS::DEPTH; level++)
+                out += prefix + ljstr("L" + dec2str(level, 1) + "-Valid-KB:", headerWidth)
+                    + dec2str(occupancy[level - 1] / KILO, numberWidth) + "\n";
+            out += prefix + ljstr("Unique-KB:", headerWidth)
+                + dec2str(occupancy[LEVELS::DEPTH] / KILO, numberWidth) + "  "
+                + fltstr(Percent(occupancy[LEVELS::DEPTH], _levels.CacheSize()), 2, 6)
+                + "% of " + levels + "\n";
+            out += prefix + "\n";
         }
+        return out;
+    }
 
-        CACHE_TAG Replace(CACHE_TAG tag) {
-            CACHE_TAG ret = INVALID_TAG;
-            _tags.push_back(tag);
-            _frequencies.push_back(1);
+template <class LEVELS>
+    string CACHE_HIERARCHY<LEVELS>::PrintCache(string prefix) const
+    {
+        CACHE_PRINT print;
+        _levels.Print(prefix, print);
 
-            if (_tags.size() <= _associativity) {
-                return ret;
-            }
+        string out;
+        out += prefix + _name + ":\n";
+        if (_l1i.Enabled())
+            out += _l1i.PrintCache(prefix);
+        out += print.geometry;
+        out += prefix + "Latencies:" + print.latencies + " " + dec2str(_levels.Latency(), 4) + "\n";
+        if (_l1i.Enabled())
+            out += _l1i.SetsName(prefix);
+        out += print.sets;
+        out += prefix + "Store_allocation: " + (_levels.StoreAllocate() ? "Yes" : "No") + "\n";
+        if (_writes.enabled)
+            out += prefix + "Write_policy:" + print.writes + " write_buffer: " +
+                dec2str(_write_buffer.Entries(), 2) + "\n";
+        out += print.inclusion;
+        out += prefix + "Geometry: " + (IsStatic() ? "static" : "dynamic") + "\n";
+        if (_prefetching)
+            out += prefix + "Prefetchers:" + print.prefetchers + print.degree + "\n";
+        if (_tlb.Enabled())
+            out += _tlb.Print(prefix);
+        out += "\n";
+        return out;
+    }
 
-            std::vector<UINT32>::iterator minFrequency = std::min_element(_frequencies.begin(), _frequencies.end());
-            UINT32 index = minFrequency - _frequencies.begin();
-            ret = _tags[index];
-            _tags.erase(_tags.begin() + index);
-            _frequencies.erase(_frequencies.begin() + index);
-            return ret;
-        }
+/**
+ * L1/L2 hierarchy: the two level CACHE_HIERARCHY, built from the geometry
+ * and latencies of each level. SET is the replacement policy of L1 and,
+ * unless L2_POLICY says otherwise, of L2; the GEOMETRY arguments choose
+ * between runtime and compile-time geometries. `inclusion` is the
+ * INCLUSION policy of L2.
+ **/
+template <class SET,
+          class L1_GEOMETRY = CACHE_GEOMETRY::DYNAMIC,
+          class L2_GEOMETRY = CACHE_GEOMETRY::DYNAMIC,
+          class L2_POLICY = SET>
+    class TWO_LEVEL_CACHE
+    : public CACHE_HIERARCHY<CACHE_LEVEL<SET, CACHE_LEVEL<L2_POLICY, MAIN_MEMORY, L2_GEOMETRY>,
+                                         L1_GEOMETRY> >
+{
+    private:
+    static std::vector<CACHE_LEVEL_CONFIG> Levels(
+        UINT32 l1CacheSize, UINT32 l1BlockSize, UINT32 l1Associativity,
+        UINT32 l2CacheSize, UINT32 l2BlockSize, UINT32 l2Associativity,
+        INCLUSION::KIND inclusion, UINT32 l1HitLatency, UINT32 l2HitLatency)
+    {
+        std::vector<CACHE_LEVEL_CONFIG> levels(2);
+        const CACHE_LEVEL_CONFIG l1 = { l1CacheSize, l1BlockSize, l1Associativity, l1HitLatency,
+                                        INCLUSION::NINE };
+        const CACHE_LEVEL_CONFIG l2 = { l2CacheSize, l2BlockSize, l2Associativity, l2HitLatency,
+                                        inclusion };
+        levels[0] = l1;
+        levels[1] = l2;
+        return levels;
+    }
 
-        VOID DeleteIfPresent(CACHE_TAG tag) {
-            for (std::vector<CACHE_TAG>::iterator it = _tags.begin();
-                 it != _tags.end(); ++it)
-            {
-                if (*it == tag) { // Tag found, lets make it MRU
-                    UINT32 index = it - _tags.begin();
-                    _tags.erase(it);
-                    _frequencies.erase(_frequencies.begin() + index);
-                    break;
-                }
-            }
-        }
-    };
+    public:
+    TWO_LEVEL_CACHE(std::string name,
+                    UINT32 l1CacheSize, UINT32 l1BlockSize, UINT32 l1Associativity,
+                    UINT32 l2CacheSize, UINT32 l2BlockSize, UINT32 l2Associativity,
+                    INCLUSION::KIND inclusion = INCLUSION::BUILD_DEFAULT,
+                    UINT32 l1HitLatency = 1, UINT32 l2HitLatency = 10,
+                    UINT32 l2MissLatency = 150)
+        : CACHE_HIERARCHY<CACHE_LEVEL<SET, CACHE_LEVEL<L2_POLICY, MAIN_MEMORY, L2_GEOMETRY>,
+                                      L1_GEOMETRY> >(
+              name, Levels(l1CacheSize, l1BlockSize, l1Associativity,
+                           l2CacheSize, l2BlockSize, l2Associativity,
+                           inclusion, l1HitLatency, l2HitLatency), l2MissLatency)
+    {
+    }
+};
 
-} // namespace CACHE_SET
+/*****************************************************************************/
+/* Multi-core hierarchy with MESI coherence                                  */
+/*****************************************************************************/
 
-template <class SET>
-    class TWO_LEVEL_CACHE
+/**
+ * Test-and-test-and-set spin lock of one cache set. The critical sections
+ * are a few tag compares long, so spinning beats sleeping.
+ **/
+static inline VOID SetLock(volatile UINT32 *lock)
+{
+    while (__sync_lock_test_and_set(lock, 1))
+        while (*lock)
+            ;
+}
+
+static inline VOID SetUnlock(volatile UINT32 *lock)
+{
+    __sync_lock_release(lock);
+}
+
+/**
+ * One private L1 per core and a shared, inclusive L2 whose lines embed a
+ * MESI directory: for every L1 block of an L2 line, the bitmask of the
+ * cores that may hold it. L1 lines carry their own MESI state, so loads
+ * and stores to M/E lines (and loads to S lines) are served by the L1
+ * alone. L1 evictions are silent, so the directory may list cores that no
+ * longer hold a block; coherence actions probe those cores' L1s and clear
+ * their stale bits.
+ *
+ * Access() may be called concurrently by the cores. Every L1 and L2 set
+ * has its own spin lock, always taken L2 first; an L1 set lock is never
+ * held together with another L1 set lock. Per core counters are only
+ * written by their own core.
+ **/
+template <class SET,
+          class L1_GEOMETRY = CACHE_GEOMETRY::DYNAMIC,
+          class L2_GEOMETRY = CACHE_GEOMETRY::DYNAMIC>
+    class MULTI_CORE_CACHE
 {
     public:
     typedef enum
@@ -302,6 +4036,8 @@ template <class SET>
         ACCESS_TYPE_NUM
     } ACCESS_TYPE;
 
+    static const UINT32 MAX_CORES = 64;
+
     private:
     enum {
         HIT_L1 = 0,
@@ -310,316 +4046,494 @@ template <class SET>
         ACCESS_RESULT_NUM
     };
 
+    enum {
+        STATE_I = 0,
+        STATE_S,
+        STATE_E,
+        STATE_M
+    };
+
     static const UINT32 HIT_MISS_NUM = 2;
-    CACHE_STATS _l1_access[ACCESS_TYPE_NUM][HIT_MISS_NUM];
-    CACHE_STATS _l2_access[ACCESS_TYPE_NUM][HIT_MISS_NUM];
 
-    UINT32 _latencies[ACCESS_RESULT_NUM];
+    // Padded to host cache lines, so that cores do not share counters' lines
+    struct CORE_STATS
+    {
+        CACHE_STATS l1Access[ACCESS_TYPE_NUM][HIT_MISS_NUM];
+        CACHE_STATS l2Access[ACCESS_TYPE_NUM][HIT_MISS_NUM];
+        CACHE_STATS upgrades;           // S -> M on store hits
+        CACHE_STATS invalidations;      // remote copies invalidated by stores
+        CACHE_STATS remoteHits;         // L1 misses served by another L1
+        CACHE_STATS writebacks;         // M lines written back to L2
+        CACHE_STATS backInvalidations;  // L1 lines dropped by L2 evictions
+        CACHE_STATS pad[3];
+    };
 
-    SET *_l1_sets;
-    SET *_l2_sets;
+    typedef typename SET::template rebind<L1_GEOMETRY::ASSOC>::type L1_SET;
+    typedef typename SET::template rebind<L2_GEOMETRY::ASSOC>::type L2_SET;
+
+    const UINT32 _numCores;
+    L1_SET *_l1_sets;               // per core
+    UINT8 **_l1_state;              // per core, per L1 line
+    volatile UINT32 **_l1_locks;    // per core, per L1 set
+    L2_SET _l2_sets;
+    UINT64 *_sharers;               // per L2 line, per L1 block of it
+    volatile UINT32 *_l2_locks;     // per L2 set
+    CORE_STATS *_stats;
+
+    UINT32 _latencies[ACCESS_RESULT_NUM];
 
     const std::string _name;
-    const UINT32 _l1_cacheSize;
-    const UINT32 _l2_cacheSize;
-    const UINT32 _l1_blockSize;
-    const UINT32 _l2_blockSize;
-    const UINT32 _l1_associativity;
-    const UINT32 _l2_associativity;
+    L1_GEOMETRY _l1_geometry;
+    L2_GEOMETRY _l2_geometry;
+    UINT32 _subBlocks;              // L1 blocks per L2 block
 
-    // computed params
-    const UINT32 _l1_lineShift; // i.e. no of block offset bits
-    const UINT32 _l2_lineShift;
-    const UINT32 _l1_setIndexMask; // mask applied to get the set index
-    const UINT32 _l2_setIndexMask;
+    MULTI_CORE_CACHE(const MULTI_CORE_CACHE &);            // not copyable
+    MULTI_CORE_CACHE &operator=(const MULTI_CORE_CACHE &);
 
-    CACHE_STATS L1SumAccess(bool hit) const
-    {
-        CACHE_STATS sum = 0;
-        for (UINT32 accessType = 0; accessType < ACCESS_TYPE_NUM; accessType++)
-            sum += _l1_access[accessType][hit];
-        return sum;
-    }
-    CACHE_STATS L2SumAccess(bool hit) const
+    template <class GEOMETRY>
+    static VOID SplitAddress(const ADDRINT addr, const GEOMETRY & geometry,
+                             CACHE_TAG & tag, UINT32 & setIndex)
     {
-        CACHE_STATS sum = 0;
-        for (UINT32 accessType = 0; accessType < ACCESS_TYPE_NUM; accessType++)
-            sum += _l2_access[accessType][hit];
-        return sum;
+        tag = addr >> geometry.LineShift();
+        setIndex = tag & geometry.SetIndexMask();
+        tag = tag >> geometry.SetShift();
     }
 
-    UINT32 L1NumSets() const { return _l1_setIndexMask + 1; }
-    UINT32 L2NumSets() const { return _l2_setIndexMask + 1; }
+    UINT32 L1Line(UINT32 set, UINT32 way) const { return set * _l1_geometry.Associativity() + way; }
 
-    // accessors
-    UINT32 L1CacheSize() const { return _l1_cacheSize; }
-    UINT32 L2CacheSize() const { return _l2_cacheSize; }
-    UINT32 L1BlockSize() const { return _l1_blockSize; }
-    UINT32 L2BlockSize() const { return _l2_blockSize; }
-    UINT32 L1Associativity() const { return _l1_associativity; }
-    UINT32 L2Associativity() const { return _l2_associativity; }
-    UINT32 L1LineShift() const { return _l1_lineShift; }
-    UINT32 L2LineShift() const { return _l2_lineShift; }
-    UINT32 L1SetIndexMask() const { return _l1_setIndexMask; }
-    UINT32 L2SetIndexMask() const { return _l2_setIndexMask; }
+    // Directory entry of the L1 block at `addr`, whose L2 line is `way` of `set`
+    UINT64 SharersIndex(UINT32 set, UINT32 way, ADDRINT addr) const
+    {
+        const UINT32 block = (addr >> _l1_geometry.LineShift()) & (_subBlocks - 1);
+        return ((UINT64)set * _l2_geometry.Associativity() + way) * _subBlocks + block;
+    }
+    UINT64 &Sharers(UINT32 set, UINT32 way, ADDRINT addr)
+    {
+        return _sharers[SharersIndex(set, way, addr)];
+    }
 
-    VOID SplitAddress(const ADDRINT addr, UINT32 lineShift, UINT32 setIndexMask,
-                      CACHE_TAG & tag, UINT32 & setIndex) const
+    /**
+     * Applies a remote request to core `core`'s copy of the L1 block at
+     * `addr` (with the L2 set lock of `addr` held): a load downgrades M/E
+     * to S, a store (or an L2 eviction, `drop`) invalidates. Returns the
+     * state the copy was in, STATE_I if the core does not hold it.
+     **/
+    UINT32 Probe(UINT32 core, ADDRINT addr, bool drop, UINT32 requester)
     {
-        tag = addr >> lineShift;
-        setIndex = tag & setIndexMask;
-        tag = tag >> FloorLog2(L1NumSets());
+        CACHE_TAG tag;
+        UINT32 set;
+        SplitAddress(addr, _l1_geometry, tag, set);
+
+        SetLock(&_l1_locks[core][set]);
+        const INT32 way = _l1_sets[core].Way(set, tag);
+        UINT32 state = STATE_I;
+        if (way >= 0) {
+            UINT8 &line = _l1_state[core][L1Line(set, way)];
+            state = line;
+            if (state == STATE_M)
+                _stats[requester].writebacks++;
+            if (drop) {
+                _l1_sets[core].DeleteIfPresent(set, tag);
+                line = STATE_I;
+            } else {
+                line = STATE_S;
+            }
+        }
+        SetUnlock(&_l1_locks[core][set]);
+        return state;
     }
 
+    /**
+     * Serves a load or store miss of `core` in its L1, or a store to one
+     * of its S lines (`upgrade`), with the L2 set lock of `addr` held.
+     * Returns the cycles past the L1 and the L1 state to install.
+     **/
+    UINT32 Request(UINT32 core, ADDRINT addr, ACCESS_TYPE accessType, bool upgrade,
+                   UINT32 &state);
 
     public:
-    // constructors/destructors
-    TWO_LEVEL_CACHE(std::string name,
-                    UINT32 l1CacheSize, UINT32 l1BlockSize, UINT32 l1Associativity,
-                    UINT32 l2CacheSize, UINT32 l2BlockSize, UINT32 l2Associativity,
-                    UINT32 l1HitLatency = 1, UINT32 l2HitLatency = 10,
-                    UINT32 l2MissLatency = 150);
-
-    // Stats
-    CACHE_STATS L1Hits(ACCESS_TYPE accessType) const { return _l1_access[accessType][true];}
-    CACHE_STATS L2Hits(ACCESS_TYPE accessType) const { return _l2_access[accessType][true];}
-    CACHE_STATS L1Misses(ACCESS_TYPE accessType) const { return _l1_access[accessType][false];}
-    CACHE_STATS L2Misses(ACCESS_TYPE accessType) const { return _l2_access[accessType][false];}
-    CACHE_STATS L1Accesses(ACCESS_TYPE accessType) const { return L1Hits(accessType) + L1Misses(accessType);}
-    CACHE_STATS L2Accesses(ACCESS_TYPE accessType) const { return L2Hits(accessType) + L2Misses(accessType);}
-    CACHE_STATS L1Hits() const { return L1SumAccess(true);}
-    CACHE_STATS L2Hits() const { return L2SumAccess(true);}
-    CACHE_STATS L1Misses() const { return L1SumAccess(false);}
-    CACHE_STATS L2Misses() const { return L2SumAccess(false);}
-    CACHE_STATS L1Accesses() const { return L1Hits() + L1Misses();}
-    CACHE_STATS L2Accesses() const { return L2Hits() + L2Misses();}
+    MULTI_CORE_CACHE(std::string name, UINT32 numCores,
+                     UINT32 l1CacheSize, UINT32 l1BlockSize, UINT32 l1Associativity,
+                     UINT32 l2CacheSize, UINT32 l2BlockSize, UINT32 l2Associativity,
+                     UINT32 l1HitLatency = 1, UINT32 l2HitLatency = 10,
+                     UINT32 l2MissLatency = 150);
+    ~MULTI_CORE_CACHE();
+
+    UINT32 NumCores() const { return _numCores; }
+
+    // Stats, summed over the cores
+    CACHE_STATS L1Misses() const { return Sum(&CORE_STATS::l1Access, false); }
+    CACHE_STATS L2Misses() const { return Sum(&CORE_STATS::l2Access, false); }
 
     string StatsLong(string prefix = "") const;
     string PrintCache(string prefix = "") const;
 
-    UINT32 Access(ADDRINT addr, ACCESS_TYPE accessType);
+    static bool IsStatic() { return L1_GEOMETRY::IsStatic() && L2_GEOMETRY::IsStatic(); }
+
+    // Returns the cycles `core` waits for the request.
+    UINT32 Access(UINT32 core, ADDRINT addr, ACCESS_TYPE accessType);
+    // A single stream (e.g. from CACHE_SIM) runs on core 0
+    UINT32 Access(ADDRINT addr, ACCESS_TYPE accessType, ADDRINT = 0, UINT32 = 0)
+    {
+        return Access(0, addr, accessType);
+    }
+
+    /**
+     * Checks the protocol invariants, with no access in flight: every valid
+     * L1 line is in the L2 and listed in its directory entry, and a block
+     * held by more than one L1 is in S in all of them. Returns the first
+     * violation found, "" if there is none. Walks every line, so it is
+     * meant for tests (see check_multi_core.cpp).
+     **/
+    string Violation() const;
+
+    private:
+    typedef CACHE_STATS (CORE_STATS::*LEVEL_STATS)[ACCESS_TYPE_NUM][HIT_MISS_NUM];
+
+    CACHE_STATS Sum(LEVEL_STATS level, bool hit) const
+    {
+        CACHE_STATS sum = 0;
+        for (UINT32 c = 0; c < _numCores; c++)
+            for (UINT32 accessType = 0; accessType < ACCESS_TYPE_NUM; accessType++)
+                sum += (_stats[c].*level)[accessType][hit];
+        return sum;
+    }
 };
 
-template <class SET>
-    TWO_LEVEL_CACHE<SET>::TWO_LEVEL_CACHE(
-        std::string name,
+template <class SET, class L1_GEOMETRY, class L2_GEOMETRY>
+    MULTI_CORE_CACHE<SET, L1_GEOMETRY, L2_GEOMETRY>::MULTI_CORE_CACHE(
+        std::string name, UINT32 numCores,
         UINT32 l1CacheSize, UINT32 l1BlockSize, UINT32 l1Associativity,
         UINT32 l2CacheSize, UINT32 l2BlockSize, UINT32 l2Associativity,
         UINT32 l1HitLatency, UINT32 l2HitLatency, UINT32 l2MissLatency)
-        : _name(name),
-_l1_cacheSize(l1CacheSize),
-_l2_cacheSize(l2CacheSize),
-_l1_blockSize(l1BlockSize),
-_l2_blockSize(l2BlockSize),
-_l1_associativity(l1Associativity),
-_l2_associativity(l2Associativity),
-_l1_lineShift(FloorLog2(l1BlockSize)),
-_l2_lineShift(FloorLog2(l2BlockSize)),
-_l1_setIndexMask((l1CacheSize / (l1Associativity * l1BlockSize)) - 1),
-_l2_setIndexMask((l2CacheSize / (l2Associativity * l2BlockSize)) - 1)
-{
-
-    // They all need to be power of 2
-    ASSERTX(IsPowerOf2(_l1_blockSize));
-    ASSERTX(IsPowerOf2(_l2_blockSize));
-    ASSERTX(IsPowerOf2(_l1_setIndexMask + 1));
-    ASSERTX(IsPowerOf2(_l2_setIndexMask + 1));
-
-    // Some more sanity checks
-    ASSERTX(_l1_cacheSize <= _l2_cacheSize);
-    ASSERTX(_l1_blockSize <= _l2_blockSize);
-
-    // Allocate space for L1 and L2 sets
-    _l1_sets = new SET[L1NumSets()];
-    _l2_sets = new SET[L2NumSets()];
+        : _numCores(numCores), _name(name)
+{
+    _l1_geometry.Init(l1CacheSize, l1BlockSize, l1Associativity);
+    _l2_geometry.Init(l2CacheSize, l2BlockSize, l2Associativity);
+
+    // The directory lives in the L2, which must hold every L1 block
+    ASSERTX(numCores >= 1 && numCores <= MAX_CORES);
+    ASSERTX(L2_INCLUSIVE == 1);
+    ASSERTX(l1CacheSize <= l2CacheSize);
+    ASSERTX(l1BlockSize <= l2BlockSize);
+    _subBlocks = l2BlockSize / l1BlockSize;
+
+    const UINT32 l1Sets = _l1_geometry.NumSets();
+    const UINT32 l2Sets = _l2_geometry.NumSets();
+    const UINT64 l1Lines = (UINT64)l1Sets * l1Associativity;
+    const UINT64 l2Lines = (UINT64)l2Sets * l2Associativity;
+
+    _l1_sets = new L1_SET[numCores];
+    _l1_state = new UINT8 *[numCores];
+    _l1_locks = new volatile UINT32 *[numCores];
+    for (UINT32 c = 0; c < numCores; c++) {
+        _l1_sets[c].Init(l1Sets, l1Associativity);
+        _l1_state[c] = AlignedAlloc<UINT8>(l1Lines);
+        _l1_locks[c] = AlignedAlloc<UINT32>(l1Sets);
+        std::fill(_l1_state[c], _l1_state[c] + l1Lines, (UINT8)STATE_I);
+        std::fill(const_cast<UINT32 *>(_l1_locks[c]), const_cast<UINT32 *>(_l1_locks[c]) + l1Sets, 0);
+    }
+
+    _l2_sets.Init(l2Sets, l2Associativity);
+    _sharers = AlignedAlloc<UINT64>(l2Lines * _subBlocks);
+    _l2_locks = AlignedAlloc<UINT32>(l2Sets);
+    std::fill(_sharers, _sharers + l2Lines * _subBlocks, 0);
+    std::fill(const_cast<UINT32 *>(_l2_locks), const_cast<UINT32 *>(_l2_locks) + l2Sets, 0);
+
+    _stats = AlignedAlloc<CORE_STATS>(numCores);
+    memset(_stats, 0, numCores * sizeof(CORE_STATS));
 
     _latencies[HIT_L1] = l1HitLatency;
     _latencies[HIT_L2] = l2HitLatency;
     _latencies[MISS_L2] = l2MissLatency;
+}
 
-    for (UINT32 i = 0; i < L1NumSets(); i++)
-        _l1_sets[i].SetAssociativity(_l1_associativity);
-    for (UINT32 i = 0; i < L2NumSets(); i++)
-        _l2_sets[i].SetAssociativity(_l2_associativity);
-
-    for (UINT32 accessType = 0; accessType < ACCESS_TYPE_NUM; accessType++)
-    {
-        _l1_access[accessType][false] = 0;
-        _l2_access[accessType][true] = 0;
-        _l1_access[accessType][false] = 0;
-        _l2_access[accessType][true] = 0;
+template <class SET, class L1_GEOMETRY, class L2_GEOMETRY>
+    MULTI_CORE_CACHE<SET, L1_GEOMETRY, L2_GEOMETRY>::~MULTI_CORE_CACHE()
+{
+    for (UINT32 c = 0; c < _numCores; c++) {
+        free(_l1_state[c]);
+        free(const_cast<UINT32 *>(_l1_locks[c]));
     }
+    delete[] _l1_sets;
+    delete[] _l1_state;
+    delete[] _l1_locks;
+    free(_sharers);
+    free(const_cast<UINT32 *>(_l2_locks));
+    free(_stats);
 }
 
-template <class SET>
-    string TWO_LEVEL_CACHE<SET>::StatsLong(string prefix) const
+template <class SET, class L1_GEOMETRY, class L2_GEOMETRY>
+    UINT32 MULTI_CORE_CACHE<SET, L1_GEOMETRY, L2_GEOMETRY>::Request(
+        UINT32 core, ADDRINT addr, ACCESS_TYPE accessType, bool upgrade, UINT32 &state)
     {
-        const UINT32 headerWidth = 19;
-        const UINT32 numberWidth = 12;
+        CORE_STATS &stats = _stats[core];
+        CACHE_TAG l2Tag;
+        UINT32 l2SetIndex;
+        UINT32 cycles = _latencies[HIT_L2];
 
-        string out;
+        SplitAddress(addr, _l2_geometry, l2Tag, l2SetIndex);
+        if (!upgrade) {
+            const bool l2Hit = _l2_sets.Find(l2SetIndex, l2Tag);
+            stats.l2Access[accessType][l2Hit]++;
 
-        // L1 stats first
-        out += prefix + "L1 Cache Stats:" + "\n";
+            if (!l2Hit) {
+                CACHE_TAG l2_replaced = _l2_sets.Replace(l2SetIndex, l2Tag);
+                const INT32 way = _l2_sets.Way(l2SetIndex, l2Tag);
+                cycles += _latencies[MISS_L2];
 
-        for (UINT32 i = 0; i < ACCESS_TYPE_NUM; i++)
-        {
-            const ACCESS_TYPE accessType = ACCESS_TYPE(i);
+                // Inclusion: drop the victim from every L1 listed for it
+                if (!(l2_replaced == INVALID_TAG)) {
+                    ADDRINT replacedAddr = ADDRINT(l2_replaced) << _l2_geometry.SetShift();
+                    replacedAddr = replacedAddr | l2SetIndex;
+                    replacedAddr = replacedAddr << _l2_geometry.LineShift();
+                    for (UINT32 i = 0; i < _subBlocks; i++) {
+                        const ADDRINT blockAddr = replacedAddr | (i << _l1_geometry.LineShift());
+                        UINT64 &sharers = Sharers(l2SetIndex, way, blockAddr);
+                        for (UINT32 c = 0; sharers; c++, sharers >>= 1)
+                            if ((sharers & 1) && Probe(c, blockAddr, true, core) != STATE_I)
+                                stats.backInvalidations++;
+                    }
+                }
+                for (UINT32 i = 0; i < _subBlocks; i++)
+                    _sharers[((UINT64)l2SetIndex * _l2_geometry.Associativity() + way) * _subBlocks + i] = 0;
+            }
+        }
 
-            std::string type(accessType == ACCESS_TYPE_LOAD ? "L1-Load" : "L1-Store");
+        // Remote copies: stores invalidate them, loads downgrade M/E to S
+        const INT32 way = _l2_sets.Way(l2SetIndex, l2Tag);
+        UINT64 &sharers = Sharers(l2SetIndex, way, addr);
+        const bool store = (accessType == ACCESS_TYPE_STORE);
+        bool shared = false;
+        for (UINT32 c = 0; c < _numCores; c++) {
+            if (c == core || !(sharers & (1ULL << c)))
+                continue;
+            const UINT32 remote = Probe(c, addr, store, core);
+            if (remote == STATE_I || store)
+                sharers &= ~(1ULL << c);
+            if (remote == STATE_I)
+                continue;
+            shared = !store;
+            if (remote != STATE_S && !upgrade)
+                stats.remoteHits++;
+            if (store)
+                stats.invalidations++;
+        }
+        sharers |= 1ULL << core;
 
-            out += prefix + ljstr(type + "-Hits:      ", headerWidth)
-                + dec2str(L1Hits(accessType), numberWidth)  +
-                "  " +fltstr(100.0 * L1Hits(accessType) / L1Accesses(accessType), 2, 6) + "%\n";
+        state = store ? STATE_M : shared ? STATE_S : STATE_E;
+        return cycles;
+    }
 
-            out += prefix + ljstr(type + "-Misses:    ", headerWidth)
-                + dec2str(L1Misses(accessType), numberWidth) +
-                "  " +fltstr(100.0 * L1Misses(accessType) / L1Accesses(accessType), 2, 6) + "%\n";
+template <class SET, class L1_GEOMETRY, class L2_GEOMETRY>
+    UINT32 MULTI_CORE_CACHE<SET, L1_GEOMETRY, L2_GEOMETRY>::Access(
+        UINT32 core, ADDRINT addr, ACCESS_TYPE accessType)
+    {
+        CORE_STATS &stats = _stats[core];
+        L1_SET &l1 = _l1_sets[core];
+        CACHE_TAG l1Tag, l2Tag;
+        UINT32 l1SetIndex, l2SetIndex;
+        UINT32 cycles = _latencies[HIT_L1];
 
-            out += prefix + ljstr(type + "-Accesses:  ", headerWidth)
-                + dec2str(L1Accesses(accessType), numberWidth) +
-                "  " +fltstr(100.0 * L1Accesses(accessType) / L1Accesses(accessType), 2, 6) + "%\n";
+        SplitAddress(addr, _l1_geometry, l1Tag, l1SetIndex);
+        volatile UINT32 *l1Lock = &_l1_locks[core][l1SetIndex];
 
-            out += prefix + "\n";
+        // Hits with enough permission only need the L1 set
+        SetLock(l1Lock);
+        INT32 way = l1.Way(l1SetIndex, l1Tag);
+        if (way >= 0) {
+            UINT8 &line = _l1_state[core][L1Line(l1SetIndex, way)];
+            if (accessType == ACCESS_TYPE_LOAD || line != STATE_S) {
+                l1.Find(l1SetIndex, l1Tag);
+                if (accessType == ACCESS_TYPE_STORE)
+                    line = STATE_M;
+                SetUnlock(l1Lock);
+                stats.l1Access[accessType][true]++;
+                return cycles;
+            }
         }
+        SetUnlock(l1Lock);
 
-        out += prefix + ljstr("L1-Total-Hits:      ", headerWidth)
-            + dec2str(L1Hits(), numberWidth) +
-            "  " +fltstr(100.0 * L1Hits() / L1Accesses(), 2, 6) + "%\n";
+        // Misses and upgrades go through the directory
+        SplitAddress(addr, _l2_geometry, l2Tag, l2SetIndex);
+        volatile UINT32 *l2Lock = &_l2_locks[l2SetIndex];
+        SetLock(l2Lock);
 
-        out += prefix + ljstr("L1-Total-Misses:    ", headerWidth)
-            + dec2str(L1Misses(), numberWidth) +
-            "  " +fltstr(100.0 * L1Misses() / L1Accesses(), 2, 6) + "%\n";
+        // Only this core fills its L1, but others may have invalidated the
+        // line in the meantime
+        SetLock(l1Lock);
+        way = l1.Way(l1SetIndex, l1Tag);
+        const bool upgrade = (way >= 0);
+        SetUnlock(l1Lock);
 
-        out += prefix + ljstr("L1-Total-Accesses:  ", headerWidth)
-            + dec2str(L1Accesses(), numberWidth) +
-            "  " +fltstr(100.0 * L1Accesses() / L1Accesses(), 2, 6) + "%\n";
-        out += "\n";
+        UINT32 state;
+        cycles += Request(core, addr, accessType, upgrade, state);
 
+        SetLock(l1Lock);
+        if (upgrade) {
+            l1.Find(l1SetIndex, l1Tag);
+            stats.upgrades++;
+        } else if (accessType == ACCESS_TYPE_LOAD || STORE_ALLOCATION == STORE_ALLOCATE) {
+            // The victim stays listed in the directory, see above
+            l1.Replace(l1SetIndex, l1Tag);
+            way = l1.Way(l1SetIndex, l1Tag);
+            UINT8 &victim = _l1_state[core][L1Line(l1SetIndex, way)];
+            if (victim == STATE_M)
+                stats.writebacks++;
+        } else {
+            way = -1;
+        }
+        if (way >= 0)
+            _l1_state[core][L1Line(l1SetIndex, way)] = state;
+        SetUnlock(l1Lock);
+        SetUnlock(l2Lock);
 
-        // L2 Stats now.
-        out += prefix + "L2 Cache Stats:" + "\n";
+        stats.l1Access[accessType][upgrade]++;
+        return cycles;
+    }
 
-        for (UINT32 i = 0; i < ACCESS_TYPE_NUM; i++)
-        {
-            const ACCESS_TYPE accessType = ACCESS_TYPE(i);
+template <class SET, class L1_GEOMETRY, class L2_GEOMETRY>
+    string MULTI_CORE_CACHE<SET, L1_GEOMETRY, L2_GEOMETRY>::Violation() const
+    {
+        const UINT32 l1Sets = _l1_geometry.NumSets();
+        const UINT32 l1Ways = _l1_geometry.Associativity();
+        for (UINT32 c = 0; c < _numCores; c++)
+            for (UINT32 set = 0; set < l1Sets; set++)
+                for (UINT32 way = 0; way < l1Ways; way++) {
+                    const CACHE_TAG tag = _l1_sets[c].TagAt(set, way);
+                    if (tag == INVALID_TAG)
+                        continue;
+                    ADDRINT addr = ADDRINT(tag) << _l1_geometry.SetShift();
+                    addr = (addr | set) << _l1_geometry.LineShift();
+                    const string where = "core " + dec2str(c, 0) + " block " + hexstr(addr);
 
-            std::string type(accessType == ACCESS_TYPE_LOAD ? "L2-Load" : "L2-Store");
+                    const UINT32 state = _l1_state[c][L1Line(set, way)];
+                    if (state == STATE_I)
+                        return where + ": valid L1 line in state I";
 
-            out += prefix + ljstr(type + "-Hits:      ", headerWidth)
-                + dec2str(L2Hits(accessType), numberWidth)  +
-                "  " +fltstr(100.0 * L2Hits(accessType) / L2Accesses(accessType), 2, 6) + "%\n";
+                    CACHE_TAG l2Tag;
+                    UINT32 l2Set;
+                    SplitAddress(addr, _l2_geometry, l2Tag, l2Set);
+                    const INT32 l2Way = _l2_sets.Way(l2Set, l2Tag);
+                    if (l2Way < 0)
+                        return where + ": not in the L2";
+                    if (!(_sharers[SharersIndex(l2Set, l2Way, addr)] & (1ULL << c)))
+                        return where + ": missing from the directory";
 
-            out += prefix + ljstr(type + "-Misses:    ", headerWidth)
-                + dec2str(L2Misses(accessType), numberWidth) +
-                "  " +fltstr(100.0 * L2Misses(accessType) / L2Accesses(accessType), 2, 6) + "%\n";
+                    if (state == STATE_S)
+                        continue;
+                    for (UINT32 other = 0; other < _numCores; other++) {
+                        CACHE_TAG otherTag;
+                        UINT32 otherSet;
+                        SplitAddress(addr, _l1_geometry, otherTag, otherSet);
+                        if (other != c && _l1_sets[other].Way(otherSet, otherTag) >= 0)
+                            return where + ": in M/E but also held by core " + dec2str(other, 0);
+                    }
+                }
+        return "";
+    }
 
-            out += prefix + ljstr(type + "-Accesses:  ", headerWidth)
-                + dec2str(L2Accesses(accessType), numberWidth) +
-                "  " +fltstr(100.0 * L2Accesses(accessType) / L2Accesses(accessType), 2, 6) + "%\n";
+template <class SET, class L1_GEOMETRY, class L2_GEOMETRY>
+    string MULTI_CORE_CACHE<SET, L1_GEOMETRY, L2_GEOMETRY>::StatsLong(string prefix) const
+    {
+        const UINT32 headerWidth = 21;
+        const UINT32 numberWidth = 12;
 
-            out += prefix + "\n";
+        CACHE_STATS l1[ACCESS_TYPE_NUM][HIT_MISS_NUM] = { { 0, 0 }, { 0, 0 } };
+        CACHE_STATS l2[ACCESS_TYPE_NUM][HIT_MISS_NUM] = { { 0, 0 }, { 0, 0 } };
+        CORE_STATS total;
+        memset(&total, 0, sizeof(total));
+        for (UINT32 c = 0; c < _numCores; c++) {
+            for (UINT32 accessType = 0; accessType < ACCESS_TYPE_NUM; accessType++)
+                for (UINT32 hit = 0; hit < HIT_MISS_NUM; hit++) {
+                    l1[accessType][hit] += _stats[c].l1Access[accessType][hit];
+                    l2[accessType][hit] += _stats[c].l2Access[accessType][hit];
+                }
+            total.upgrades += _stats[c].upgrades;
+            total.invalidations += _stats[c].invalidations;
+            total.remoteHits += _stats[c].remoteHits;
+            total.writebacks += _stats[c].writebacks;
+            total.backInvalidations += _stats[c].backInvalidations;
         }
 
-        out += prefix + ljstr("L2-Total-Hits:      ", headerWidth)
-            + dec2str(L2Hits(), numberWidth) +
-            "  " +fltstr(100.0 * L2Hits() / L2Accesses(), 2, 6) + "%\n";
+        string out = LevelStatsLong(prefix, "L1", l1) + LevelStatsLong(prefix, "L2", l2) +
+                     _l2_sets.StatsLong(prefix, "L2");
 
-        out += prefix + ljstr("L2-Total-Misses:    ", headerWidth)
-            + dec2str(L2Misses(), numberWidth) +
-            "  " +fltstr(100.0 * L2Misses() / L2Accesses(), 2, 6) + "%\n";
+        out += prefix + "Coherence Stats (MESI):\n";
+        out += prefix + ljstr("Upgrades:", headerWidth) + dec2str(total.upgrades, numberWidth) + "\n";
+        out += prefix + ljstr("Invalidations:", headerWidth) + dec2str(total.invalidations, numberWidth) + "\n";
+        out += prefix + ljstr("Remote-Hits:", headerWidth) + dec2str(total.remoteHits, numberWidth) + "\n";
+        out += prefix + ljstr("Writebacks:", headerWidth) + dec2str(total.writebacks, numberWidth) + "\n";
+        out += prefix + ljstr("Back-Invalidations:", headerWidth) + dec2str(total.backInvalidations, numberWidth) + "\n";
+        out += prefix + "\n";
 
-        out += prefix + ljstr("L2-Total-Accesses:  ", headerWidth)
-            + dec2str(L2Accesses(), numberWidth) +
-            "  " +fltstr(100.0 * L2Accesses() / L2Accesses(), 2, 6) + "%\n";
+        out += prefix + "Per-Core Stats: (Core - L1-Accesses - L1-Misses - Upgrades - Invalidations - Remote-Hits)\n";
+        for (UINT32 c = 0; c < _numCores; c++) {
+            const CORE_STATS &stats = _stats[c];
+            const CACHE_STATS misses = stats.l1Access[ACCESS_TYPE_LOAD][false] +
+                                       stats.l1Access[ACCESS_TYPE_STORE][false];
+            const CACHE_STATS accesses = misses + stats.l1Access[ACCESS_TYPE_LOAD][true] +
+                                         stats.l1Access[ACCESS_TYPE_STORE][true];
+            out += prefix + "  " + dec2str(c, 2) + ": " + dec2str(accesses, numberWidth) + " "
+                + dec2str(misses, numberWidth) + " " + dec2str(stats.upgrades, numberWidth) + " "
+                + dec2str(stats.invalidations, numberWidth) + " "
+                + dec2str(stats.remoteHits, numberWidth) + "\n";
+        }
         out += prefix + "\n";
 
         return out;
     }
 
-template <class SET>
-    string TWO_LEVEL_CACHE<SET>::PrintCache(string prefix) const
+template <class SET, class L1_GEOMETRY, class L2_GEOMETRY>
+    string MULTI_CORE_CACHE<SET, L1_GEOMETRY, L2_GEOMETRY>::PrintCache(string prefix) const
     {
         string out;
 
         out += prefix + _name + ":\n";
-        out += prefix + "  L1-Data Cache:\n";
-        out += prefix + "    Size(KB):       " + dec2str(this->L1CacheSize()/KILO, 5) + "\n";
-        out += prefix + "    Block Size(B):  " + dec2str(this->L1BlockSize(), 5) + "\n";
-        out += prefix + "    Associativity:  " + dec2str(this->L1Associativity(), 5) + "\n";
+        out += prefix + "  Cores:            " + dec2str(_numCores, 5) + "\n";
+        out += prefix + "  L1-Data Cache (private):\n";
+        out += prefix + "    Size(KB):       " + dec2str(_l1_geometry.CacheSize()/KILO, 5) + "\n";
+        out += prefix + "    Block Size(B):  " + dec2str(_l1_geometry.BlockSize(), 5) + "\n";
+        out += prefix + "    Associativity:  " + dec2str(_l1_geometry.Associativity(), 5) + "\n";
         out += prefix + "\n";
-        out += prefix + "  L2-Data Cache:\n";
-        out += prefix + "    Size(KB):       " + dec2str(this->L2CacheSize()/KILO, 5) + "\n";
-        out += prefix + "    Block Size(B):  " + dec2str(this->L2BlockSize(), 5) + "\n";
-        out += prefix + "    Associativity:  " + dec2str(this->L2Associativity(), 5) + "\n";
+        out += prefix + "  L2-Data Cache (shared):\n";
+        out += prefix + "    Size(KB):       " + dec2str(_l2_geometry.CacheSize()/KILO, 5) + "\n";
+        out += prefix + "    Block Size(B):  " + dec2str(_l2_geometry.BlockSize(), 5) + "\n";
+        out += prefix + "    Associativity:  " + dec2str(_l2_geometry.Associativity(), 5) + "\n";
         out += prefix + "\n";
 
         out += prefix + "Latencies: " + dec2str(_latencies[HIT_L1], 4) + " "
             + dec2str(_latencies[HIT_L2], 4) + " "
             + dec2str(_latencies[MISS_L2], 4) + "\n";
-        out += prefix + "L1-Sets: " + this->_l1_sets[0].Name() + " assoc: " +
-            dec2str(this->_l1_sets[0].GetAssociativity(), 3) + "\n";
-        out += prefix + "L2-Sets: " + this->_l2_sets[0].Name() + " assoc: " +
-            dec2str(this->_l2_sets[0].GetAssociativity(), 3) + "\n";
+        out += prefix + "L1-Sets: " + _l1_sets[0].Name() + " assoc: " +
+            dec2str(_l1_sets[0].GetAssociativity(), 3) + "\n";
+        out += prefix + "L2-Sets: " + _l2_sets.Name() + " assoc: " +
+            dec2str(_l2_sets.GetAssociativity(), 3) + "\n";
         out += prefix + "Store_allocation: " + (STORE_ALLOCATION == STORE_ALLOCATE ? "Yes" : "No") + "\n";
-        out += prefix + "L2_inclusive: " + (L2_INCLUSIVE == 1 ? "Yes" : "No") + "\n";
+        out += prefix + "L2_inclusive: Yes\n";
+        out += prefix + "Coherence: MESI, directory in L2\n";
+        out += prefix + "Geometry: " + (IsStatic() ? "static" : "dynamic") + "\n";
         out += "\n";
 
         return out;
     }
 
-// Returns the cycles to serve the request.
-template <class SET>
-    UINT32 TWO_LEVEL_CACHE<SET>::Access(ADDRINT addr, ACCESS_TYPE accessType)
-    {
-        CACHE_TAG l1Tag, l2Tag;
-        UINT32 l1SetIndex, l2SetIndex;
-        bool l1Hit = 0, l2Hit = 0;
-        UINT32 cycles = 0;
-
-        // Let's check L1 first
-        SplitAddress(addr, L1LineShift(), L1SetIndexMask(), l1Tag, l1SetIndex);
-        SET & l1Set = _l1_sets[l1SetIndex];
-        l1Hit = l1Set.Find(l1Tag);
-        _l1_access[accessType][l1Hit]++;
-        cycles = _latencies[HIT_L1];
-
-        if (!l1Hit) {
-            // On miss, loads always allocate, stores optionally
-            if (accessType == ACCESS_TYPE_LOAD ||
-                STORE_ALLOCATION == STORE_ALLOCATE)
-                l1Set.Replace(l1Tag);
-
-            // Let's check L2 now
-            SplitAddress(addr, L2LineShift(), L2SetIndexMask(), l2Tag, l2SetIndex);
-            SET & l2Set = _l2_sets[l2SetIndex];
-            l2Hit = l2Set.Find(l2Tag);
-            _l2_access[accessType][l2Hit]++;
-            cycles += _latencies[HIT_L2];
-
-            // L2 always allocates loads and stores
-            if (!l2Hit) {
-                CACHE_TAG l2_replaced = l2Set.Replace(l2Tag);
-                cycles += _latencies[MISS_L2];
-
-                // If L2 is inclusive and a TAG has been replaced we need to remove
-                // all evicted blocks from L1.
-                if ((L2_INCLUSIVE == 1) && !(l2_replaced == INVALID_TAG)) {
-                    ADDRINT replacedAddr = ADDRINT(l2Tag) << FloorLog2(L2NumSets());
-                    replacedAddr = replacedAddr | l2SetIndex;
-                    replacedAddr = replacedAddr << L2LineShift();
-                    for (UINT32 i=0; i < L2BlockSize(); i+=L1BlockSize()) {
-                        ADDRINT newAddr = replacedAddr | i;
-                        SplitAddress(newAddr, L1LineShift(), L1SetIndexMask(), l1Tag, l1SetIndex);
-                        l1Set = _l1_sets[l1SetIndex];
-                        l1Set.DeleteIfPresent(l1Tag);
-                    }
-                }
-            }
-        }
-
-        return cycles;
-    }
+/**
+ * The MULTI_CORE_CACHE with the policy and geometries of a TWO_LEVEL_CACHE
+ * type, e.g. the one picked by VisitCacheType (whose L2 has the L1 policy).
+ **/
+template <class CACHE> struct MULTI_CORE_OF;
+template <class SET, class L1_GEOMETRY, class L2_GEOMETRY, class L2_POLICY>
+struct MULTI_CORE_OF<TWO_LEVEL_CACHE<SET, L1_GEOMETRY, L2_GEOMETRY, L2_POLICY> >
+{
+    typedef MULTI_CORE_CACHE<SET, L1_GEOMETRY, L2_GEOMETRY> type;
+};
+// Multi-core hierarchies have two levels: deeper ones map to their L1
+// policy for VisitCacheType's sake, but are rejected at runtime
+template <class SET, class NEXT, class GEOMETRY>
+struct MULTI_CORE_OF<CACHE_HIERARCHY<CACHE_LEVEL<SET, NEXT, GEOMETRY> > >
+{
+    typedef MULTI_CORE_CACHE<SET> type;
+};
 
 #endif // CACHE_H
-
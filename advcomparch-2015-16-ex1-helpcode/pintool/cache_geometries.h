@@ -0,0 +1,35 @@
+/* Generated by gen_cache_geometries.py -- do not edit. */
+#ifndef CACHE_GEOMETRIES_H
+#define CACHE_GEOMETRIES_H
+
+/**
+ * X(l1SizeKB, l1Assoc, l1BlockSize, l2SizeKB, l2Assoc, l2BlockSize)
+ **/
+#define CACHE_GEOMETRY_TABLE(X) \
+    X(  32,  8,  64,  256,  8,  64) \
+    X(  16,  4,  32, 1024,  8, 128) \
+    X(  16,  4,  64, 1024,  8, 128) \
+    X(  16,  4, 128, 1024,  8, 128) \
+    X(  32,  4,  32, 1024,  8, 128) \
+    X(  32,  4,  64, 1024,  8, 128) \
+    X(  32,  4, 128, 1024,  8, 128) \
+    X(  32,  8,  64, 1024,  8, 128) \
+    X(  64,  4,  32, 1024,  8, 128) \
+    X(  64,  4,  64, 1024,  8, 128) \
+    X(  64,  4, 128, 1024,  8, 128) \
+    X(  64,  8,  64, 1024,  8, 128) \
+    X( 128,  8,  64, 1024,  8, 128) \
+    X(  32,  8,  64,  256,  4, 128) \
+    X(  32,  8,  64,  512,  4, 128) \
+    X(  32,  8,  64,  512,  8,  64) \
+    X(  32,  8,  64,  512,  8, 128) \
+    X(  32,  8,  64,  512,  8, 256) \
+    X(  32,  8,  64, 1024,  8,  64) \
+    X(  32,  8,  64, 1024,  8, 256) \
+    X(  32,  8,  64, 1024, 16, 128) \
+    X(  32,  8,  64, 2048,  8,  64) \
+    X(  32,  8,  64, 2048,  8, 128) \
+    X(  32,  8,  64, 2048,  8, 256) \
+    X(  32,  8,  64, 2048, 16, 128) \
+
+#endif // CACHE_GEOMETRIES_H
@@ -0,0 +1,481 @@
+/**
+ * Pin-free replay of a memory reference trace recorded with
+ * `cslab_cache -record`. The trace is mmap()ed and fed to the same cache
+ * models as cslab_cache, which report in the same format; the -o, -L1?,
+ * -L2?, -L3?, -cfg, -cfg_file, -sdist and -sdist_max_assoc options mean
+ * the same as for the pintool.
+ *
+ *   $ make cache_replay
+ *   $ ./cache_replay -cfg 32_8_64:1024_8_128 -cfg 64_8_64:1024_8_128 \
+ *         -o outputs/blackscholes.dcache_cslab.out blackscholes.trace
+ *
+ * With -threads N the models are split among N threads, each of which
+ * decodes the trace on its own (decoding is much cheaper than simulating).
+ * A single configuration is instead split by sets among the N threads (see
+ * SHARDED_REPLAY), with the same results as the serial replay.
+ *
+ * The cache models, not the decoding, bound the throughput. On the Xeon
+ * this was measured on, one thread decodes 80 to 290 Mrefs/s but
+ * simulates 15 to 45 Mrefs/s of a configuration (up to about 70 Mrefs/s
+ * when nearly every reference hits L1). Time grows linearly with the
+ * number of configurations, and -threads is what scales it.
+ *
+ * With -opt 1 every configuration is also replayed with Belady's optimal
+ * replacement (see belady.h), reported like the other configurations in
+ * <output>.opt.out, or <output>.opt.L1_....out with -cfg.
+ **/
+#include "pin_compat.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "cache.h"
+#include "cache_sim.h"
+#include "trace.h"
+#include "belady.h"
+
+typedef CACHE_SET::LRU CACHE_SET_T;
+
+static std::vector<CACHE_SIM *> models;
+static const VOID *trace_data;
+static UINT64 trace_size;
+
+struct REPLAY_THREAD
+{
+    UINT32 id, numThreads;
+    pthread_t thread;
+};
+
+static VOID *ReplayMain(VOID *arg)
+{
+    const REPLAY_THREAD *self = static_cast<const REPLAY_THREAD *>(arg);
+
+    TRACE_READER reader;
+    reader.Init(trace_data, trace_size);
+    std::vector<MEMREF> refs(reader.Header().blockRefs);
+
+    UINT32 n;
+    while ((n = reader.NextBlock(&refs[0])) > 0)
+        for (UINT32 i = self->id; i < models.size(); i += self->numThreads)
+            models[i]->Simulate(&refs[0], n);
+    return NULL;
+}
+
+/**
+ * Parallel replay of one cache configuration. References are split by
+ * the address bits that index both an L1 and an L2 set (see
+ * CACHE_CONFIG::SharedSetBits()), so every set, and every inclusion
+ * back-invalidation, is handled by a single thread, in trace order. Each
+ * thread simulates on its own copy of the cache, touching only its sets,
+ * and the stats of the copies are summed at the end: for deterministic
+ * replacement policies the result is bit for bit the serial one.
+ *
+ * Work proceeds in rounds of one trace block per thread. Each thread
+ * decodes its block and bins the references by owner thread; after a
+ * barrier each thread simulates its bins of all the blocks of the round,
+ * in block order.
+ **/
+template <class CACHE>
+class SHARDED_REPLAY
+{
+    private:
+    struct SHARD_THREAD
+    {
+        UINT32 id;
+        pthread_t thread;
+        SHARDED_REPLAY *replay;
+        CACHE *cache;
+        UINT64 cycles;
+        std::vector<MEMREF> refs;               // block decoded this round
+        UINT32 numRefs;
+        std::vector<std::vector<UINT32> > bins; // indices into refs, per owner
+    };
+
+    const UINT32 _numThreads;
+    UINT32 _shift;
+    ADDRINT _mask;
+    std::vector<SHARD_THREAD> _threads;
+    pthread_barrier_t _barrier;
+
+    VOID Replay(SHARD_THREAD &self)
+    {
+        const UINT32 numThreads = _numThreads;
+        TRACE_READER reader;
+        reader.Init(trace_data, trace_size);
+        self.refs.resize(reader.Header().blockRefs);
+        self.bins.resize(numThreads);
+
+        // Thread i decodes blocks i, i + T, i + 2T, ...
+        for (UINT32 b = 0; b < self.id; b++)
+            reader.SkipBlock();
+
+        for (;;) {
+            self.numRefs = reader.NextBlock(&self.refs[0]);
+            for (UINT32 b = 1; b < numThreads; b++)
+                reader.SkipBlock();
+            for (UINT32 t = 0; t < numThreads; t++)
+                self.bins[t].clear();
+            for (UINT32 i = 0; i < self.numRefs; i++)
+                self.bins[((self.refs[i].addr >> _shift) & _mask) % numThreads].push_back(i);
+
+            pthread_barrier_wait(&_barrier);
+
+            bool done = true;
+            for (UINT32 t = 0; t < numThreads; t++) {
+                const SHARD_THREAD &block = _threads[t];
+                const std::vector<UINT32> &bin = block.bins[self.id];
+                done &= (block.numRefs == 0);
+                for (UINT32 i = 0; i < bin.size(); i++) {
+                    const MEMREF &ref = block.refs[bin[i]];
+                    self.cycles += self.cache->Access(ref.addr, ref.type == MEMREF_LOAD ?
+                        CACHE::ACCESS_TYPE_LOAD : CACHE::ACCESS_TYPE_STORE, ref.pc, ref.size);
+                }
+            }
+
+            // Do not decode over blocks others are still simulating
+            pthread_barrier_wait(&_barrier);
+            if (done)
+                break;
+        }
+    }
+
+    static VOID *ThreadMain(VOID *arg)
+    {
+        SHARD_THREAD *self = static_cast<SHARD_THREAD *>(arg);
+        self->replay->Replay(*self);
+        return NULL;
+    }
+
+    public:
+    SHARDED_REPLAY(const CACHE_CONFIG &config, UINT32 numThreads)
+        : _numThreads(numThreads), _threads(numThreads)
+    {
+        _mask = (ADDRINT(1) << config.SharedSetBits(_shift)) - 1;
+        for (UINT32 i = 0; i < numThreads; i++) {
+            _threads[i].id = i;
+            _threads[i].replay = this;
+            _threads[i].cache = NewCache<CACHE>(config);
+            _threads[i].cycles = 0;
+            _threads[i].numRefs = 0;
+        }
+    }
+
+    // Returns the cache holding the summed stats; the caller owns it.
+    CACHE *Run(UINT64 &cycles)
+    {
+        pthread_barrier_init(&_barrier, NULL, _numThreads);
+        for (UINT32 i = 0; i < _numThreads; i++)
+            pthread_create(&_threads[i].thread, NULL, ThreadMain, &_threads[i]);
+        for (UINT32 i = 0; i < _numThreads; i++)
+            pthread_join(_threads[i].thread, NULL);
+        pthread_barrier_destroy(&_barrier);
+
+        CACHE *cache = _threads[0].cache;
+        cycles = _threads[0].cycles;
+        for (UINT32 i = 1; i < _numThreads; i++) {
+            cache->AddStats(*_threads[i].cache);
+            cycles += _threads[i].cycles;
+            delete _threads[i].cache;
+        }
+        return cache;
+    }
+};
+
+struct SHARDED_RUNNER
+{
+    const CACHE_CONFIG &config;
+    const UINT32 numThreads;
+    CACHE_SIM *sim;
+
+    SHARDED_RUNNER(const CACHE_CONFIG &cfg, UINT32 threads)
+        : config(cfg), numThreads(threads), sim(NULL) {}
+
+    template <class CACHE>
+    VOID Visit()
+    {
+        SHARDED_REPLAY<CACHE> replay(config, numThreads);
+        UINT64 cycles;
+        CACHE *cache = replay.Run(cycles);
+        sim = new CACHE_SIM(config.OutputName(""), cache);
+        sim->cycles = cycles;
+    }
+};
+
+static double Now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+static VOID Report(std::ofstream &out, UINT64 instructions, const CACHE_SIM *sim)
+{
+    // As in cslab_cache, every instruction costs one cycle on top of the
+    // memory hierarchy
+    const UINT64 cycles = instructions + sim->cycles;
+
+    out << "Total Instructions: " << instructions << "\n";
+    out << "Total Cycles: " << cycles << "\n";
+    out << "IPC: " << (double)instructions / (double)cycles << "\n";
+    out << "\n";
+    out << sim->Report();
+}
+
+static int Usage()
+{
+    cerr << "Usage: cache_replay [options] <trace>\n"
+            "  -o <file>              output file (cslab_cache.out)\n"
+            "  -L1c/-L1a/-L1b <n>     L1 size (KB), associativity, block size (32, 8, 64)\n"
+            "  -L2c/-L2a/-L2b <n>     L2 size (KB), associativity, block size (256, 8, 64)\n"
+            "  -L3c/-L3a/-L3b <n>     L3 size (KB, 0 for no L3), associativity, block size (0, 16, 64)\n"
+            "  -cfg <L1c_L1a_L1b:L2c_L2a_L2b[:L3c_L3a_L3b]>  simulate this configuration (repeatable)\n"
+            "  -cfg_file <file>       one -cfg configuration per line\n"
+            "  -sdist <block_size>_<sets>  LRU stack distance analysis (repeatable)\n"
+            "  -sdist_max_assoc <n>   largest associativity of the miss ratio curves (64)\n"
+            "  -threads <n>           replay threads; a single configuration is split by sets (1)\n"
+            "  -L1prefetch/-L2prefetch <none|next_line|stride|stream>  prefetchers (none)\n"
+            "  -prefetch_degree <n>   most prefetches per trigger (2)\n"
+            "  -prefetch_distance <n> blocks a stream prefetcher runs ahead (16)\n"
+            "  -inclusion <inclusive|exclusive|nine>  L2 inclusion of L1 (the build's L2_INCLUSIVE)\n"
+            "  -opt <0|1>             also replay with optimal (Belady) replacement (0)\n"
+            "  -opt_chunk <n>         next uses kept in memory per block size, in references (16M)\n";
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    string outputFile = "cslab_cache.out";
+    // Zeroed fields are off or the defaults (see CACHE_CONFIG)
+    CACHE_CONFIG single = CACHE_CONFIG();
+    single.l1Size = 32;
+    single.l1Assoc = 8;
+    single.l1Block = 64;
+    single.l2Size = 256;
+    single.l2Assoc = 8;
+    single.l2Block = 64;
+    single.l3Assoc = 16;
+    single.l3Block = 64;
+    std::vector<string> configNames, sdistNames;
+    UINT32 sdistMaxAssoc = 64, numThreads = 1;
+    PREFETCHER::KIND l1Prefetch = PREFETCHER::NONE, l2Prefetch = PREFETCHER::NONE;
+    UINT32 prefetchDegree = 2, prefetchDistance = 16;
+    INCLUSION inclusion;
+    memset(&inclusion, 0, sizeof(inclusion));
+    bool opt = false;
+    UINT64 optChunk = 1 << 24;
+    const CHAR *tracePath = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        const string arg = argv[i];
+        if (arg[0] != '-') {
+            tracePath = argv[i];
+            continue;
+        }
+        if (i + 1 == argc)
+            return Usage();
+        const CHAR *value = argv[++i];
+
+        if (arg == "-o") outputFile = value;
+        else if (arg == "-L1c") single.l1Size = atoi(value);
+        else if (arg == "-L1a") single.l1Assoc = atoi(value);
+        else if (arg == "-L1b") single.l1Block = atoi(value);
+        else if (arg == "-L2c") single.l2Size = atoi(value);
+        else if (arg == "-L2a") single.l2Assoc = atoi(value);
+        else if (arg == "-L2b") single.l2Block = atoi(value);
+        else if (arg == "-L3c") single.l3Size = atoi(value);
+        else if (arg == "-L3a") single.l3Assoc = atoi(value);
+        else if (arg == "-L3b") single.l3Block = atoi(value);
+        else if (arg == "-cfg") configNames.push_back(value);
+        else if (arg == "-sdist") sdistNames.push_back(value);
+        else if (arg == "-sdist_max_assoc") sdistMaxAssoc = atoi(value);
+        else if (arg == "-threads") numThreads = atoi(value);
+        else if (arg == "-prefetch_degree") prefetchDegree = atoi(value);
+        else if (arg == "-prefetch_distance") prefetchDistance = atoi(value);
+        else if (arg == "-opt") opt = atoi(value) != 0;
+        else if (arg == "-opt_chunk") optChunk = strtoull(value, NULL, 0);
+        else if (arg == "-L1prefetch" || arg == "-L2prefetch") {
+            if (!PREFETCHER::Parse(value, arg == "-L1prefetch" ? l1Prefetch : l2Prefetch))
+                return Usage();
+        }
+        else if (arg == "-inclusion") {
+            inclusion.enabled = true;
+            if (!INCLUSION::Parse(value, inclusion.kind))
+                return Usage();
+        }
+        else if (arg == "-cfg_file") {
+            if (!ReadConfigFile(value, configNames)) {
+                cerr << "Error: could not open " << value << endl;
+                return 1;
+            }
+        }
+        else
+            return Usage();
+    }
+    if (!tracePath || numThreads == 0)
+        return Usage();
+    if (opt && inclusion.Kind() != INCLUSION::BUILD_DEFAULT) {
+        cerr << "Error: -opt only models the build's L2_INCLUSIVE" << endl;
+        return 1;
+    }
+
+    // Same models as cslab_cache
+    std::vector<CACHE_CONFIG> configs;
+    for (UINT32 i = 0; i < configNames.size(); i++) {
+        CACHE_CONFIG config;
+        if (!config.Parse(configNames[i])) {
+            cerr << "Error: invalid cache configuration " << configNames[i] << endl;
+            return 1;
+        }
+        configs.push_back(config);
+    }
+    const bool multiConfig = !configs.empty();
+    if (!multiConfig) {
+        if (!single.Valid()) {
+            cerr << "Error: invalid cache configuration " << single.Name() << endl;
+            return 1;
+        }
+        configs.push_back(single);
+    }
+    for (UINT32 i = 0; i < configs.size(); i++) {
+        configs[i].l1Prefetch = l1Prefetch;
+        configs[i].l2Prefetch = l2Prefetch;
+        configs[i].prefetchDegree = prefetchDegree;
+        configs[i].prefetchDistance = prefetchDistance;
+        configs[i].inclusion = inclusion;
+        if (configs[i].l3Size && opt) {
+            cerr << "Error: L3 configurations do not model -opt" << endl;
+            return 1;
+        }
+        if (inclusion.Kind() == INCLUSION::EXCLUSIVE &&
+            (configs[i].l1Block != configs[i].l2Block || configs[i].l3Size ||
+             configs[i].Prefetching())) {
+            cerr << "Error: an exclusive L2 needs the L1 block size, no L3 and no prefetchers" << endl;
+            return 1;
+        }
+        if (!configs[i].ValidReplacement(REPLACEMENT_OF<CACHE_SET_T>::KIND)) {
+            cerr << "Error: " << CACHE_SET_T().Name() << " does not support the associativities of "
+                 << configs[i].Name() << endl;
+            return 1;
+        }
+        models.push_back(NewCacheSim<CACHE_SET_T>(configs[i]));
+    }
+    for (UINT32 i = 0; i < sdistNames.size(); i++) {
+        STACK_DISTANCE_CONFIG config;
+        if (!config.Parse(sdistNames[i])) {
+            cerr << "Error: invalid stack distance geometry " << sdistNames[i] << endl;
+            return 1;
+        }
+        models.push_back(NewStackDistanceSim(config, sdistMaxAssoc));
+    }
+
+    // Map the trace
+    int fd = open(tracePath, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        cerr << "Error: could not open " << tracePath << endl;
+        return 1;
+    }
+    trace_size = st.st_size;
+    trace_data = mmap(NULL, trace_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (trace_data == MAP_FAILED) {
+        cerr << "Error: could not map " << tracePath << endl;
+        return 1;
+    }
+    madvise(const_cast<VOID *>(trace_data), trace_size, MADV_SEQUENTIAL);
+
+    TRACE_READER reader;
+    if (!reader.Init(trace_data, trace_size)) {
+        cerr << "Error: " << tracePath << " is not a cslab_cache trace" << endl;
+        return 1;
+    }
+    const TRACE_HEADER header = reader.Header();
+
+    // Optimal replacement needs the next uses of each block size first
+    std::map<UINT32, NEXT_USES *> nextUses;
+    if (opt) {
+        double start = Now();
+        for (UINT32 i = 0; i < configs.size(); i++) {
+            const UINT32 blockSizes[] = { configs[i].l1Block, configs[i].l2Block };
+            for (UINT32 j = 0; j < 2; j++) {
+                NEXT_USES *&uses = nextUses[blockSizes[j]];
+                if (uses)
+                    continue;
+                uses = new NEXT_USES();
+                if (!uses->Build(trace_data, trace_size, blockSizes[j], optChunk)) {
+                    cerr << "Error: could not write the next uses of " << tracePath << endl;
+                    return 1;
+                }
+            }
+            models.push_back(new CACHE_SIM(configs[i].OutputName(".opt"),
+                new OPT_CACHE("Two level cache hierarchy", configs[i],
+                              *nextUses[configs[i].l1Block], *nextUses[configs[i].l2Block])));
+        }
+        fprintf(stderr, "Computed next uses of %u block sizes in %.2f s\n",
+                (UINT32)nextUses.size(), Now() - start);
+    }
+
+    // Replay
+    double start = Now();
+    UINT32 shift;
+    // Prefetches cross sets, so prefetching configurations do not split,
+    // nor do policies with state shared by the sets
+    if (models.size() == 1 && numThreads > 1 && !configs[0].Prefetching() &&
+        CACHE_SET_T::SetsIndependent() && configs[0].SharedSetBits(shift) > 0) {
+        SHARDED_RUNNER runner(configs[0], numThreads);
+        VisitCacheType<CACHE_SET_T>(configs[0], runner);
+        delete models[0];
+        models[0] = runner.sim;
+    } else {
+        if (numThreads > models.size())
+            numThreads = models.size();
+        std::vector<REPLAY_THREAD> threads(numThreads);
+        for (UINT32 i = 0; i < numThreads; i++) {
+            threads[i].id = i;
+            threads[i].numThreads = numThreads;
+            pthread_create(&threads[i].thread, NULL, ReplayMain, &threads[i]);
+        }
+        for (UINT32 i = 0; i < numThreads; i++)
+            pthread_join(threads[i].thread, NULL);
+    }
+    double secs = Now() - start;
+
+    fprintf(stderr, "Replayed %llu references x %u models in %.2f s (%.1f Mrefs/s)\n",
+            (unsigned long long)header.numRefs, (UINT32)models.size(), secs,
+            header.numRefs * models.size() / secs / 1e6);
+
+    // Report, named like cslab_cache does
+    string prefix = outputFile;
+    if (prefix.size() > 4 && prefix.compare(prefix.size() - 4, 4, ".out") == 0)
+        prefix.erase(prefix.size() - 4);
+    const UINT32 numCacheModels = configs.size() + sdistNames.size();
+    for (UINT32 i = 0; i < models.size(); i++) {
+        if (i < configs.size()) {
+            std::ofstream out((multiConfig ? prefix + models[i]->output : outputFile).c_str());
+            Report(out, header.numInstructions, models[i]);
+        } else if (i >= numCacheModels) {
+            std::ofstream out((prefix + (multiConfig ? models[i]->output : ".opt.out")).c_str());
+            Report(out, header.numInstructions, models[i]);
+        } else {
+            std::ofstream out((prefix + models[i]->output).c_str());
+            out << "Total Instructions: " << header.numInstructions << "\n";
+            out << "\n";
+            out << models[i]->Report();
+        }
+        delete models[i];
+    }
+    for (std::map<UINT32, NEXT_USES *>::iterator it = nextUses.begin();
+         it != nextUses.end(); ++it)
+        delete it->second;
+
+    munmap(const_cast<VOID *>(trace_data), trace_size);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,549 @@
+#ifndef CACHE_SIM_H
+#define CACHE_SIM_H
+
+/**
+ * Glue between a memory reference stream and the TWO_LEVEL_CACHE models:
+ * cache configurations, picking the concrete cache type for a geometry,
+ * and type-erased simulation objects. Shared by the pintool and the
+ * Pin-free host programs; include after pin.H (or pin_compat.h).
+ **/
+
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+
+#include "cache.h"
+#include "cache_geometries.h"
+
+/**
+ * A memory reference of the simulated stream.
+ * MEMREF_ROI_END marks the end of the ROI; nothing after it is simulated.
+ **/
+enum {
+    MEMREF_LOAD = 0,
+    MEMREF_STORE,
+    MEMREF_ROI_END
+};
+struct MEMREF
+{
+    ADDRINT addr;
+    ADDRINT pc;
+    UINT32 size;
+    UINT32 type;
+};
+
+/**
+ * A CACHE_SET replacement policy picked at runtime (see
+ * VisitReplacementType), named in lower case (`lru`, `srrip`, ...).
+ * DEFAULT is the policy the tool passes to VisitReplacementType.
+ **/
+struct REPLACEMENT
+{
+#define REPLACEMENT_KIND(NAME) NAME,
+    typedef enum
+    {
+        DEFAULT = 0,
+        CACHE_SET_TABLE(REPLACEMENT_KIND)
+        KIND_NUM
+    } KIND;
+#undef REPLACEMENT_KIND
+
+    static string Name(KIND kind)
+    {
+        switch (kind) {
+#define REPLACEMENT_NAME(NAME) case NAME: return Lower(#NAME);
+            CACHE_SET_TABLE(REPLACEMENT_NAME)
+#undef REPLACEMENT_NAME
+            default: return "default";
+        }
+    }
+
+    // CACHE_SET::Supports(`associativity`) of `kind`
+    static bool Supports(KIND kind, UINT32 associativity)
+    {
+        switch (kind) {
+#define REPLACEMENT_SUPPORTS(NAME) \
+            case NAME: return CACHE_SET::NAME::Supports(associativity);
+            CACHE_SET_TABLE(REPLACEMENT_SUPPORTS)
+#undef REPLACEMENT_SUPPORTS
+            default: return false;
+        }
+    }
+
+    // An empty `name` is DEFAULT
+    static bool Parse(const string &name, KIND &kind)
+    {
+        kind = DEFAULT;
+        if (name.empty())
+            return true;
+        for (UINT32 k = DEFAULT + 1; k < KIND_NUM; k++)
+            if (name == Name(KIND(k))) {
+                kind = KIND(k);
+                return true;
+            }
+        return false;
+    }
+
+    private:
+    static string Lower(string name)
+    {
+        for (UINT32 i = 0; i < name.size(); i++)
+            name[i] = tolower(name[i]);
+        return name;
+    }
+};
+
+// The REPLACEMENT::KIND of a CACHE_SET policy
+template <class SET> struct REPLACEMENT_OF;
+#define REPLACEMENT_OF_SET(NAME)                                               \
+    template <> struct REPLACEMENT_OF<CACHE_SET::NAME>                         \
+    {                                                                          \
+        static const REPLACEMENT::KIND KIND = REPLACEMENT::NAME;               \
+    };
+CACHE_SET_TABLE(REPLACEMENT_OF_SET)
+#undef REPLACEMENT_OF_SET
+
+/**
+ * Geometry of a two level hierarchy, sizes in kilobytes. Written as
+ * `<L1 size>_<assoc>_<block size>:<L2 size>_<assoc>_<block size>`,
+ * the triples of run_l1.sh, e.g. `32_8_64:1024_8_128`, optionally
+ * followed by a third triple for an (inclusive) L3, which makes it a
+ * CACHE_HIERARCHY. The replacement policies, the prefetchers, the data
+ * TLBs, the write handling, the inclusion policy and the L1 instruction
+ * cache (only simulated live, by cslab_cache) are not part of the name;
+ * zero-initialized they are off (the policies are the defaults), as is
+ * the L3.
+ **/
+struct CACHE_CONFIG
+{
+    UINT32 l1Size, l1Assoc, l1Block;
+    UINT32 l2Size, l2Assoc, l2Block;
+    REPLACEMENT::KIND l1Replacement, l2Replacement; // see VisitReplacementType
+    PREFETCHER::KIND l1Prefetch, l2Prefetch;
+    UINT32 prefetchDegree, prefetchDistance;
+    UINT32 l3Size, l3Assoc, l3Block;
+    UINT32 l1iSize, l1iAssoc, l1iBlock;
+    TLB_CONFIG tlb;
+    WRITE_CONFIG writes;
+    INCLUSION inclusion;
+
+    bool Prefetching() const
+    {
+        return l1Prefetch != PREFETCHER::NONE || l2Prefetch != PREFETCHER::NONE;
+    }
+
+    // Whether a level replaces with another policy than `policy`, the default
+    bool OtherReplacement(REPLACEMENT::KIND policy) const
+    {
+        return (l1Replacement && l1Replacement != policy) ||
+               (l2Replacement && l2Replacement != policy);
+    }
+
+    /**
+     * Whether the replacement policy of each level, `policy` unless chosen
+     * otherwise, can have its associativity. L1I has the L1 policy, L3
+     * `policy`.
+     **/
+    bool ValidReplacement(REPLACEMENT::KIND policy) const
+    {
+        const REPLACEMENT::KIND l1Policy = l1Replacement ? l1Replacement : policy;
+        return REPLACEMENT::Supports(l1Policy, l1Assoc) &&
+               REPLACEMENT::Supports(l2Replacement ? l2Replacement : policy, l2Assoc) &&
+               (!l1iSize || REPLACEMENT::Supports(l1Policy, l1iAssoc)) &&
+               (!l3Size || REPLACEMENT::Supports(policy, l3Assoc));
+    }
+
+    bool Parse(const string &str)
+    {
+        l3Size = l3Assoc = l3Block = 0;
+        l1Replacement = l2Replacement = REPLACEMENT::DEFAULT;
+        l1iSize = l1iAssoc = l1iBlock = 0;
+        memset(&tlb, 0, sizeof(tlb));
+        memset(&writes, 0, sizeof(writes));
+        memset(&inclusion, 0, sizeof(inclusion));
+        const int n = sscanf(str.c_str(), "%u_%u_%u:%u_%u_%u:%u_%u_%u",
+                             &l1Size, &l1Assoc, &l1Block,
+                             &l2Size, &l2Assoc, &l2Block,
+                             &l3Size, &l3Assoc, &l3Block);
+        return (n == 6 || n == 9) && Valid();
+    }
+
+    bool Valid() const
+    {
+        if (!l1Assoc || !l1Block || !l2Assoc || !l2Block)
+            return false;
+        UINT32 l1Sets = l1Size * KILO / (l1Assoc * l1Block);
+        UINT32 l2Sets = l2Size * KILO / (l2Assoc * l2Block);
+        if (!(l1Sets && l2Sets &&
+              IsPowerOf2(l1Block) && IsPowerOf2(l2Block) &&
+              IsPowerOf2(l1Sets) && IsPowerOf2(l2Sets) &&
+              l1Size <= l2Size && l1Block <= l2Block))
+            return false;
+        if (l1iSize) {
+            if (!l1iAssoc || !l1iBlock)
+                return false;
+            UINT32 l1iSets = l1iSize * KILO / (l1iAssoc * l1iBlock);
+            if (!(l1iSets && IsPowerOf2(l1iBlock) && IsPowerOf2(l1iSets) &&
+                  l1iSize <= l2Size && l1iBlock <= l2Block))
+                return false;
+        }
+        if (!l3Size)
+            return true;
+        if (!l3Assoc || !l3Block)
+            return false;
+        UINT32 l3Sets = l3Size * KILO / (l3Assoc * l3Block);
+        return l3Sets && IsPowerOf2(l3Block) && IsPowerOf2(l3Sets) &&
+               l2Size <= l3Size && l2Block <= l3Block;
+    }
+
+    /**
+     * Address bits [shift, shift + returned bits) index both an L1 and an
+     * L2 set, so references that differ in them never touch the same set,
+     * not even through inclusion back-invalidations (which stay within one
+     * L2 block).
+     **/
+    UINT32 SharedSetBits(UINT32 &shift) const
+    {
+        const UINT32 l1Lo = FloorLog2(l1Block);
+        const UINT32 l1Hi = l1Lo + FloorLog2(l1Size * KILO / (l1Assoc * l1Block));
+        const UINT32 l2Lo = FloorLog2(l2Block);
+        const UINT32 l2Hi = l2Lo + FloorLog2(l2Size * KILO / (l2Assoc * l2Block));
+        shift = std::max(l1Lo, l2Lo);
+        UINT32 hi = std::min(l1Hi, l2Hi);
+        if (l3Size) {
+            const UINT32 l3Lo = FloorLog2(l3Block);
+            shift = std::max(shift, l3Lo);
+            hi = std::min(hi, l3Lo + FloorLog2(l3Size * KILO / (l3Assoc * l3Block)));
+        }
+        return hi > shift ? hi - shift : 0;
+    }
+
+    string Name() const
+    {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%u_%u_%u:%u_%u_%u",
+                 l1Size, l1Assoc, l1Block, l2Size, l2Assoc, l2Block);
+        string name = buf;
+        if (l3Size) {
+            snprintf(buf, sizeof(buf), ":%u_%u_%u", l3Size, l3Assoc, l3Block);
+            name += buf;
+        }
+        return name;
+    }
+
+    // Output file of this configuration, named like run_l1.sh does
+    string OutputName(const string &prefix) const
+    {
+        char buf[64];
+        snprintf(buf, sizeof(buf), ".L1_%04u_%02u_%03u.L2_%04u_%02u_%03u",
+                 l1Size, l1Assoc, l1Block, l2Size, l2Assoc, l2Block);
+        string name = prefix + buf;
+        if (l3Size) {
+            snprintf(buf, sizeof(buf), ".L3_%05u_%02u_%03u", l3Size, l3Assoc, l3Block);
+            name += buf;
+        }
+        return name + ".out";
+    }
+};
+
+/**
+ * Appends the configurations listed in `path`, one per line ('#' starts a
+ * comment), to `names`. Returns false if the file cannot be read.
+ **/
+static inline bool ReadConfigFile(const string &path, std::vector<string> &names)
+{
+    std::ifstream in(path.c_str());
+    if (!in)
+        return false;
+    string line;
+    while (std::getline(in, line)) {
+        std::istringstream words(line.substr(0, line.find('#')));
+        string name;
+        if (words >> name)
+            names.push_back(name);
+    }
+    return true;
+}
+
+// Sets up the parts of `config` that every hierarchy shares
+template <class LEVELS>
+VOID ConfigureCache(const CACHE_CONFIG &config, CACHE_HIERARCHY<LEVELS> *cache)
+{
+    if (config.Prefetching())
+        cache->SetPrefetchers(config.l1Prefetch, config.l2Prefetch,
+                              config.prefetchDegree, config.prefetchDistance);
+    if (config.l1iSize)
+        cache->SetInstructionCache(config.l1iSize * KILO, config.l1iBlock, config.l1iAssoc);
+    if (config.tlb.Enabled())
+        cache->SetTlb(config.tlb);
+    if (config.writes.enabled)
+        cache->SetWrites(config.writes);
+    if (config.inclusion.enabled)
+        cache->ReportInclusion();
+}
+
+template <class SET, class L1_GEOMETRY, class L2_GEOMETRY, class L2_POLICY>
+TWO_LEVEL_CACHE<SET, L1_GEOMETRY, L2_GEOMETRY, L2_POLICY> *NewCache(
+    const CACHE_CONFIG &config, TWO_LEVEL_CACHE<SET, L1_GEOMETRY, L2_GEOMETRY, L2_POLICY> *)
+{
+    TWO_LEVEL_CACHE<SET, L1_GEOMETRY, L2_GEOMETRY, L2_POLICY> *cache =
+        new TWO_LEVEL_CACHE<SET, L1_GEOMETRY, L2_GEOMETRY, L2_POLICY>("Two level cache hierarchy",
+            config.l1Size * KILO, config.l1Block, config.l1Assoc,
+            config.l2Size * KILO, config.l2Block, config.l2Assoc, config.inclusion.Kind());
+    ConfigureCache(config, cache);
+    return cache;
+}
+
+// Latency of an L3 hit; L1 and L2 keep those of TWO_LEVEL_CACHE
+static const UINT32 L3_HIT_LATENCY = 40;
+
+// An inclusive L3 below the L1 and L2 of `config`
+template <class LEVELS>
+CACHE_HIERARCHY<LEVELS> *NewCache(const CACHE_CONFIG &config, CACHE_HIERARCHY<LEVELS> *)
+{
+    std::vector<CACHE_LEVEL_CONFIG> levels(3);
+    const CACHE_LEVEL_CONFIG l1 = { config.l1Size * KILO, config.l1Block, config.l1Assoc, 1,
+                                    INCLUSION::NINE };
+    const CACHE_LEVEL_CONFIG l2 = { config.l2Size * KILO, config.l2Block, config.l2Assoc, 10,
+                                    config.inclusion.Kind() };
+    const CACHE_LEVEL_CONFIG l3 = { config.l3Size * KILO, config.l3Block, config.l3Assoc,
+                                    L3_HIT_LATENCY, INCLUSION::INCLUSIVE };
+    levels[0] = l1;
+    levels[1] = l2;
+    levels[2] = l3;
+    CACHE_HIERARCHY<LEVELS> *cache = new CACHE_HIERARCHY<LEVELS>("Three level cache hierarchy",
+                                                                 levels);
+    ConfigureCache(config, cache);
+    return cache;
+}
+
+// The cache of type CACHE (see VisitCacheType) that simulates `config`
+template <class CACHE>
+CACHE *NewCache(const CACHE_CONFIG &config)
+{
+    return NewCache(config, static_cast<CACHE *>(NULL));
+}
+
+/**
+ * Calls `visitor.Visit<CACHE>()` with the cache type that simulates
+ * `config`: a three level CACHE_HIERARCHY if it has an L3, otherwise a
+ * TWO_LEVEL_CACHE, compile-time specialized if its geometry is listed in
+ * cache_geometries.h, the runtime geometry version otherwise. Inclusion
+ * is a runtime setting of either.
+ **/
+template <class SET, class VISITOR>
+VOID VisitCacheType(const CACHE_CONFIG &config, VISITOR &visitor)
+{
+    if (config.l3Size) {
+        visitor.template Visit<CACHE_HIERARCHY<CACHE_LEVEL<SET,
+            CACHE_LEVEL<SET, CACHE_LEVEL<SET> > > > >();
+        return;
+    }
+
+#define SPECIALIZED_GEOMETRY(c1, a1, b1, c2, a2, b2)                          \
+    if (config.l1Size == c1 && config.l1Assoc == a1 && config.l1Block == b1 && \
+        config.l2Size == c2 && config.l2Assoc == a2 && config.l2Block == b2) { \
+        visitor.template Visit<TWO_LEVEL_CACHE<SET,                           \
+            CACHE_GEOMETRY::STATIC<b1, (c1 * KILO) / (a1 * b1), a1>,          \
+            CACHE_GEOMETRY::STATIC<b2, (c2 * KILO) / (a2 * b2), a2> > >();    \
+        return;                                                               \
+    }
+    CACHE_GEOMETRY_TABLE(SPECIALIZED_GEOMETRY)
+#undef SPECIALIZED_GEOMETRY
+
+    visitor.template Visit<TWO_LEVEL_CACHE<SET> >();
+}
+
+// Visits the runtime geometry TWO_LEVEL_CACHE of policies L1_SET and `l2`
+template <class L1_SET, class VISITOR>
+VOID VisitL2Replacement(REPLACEMENT::KIND l2, VISITOR &visitor)
+{
+    switch (l2) {
+#define L2_REPLACEMENT(NAME)                                                   \
+        case REPLACEMENT::NAME:                                                \
+            visitor.template Visit<TWO_LEVEL_CACHE<L1_SET,                     \
+                CACHE_GEOMETRY::DYNAMIC, CACHE_GEOMETRY::DYNAMIC,              \
+                CACHE_SET::NAME> >();                                          \
+            return;
+        CACHE_SET_TABLE(L2_REPLACEMENT)
+#undef L2_REPLACEMENT
+        default:
+            ASSERTX(false);
+    }
+}
+
+/**
+ * VisitCacheType, with the replacement policies of `config`. If they are
+ * not both SET, it visits the runtime geometry TWO_LEVEL_CACHE of the two
+ * policies, instantiated for every pair: like the geometry, the policies
+ * are bound once here, never looked at per access. Such configurations
+ * must have two levels (see CACHE_CONFIG::OtherReplacement). Only the
+ * tools that take policies use it, the others skip the instantiations.
+ **/
+template <class SET, class VISITOR>
+VOID VisitReplacementType(const CACHE_CONFIG &config, VISITOR &visitor)
+{
+    const REPLACEMENT::KIND policy = REPLACEMENT_OF<SET>::KIND;
+    if (!config.OtherReplacement(policy)) {
+        VisitCacheType<SET>(config, visitor);
+        return;
+    }
+    ASSERTX(!config.l3Size);
+
+    const REPLACEMENT::KIND l2 = config.l2Replacement ? config.l2Replacement : policy;
+    switch (config.l1Replacement ? config.l1Replacement : policy) {
+#define L1_REPLACEMENT(NAME)                                                   \
+        case REPLACEMENT::NAME:                                                \
+            VisitL2Replacement<CACHE_SET::NAME>(l2, visitor);                  \
+            return;
+        CACHE_SET_TABLE(L1_REPLACEMENT)
+#undef L1_REPLACEMENT
+        default:
+            ASSERTX(false);
+    }
+}
+
+/**
+ * The "DTLB Stats" of `cache`, MPKI over `instructions`: empty unless it
+ * is a hierarchy with TLBs.
+ **/
+template <class CACHE>
+string TlbStatsLong(const CACHE &, const string &, UINT64)
+{
+    return "";
+}
+
+template <class SET, class L1_GEOMETRY, class L2_GEOMETRY, class L2_POLICY>
+string TlbStatsLong(const TWO_LEVEL_CACHE<SET, L1_GEOMETRY, L2_GEOMETRY, L2_POLICY> &cache,
+                    const string &prefix, UINT64 instructions)
+{
+    return cache.Tlb().Enabled() ?
+        cache.Tlb().StatsLong(prefix, instructions, cache.WalkStatsLong(prefix)) : "";
+}
+
+template <class LEVELS>
+string TlbStatsLong(const CACHE_HIERARCHY<LEVELS> &cache, const string &prefix,
+                    UINT64 instructions)
+{
+    return cache.Tlb().Enabled() ?
+        cache.Tlb().StatsLong(prefix, instructions, cache.WalkStatsLong(prefix)) : "";
+}
+
+/**
+ * One simulated model: a cache of whatever concrete type (or anything with
+ * the same Access/PrintCache/StatsLong interface, such as STACK_DISTANCE),
+ * driven in batches of references through type-erased hooks (one indirect
+ * call per batch, none per access).
+ **/
+class CACHE_SIM
+{
+    private:
+    VOID *_cache;
+    UINT64 (*_simulate)(VOID *, const MEMREF *, UINT64);
+    string (*_report)(const VOID *, UINT64);
+    VOID (*_delete)(VOID *);
+
+    template <class CACHE>
+    static UINT64 SimulateImpl(VOID *ptr, const MEMREF *refs, UINT64 numRefs)
+    {
+        CACHE *cache = static_cast<CACHE *>(ptr);
+        UINT64 cycles = 0;
+        for (UINT64 i = 0; i < numRefs; i++)
+            cycles += cache->Access(refs[i].addr, refs[i].type == MEMREF_LOAD ?
+                                    CACHE::ACCESS_TYPE_LOAD : CACHE::ACCESS_TYPE_STORE,
+                                    refs[i].pc, refs[i].size);
+        return cycles;
+    }
+
+    template <class CACHE>
+    static string ReportImpl(const VOID *ptr, UINT64 instructions)
+    {
+        const CACHE *cache = static_cast<const CACHE *>(ptr);
+        return cache->PrintCache("") + cache->StatsLong("") +
+            TlbStatsLong(*cache, "", instructions);
+    }
+
+    template <class CACHE>
+    static VOID DeleteImpl(VOID *ptr) { delete static_cast<CACHE *>(ptr); }
+
+    CACHE_SIM(const CACHE_SIM &);            // not copyable
+    CACHE_SIM &operator=(const CACHE_SIM &);
+
+    public:
+    const string output; // suffix of its output file
+    UINT64 cycles;       // cycles spent in the memory hierarchy
+
+    template <class CACHE>
+    CACHE_SIM(const string &outputSuffix, CACHE *cache)
+        : _cache(cache),
+          _simulate(SimulateImpl<CACHE>),
+          _report(ReportImpl<CACHE>),
+          _delete(DeleteImpl<CACHE>),
+          output(outputSuffix),
+          cycles(0) {}
+
+    ~CACHE_SIM() { _delete(_cache); }
+
+    VOID Simulate(const MEMREF *refs, UINT64 numRefs)
+    {
+        cycles += _simulate(_cache, refs, numRefs);
+    }
+
+    // PrintCache + StatsLong of the simulated cache, MPKI over `instructions`
+    string Report(UINT64 instructions = 0) const { return _report(_cache, instructions); }
+};
+
+struct CACHE_SIM_FACTORY
+{
+    const CACHE_CONFIG &config;
+    CACHE_SIM *sim;
+
+    CACHE_SIM_FACTORY(const CACHE_CONFIG &cfg) : config(cfg), sim(NULL) {}
+
+    template <class CACHE>
+    VOID Visit()
+    {
+        sim = new CACHE_SIM(config.OutputName(""), NewCache<CACHE>(config));
+    }
+};
+
+template <class SET>
+CACHE_SIM *NewCacheSim(const CACHE_CONFIG &config)
+{
+    CACHE_SIM_FACTORY factory(config);
+    VisitCacheType<SET>(config, factory);
+    return factory.sim;
+}
+
+/**
+ * Stack distance analysis of `blockSize` byte blocks in `numSets` sets,
+ * written as `<block size>_<sets>`, e.g. `64_64`.
+ **/
+struct STACK_DISTANCE_CONFIG
+{
+    UINT32 blockSize, numSets;
+
+    bool Parse(const string &str)
+    {
+        return sscanf(str.c_str(), "%u_%u", &blockSize, &numSets) == 2 &&
+               blockSize && numSets &&
+               IsPowerOf2(blockSize) && IsPowerOf2(numSets);
+    }
+
+    string OutputName(const string &prefix) const
+    {
+        char buf[64];
+        snprintf(buf, sizeof(buf), ".sdist.B_%03u.S_%05u.out", blockSize, numSets);
+        return prefix + buf;
+    }
+};
+
+static inline CACHE_SIM *NewStackDistanceSim(const STACK_DISTANCE_CONFIG &config,
+                                             UINT32 maxAssoc)
+{
+    return new CACHE_SIM(config.OutputName(""),
+                         new STACK_DISTANCE("LRU stack distance analysis",
+                                            config.blockSize, config.numSets, maxAssoc));
+}
+
+#endif // CACHE_SIM_H
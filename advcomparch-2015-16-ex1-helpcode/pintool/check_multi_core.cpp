@@ -0,0 +1,149 @@
+/**
+ * Consistency check of MULTI_CORE_CACHE.
+ *
+ * With one core, it drives MULTI_CORE_CACHE and TWO_LEVEL_CACHE with the
+ * same random load/store stream and requires the same cycles on every
+ * access and the same miss counts. With 4 and 8 cores, one thread per core
+ * hammers a small shared region and a private region of its own; the
+ * threads stop at a barrier every round, and MULTI_CORE_CACHE::Violation()
+ * must then find every valid L1 line in the L2 with its directory bit, and
+ * every block held by more than one L1 in S. Exits non zero on the first
+ * mismatch.
+ *
+ *   $ make check_multi_core && ./check_multi_core
+ **/
+#include "pin_compat.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <pthread.h>
+
+#include "cache.h"
+#include "host_check.h"
+
+typedef MULTI_CORE_CACHE<CACHE_SET::LRU> MULTI_CORE;
+typedef TWO_LEVEL_CACHE<CACHE_SET::LRU> TWO_LEVEL;
+
+static const UINT32 SINGLE_ACCESSES = 1 << 21;
+static const UINT32 ROUNDS = 64;
+static const UINT32 ROUND_ACCESSES = 1 << 14;   // per core
+
+// Access `i` of a stream: mostly within a 16 KB window that moves by 4 KB
+// every 4096 accesses over 1 MB, with some far misses
+static ADDRINT NextAddr(UINT64 &state, ADDRINT base, UINT32 i)
+{
+    const UINT64 r = Rand64(state);
+    if (r % 8 == 0)
+        return base + (r >> 8) % (1 << 20);
+    const ADDRINT window = ((ADDRINT)(i >> 12) << 12) % (1 << 20);
+    return base + window + (r >> 8) % (16 * KILO);
+}
+
+static bool CheckSingleCore()
+{
+    MULTI_CORE multi("multi", 1, L1_SIZE, L1_BLOCK, L1_ASSOC, L2_SIZE, L2_BLOCK, L2_ASSOC);
+    TWO_LEVEL two("two", L1_SIZE, L1_BLOCK, L1_ASSOC, L2_SIZE, L2_BLOCK, L2_ASSOC);
+
+    UINT64 state = 0x9e3779b97f4a7c15ULL;
+    for (UINT32 i = 0; i < SINGLE_ACCESSES; i++) {
+        const ADDRINT addr = NextAddr(state, 0x10000000, i);
+        const bool store = Rand64(state) % 4 == 0;
+        const UINT32 multiCycles = multi.Access(0, addr, store ? MULTI_CORE::ACCESS_TYPE_STORE
+                                                               : MULTI_CORE::ACCESS_TYPE_LOAD);
+        const UINT32 twoCycles = two.Access(addr, store ? TWO_LEVEL::ACCESS_TYPE_STORE
+                                                        : TWO_LEVEL::ACCESS_TYPE_LOAD);
+        if (multiCycles != twoCycles) {
+            printf("FAIL 1 core: access %u to %s took %u cycles, TWO_LEVEL_CACHE %u\n",
+                   i, hexstr(addr).c_str(), multiCycles, twoCycles);
+            return false;
+        }
+    }
+    if (multi.L1Misses() != two.L1Misses() || multi.L2Misses() != two.L2Misses()) {
+        printf("FAIL 1 core: misses L1 %llu L2 %llu, TWO_LEVEL_CACHE L1 %llu L2 %llu\n",
+               (unsigned long long)multi.L1Misses(), (unsigned long long)multi.L2Misses(),
+               (unsigned long long)two.L1Misses(), (unsigned long long)two.L2Misses());
+        return false;
+    }
+    const string violation = multi.Violation();
+    if (!violation.empty()) {
+        printf("FAIL 1 core: %s\n", violation.c_str());
+        return false;
+    }
+    printf("ok   1 core: %u accesses match TWO_LEVEL_CACHE\n", SINGLE_ACCESSES);
+    return true;
+}
+
+struct CORE
+{
+    MULTI_CORE *cache;
+    pthread_barrier_t *barrier;
+    UINT32 core;
+};
+
+static VOID *RunCore(VOID *arg)
+{
+    const CORE &c = *static_cast<CORE *>(arg);
+    UINT64 state = 0x2545f4914f6cdd1dULL * (c.core + 1);
+    // A shared region every core touches, and a private one
+    const ADDRINT shared = 0x20000000;
+    const ADDRINT own = 0x40000000 + (ADDRINT)c.core * 0x1000000;
+
+    for (UINT32 r = 0; r < ROUNDS; r++) {
+        for (UINT32 i = 0; i < ROUND_ACCESSES; i++) {
+            const UINT64 pick = Rand64(state);
+            const ADDRINT addr = pick % 2 ? shared + (pick >> 8) % (8 * KILO)
+                                          : NextAddr(state, own, r * ROUND_ACCESSES + i);
+            const bool store = (pick >> 4) % 4 == 0;
+            c.cache->Access(c.core, addr, store ? MULTI_CORE::ACCESS_TYPE_STORE
+                                                : MULTI_CORE::ACCESS_TYPE_LOAD);
+        }
+        // The main thread checks between the two barriers
+        pthread_barrier_wait(c.barrier);
+        pthread_barrier_wait(c.barrier);
+    }
+    return NULL;
+}
+
+static bool CheckCores(UINT32 numCores)
+{
+    MULTI_CORE cache("multi", numCores, L1_SIZE, L1_BLOCK, L1_ASSOC, L2_SIZE, L2_BLOCK, L2_ASSOC);
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, numCores + 1);
+
+    std::vector<CORE> cores(numCores);
+    std::vector<pthread_t> threads(numCores);
+    for (UINT32 c = 0; c < numCores; c++) {
+        cores[c].cache = &cache;
+        cores[c].barrier = &barrier;
+        cores[c].core = c;
+        pthread_create(&threads[c], NULL, RunCore, &cores[c]);
+    }
+
+    string violation;
+    for (UINT32 r = 0; r < ROUNDS; r++) {
+        pthread_barrier_wait(&barrier);
+        if (violation.empty())
+            violation = cache.Violation();
+        pthread_barrier_wait(&barrier);
+    }
+    for (UINT32 c = 0; c < numCores; c++)
+        pthread_join(threads[c], NULL);
+    pthread_barrier_destroy(&barrier);
+
+    if (!violation.empty()) {
+        printf("FAIL %u cores: %s\n", numCores, violation.c_str());
+        return false;
+    }
+    printf("ok   %u cores: %u rounds of %u accesses per core, L1 misses %llu L2 misses %llu\n",
+           numCores, ROUNDS, ROUND_ACCESSES,
+           (unsigned long long)cache.L1Misses(), (unsigned long long)cache.L2Misses());
+    return true;
+}
+
+int main()
+{
+    bool ok = CheckSingleCore();
+    ok = CheckCores(4) && ok;
+    ok = CheckCores(8) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,650 @@
+/**
+ * Reference check of the cache.h replacement policies.
+ *
+ * Every policy is paired with a naive model of it: plain per-set vectors
+ * of tags and per-way state, updated the way the policy's description
+ * says, with none of the packing of cache.h. Both get the same random
+ * stream of accesses (Find, then Replace on a miss, as TWO_LEVEL_CACHE
+ * does) and deletes over a few sets, from PCs that either reuse a small
+ * pool of tags or stream through a large one; every hit/miss and every
+ * victim must agree. Each policy is run at every associativity from 1 to
+ * 64 that it supports (200 for LFU and LRFU, over fewer sets so that they
+ * age often), with the associativity known at runtime, and at 8 ways fixed
+ * at compile time. Exits non zero on the first mismatch.
+ *
+ *   $ make check_replacement && ./check_replacement
+ **/
+#include "pin_compat.h"
+
+#include <cstdio>
+#include <list>
+#include <map>
+#include <vector>
+
+#include "cache.h"
+#include "host_check.h"
+
+static const UINT32 NUM_SETS = 64;
+static const UINT32 NUM_OPS = 100000;
+static const UINT32 NUM_PCS = 16;
+static const UINT32 MAX_ASSOC = 64;
+static const UINT32 FREQUENCY_SETS = 4;
+static const UINT32 FREQUENCY_MAX_ASSOC = 200;
+
+/**
+ * The tags of every set, empty ways holding INVALID_TAG, and the PC of the
+ * next access. Models fill the first empty way before evicting.
+ **/
+struct REFERENCE
+{
+    UINT32 ways;
+    std::vector<std::vector<CACHE_TAG> > tags;
+    ADDRINT pc;
+
+    REFERENCE(UINT32 numSets, UINT32 associativity)
+        : ways(associativity),
+          tags(numSets, std::vector<CACHE_TAG>(associativity, INVALID_TAG)), pc(0) {}
+
+    INT32 Way(UINT32 set, CACHE_TAG tag) const
+    {
+        for (UINT32 w = 0; w < ways; w++)
+            if (tags[set][w] == tag)
+                return w;
+        return -1;
+    }
+
+    INT32 Empty(UINT32 set) const { return Way(set, INVALID_TAG); }
+
+    VOID SetPc(ADDRINT p) { pc = p; }
+
+    // Puts `tag` in `way`, returning the tag it evicts
+    CACHE_TAG Fill(UINT32 set, UINT32 way, CACHE_TAG tag)
+    {
+        const CACHE_TAG victim = tags[set][way];
+        tags[set][way] = tag;
+        return victim;
+    }
+};
+
+/**
+ * Tree PLRU as a binary tree over the ways: each node halves its range of
+ * ways and points at the half the next victim comes from.
+ **/
+struct PLRU_REFERENCE : REFERENCE
+{
+    std::vector<std::vector<bool> > right; // per set, per node (root 1)
+
+    PLRU_REFERENCE(UINT32 numSets, UINT32 associativity)
+        : REFERENCE(numSets, associativity),
+          right(numSets, std::vector<bool>(2 * associativity, false)) {}
+
+    // Points the nodes above `way` away from it, or at it
+    VOID Point(UINT32 set, UINT32 way, bool away)
+    {
+        UINT32 node = 1, lo = 0, hi = ways;
+        while (hi - lo > 1) {
+            const UINT32 mid = (lo + hi) / 2;
+            const bool inRight = way >= mid;
+            right[set][node] = away ? !inRight : inRight;
+            node = 2 * node + inRight;
+            (inRight ? lo : hi) = mid;
+        }
+    }
+
+    UINT32 Victim(UINT32 set) const
+    {
+        UINT32 node = 1, lo = 0, hi = ways;
+        while (hi - lo > 1) {
+            const UINT32 mid = (lo + hi) / 2;
+            const bool toRight = right[set][node];
+            node = 2 * node + toRight;
+            (toRight ? lo : hi) = mid;
+        }
+        return lo;
+    }
+
+    bool Find(UINT32 set, CACHE_TAG tag)
+    {
+        const INT32 way = Way(set, tag);
+        if (way >= 0)
+            Point(set, way, true);
+        return way >= 0;
+    }
+
+    CACHE_TAG Replace(UINT32 set, CACHE_TAG tag)
+    {
+        INT32 way = Empty(set);
+        if (way < 0)
+            way = Victim(set);
+        Point(set, way, true);
+        return Fill(set, way, tag);
+    }
+
+    VOID Delete(UINT32 set, CACHE_TAG tag)
+    {
+        const INT32 way = Way(set, tag);
+        if (way < 0)
+            return;
+        tags[set][way] = INVALID_TAG;
+        Point(set, way, false);
+    }
+};
+
+/**
+ * NRU: a reference bit per way. When every bit would be set, only the
+ * accessed way's stays set; the victim is the first way whose bit is clear.
+ **/
+struct NRU_REFERENCE : REFERENCE
+{
+    std::vector<std::vector<bool> > referenced;
+
+    NRU_REFERENCE(UINT32 numSets, UINT32 associativity)
+        : REFERENCE(numSets, associativity),
+          referenced(numSets, std::vector<bool>(associativity, false)) {}
+
+    VOID Touch(UINT32 set, UINT32 way)
+    {
+        std::vector<bool> &bits = referenced[set];
+        bits[way] = true;
+        for (UINT32 w = 0; w < ways; w++)
+            if (!bits[w])
+                return;
+        bits.assign(ways, false);
+        bits[way] = true;
+    }
+
+    bool Find(UINT32 set, CACHE_TAG tag)
+    {
+        const INT32 way = Way(set, tag);
+        if (way >= 0)
+            Touch(set, way);
+        return way >= 0;
+    }
+
+    CACHE_TAG Replace(UINT32 set, CACHE_TAG tag)
+    {
+        INT32 way = Empty(set);
+        for (UINT32 w = 0; way < 0 && w < ways; w++)
+            if (!referenced[set][w])
+                way = w;
+        if (way < 0)
+            way = 0;   // a single way, always referenced
+        Touch(set, way);
+        return Fill(set, way, tag);
+    }
+
+    VOID Delete(UINT32 set, CACHE_TAG tag)
+    {
+        const INT32 way = Way(set, tag);
+        if (way < 0)
+            return;
+        tags[set][way] = INVALID_TAG;
+        referenced[set][way] = false;
+    }
+};
+
+/**
+ * SRRIP, BRRIP and DRRIP with one RRPV per way, aged one step at a time.
+ * DRRIP has an SRRIP leader at offset 0 and a BRRIP leader at half of
+ * every region of max(sets / 32, 4) sets.
+ **/
+struct RRIP_REFERENCE : REFERENCE
+{
+    CACHE_SET::RRIP_INSERTION insertion;
+    std::vector<std::vector<UINT32> > rrpv;
+    UINT32 bimodal, psel, region;
+
+    RRIP_REFERENCE(UINT32 numSets, UINT32 associativity,
+                   CACHE_SET::RRIP_INSERTION kind = CACHE_SET::RRIP_SRRIP)
+        : REFERENCE(numSets, associativity), insertion(kind),
+          rrpv(numSets, std::vector<UINT32>(associativity, 3)),
+          bimodal(0), psel(512), region(std::max(numSets / 32, 4u)) {}
+
+    UINT32 Bimodal()
+    {
+        if (++bimodal < 32)
+            return 3;
+        bimodal = 0;
+        return 2;
+    }
+
+    UINT32 Insertion(UINT32 set)
+    {
+        if (insertion == CACHE_SET::RRIP_SRRIP)
+            return 2;
+        if (insertion == CACHE_SET::RRIP_BRRIP)
+            return Bimodal();
+        if (set % region == 0) {
+            psel = std::min(psel + 1, 1023u);
+            return 2;
+        }
+        if (set % region == region / 2) {
+            psel = psel ? psel - 1 : 0;
+            return Bimodal();
+        }
+        return psel > 511 ? Bimodal() : 2;
+    }
+
+    UINT32 Victim(UINT32 set)
+    {
+        for (;;) {
+            for (UINT32 w = 0; w < ways; w++)
+                if (rrpv[set][w] == 3)
+                    return w;
+            for (UINT32 w = 0; w < ways; w++)
+                rrpv[set][w]++;
+        }
+    }
+
+    bool Find(UINT32 set, CACHE_TAG tag)
+    {
+        const INT32 way = Way(set, tag);
+        if (way >= 0)
+            rrpv[set][way] = 0;
+        return way >= 0;
+    }
+
+    CACHE_TAG Replace(UINT32 set, CACHE_TAG tag)
+    {
+        const UINT32 value = Insertion(set);
+        INT32 way = Empty(set);
+        if (way < 0)
+            way = Victim(set);
+        rrpv[set][way] = value;
+        return Fill(set, way, tag);
+    }
+
+    VOID Delete(UINT32 set, CACHE_TAG tag)
+    {
+        const INT32 way = Way(set, tag);
+        if (way < 0)
+            return;
+        tags[set][way] = INVALID_TAG;
+        rrpv[set][way] = 3;
+    }
+};
+
+struct BRRIP_REFERENCE : RRIP_REFERENCE
+{
+    BRRIP_REFERENCE(UINT32 numSets, UINT32 associativity)
+        : RRIP_REFERENCE(numSets, associativity, CACHE_SET::RRIP_BRRIP) {}
+};
+
+struct DRRIP_REFERENCE : RRIP_REFERENCE
+{
+    DRRIP_REFERENCE(UINT32 numSets, UINT32 associativity)
+        : RRIP_REFERENCE(numSets, associativity, CACHE_SET::RRIP_DRRIP) {}
+};
+
+/**
+ * SHiP on SRRIP: a saturating counter (0 to 7, from 1) per 14-bit PC
+ * signature, up on hits to a line filled by it, down when such a line is
+ * evicted without a hit; lines of a signature at 0 are filled distant.
+ **/
+struct SHIP_REFERENCE : RRIP_REFERENCE
+{
+    std::vector<UINT32> shct;
+    std::vector<std::vector<UINT32> > signature;
+    std::vector<std::vector<bool> > reused;
+
+    SHIP_REFERENCE(UINT32 numSets, UINT32 associativity)
+        : RRIP_REFERENCE(numSets, associativity), shct(1 << 14, 1),
+          signature(numSets, std::vector<UINT32>(associativity, 0)),
+          reused(numSets, std::vector<bool>(associativity, false)) {}
+
+    bool Find(UINT32 set, CACHE_TAG tag)
+    {
+        const INT32 way = Way(set, tag);
+        if (way < 0)
+            return false;
+        UINT32 &counter = shct[signature[set][way]];
+        counter = std::min(counter + 1, 7u);
+        reused[set][way] = true;
+        rrpv[set][way] = 0;
+        return true;
+    }
+
+    CACHE_TAG Replace(UINT32 set, CACHE_TAG tag)
+    {
+        INT32 way = Empty(set);
+        if (way < 0) {
+            way = Victim(set);
+            UINT32 &counter = shct[signature[set][way]];
+            if (!reused[set][way] && counter > 0)
+                counter--;
+        }
+        const UINT32 sig = CACHE_SET::PcSignature(pc, 14);
+        signature[set][way] = sig;
+        reused[set][way] = false;
+        rrpv[set][way] = shct[sig] == 0 ? 3 : 2;
+        return Fill(set, way, tag);
+    }
+
+    VOID Delete(UINT32 set, CACHE_TAG tag)
+    {
+        const INT32 way = Way(set, tag);
+        if (way < 0)
+            return;
+        tags[set][way] = INVALID_TAG;
+        signature[set][way] = 0;
+        reused[set][way] = false;
+        rrpv[set][way] = 3;
+    }
+};
+
+/**
+ * Hawkeye. OPTgen keeps, per sampled set, the last access time and PC
+ * signature of up to 8 x associativity tags (dropping the oldest, a MIN
+ * miss) and the occupancy at every recent time; a reuse within that many
+ * accesses is a MIN hit iff no occupancy in between has reached the
+ * associativity. Lines have 3-bit RRPVs set by the 13-bit PC predictor.
+ **/
+struct HAWKEYE_REFERENCE : REFERENCE
+{
+    struct SAMPLE
+    {
+        UINT32 time, signature;
+    };
+    struct SAMPLED_SET
+    {
+        UINT32 clock;
+        std::map<CACHE_TAG, SAMPLE> samples;
+        std::map<UINT32, UINT32> occupancy;   // by time
+        SAMPLED_SET() : clock(0) {}
+    };
+
+    std::vector<std::vector<UINT32> > rrpv, signature;
+    std::vector<UINT32> predictor;
+    UINT32 stride, history;
+    std::vector<SAMPLED_SET> sampled;
+
+    HAWKEYE_REFERENCE(UINT32 numSets, UINT32 associativity)
+        : REFERENCE(numSets, associativity),
+          rrpv(numSets, std::vector<UINT32>(associativity, 7)),
+          signature(numSets, std::vector<UINT32>(associativity, 0)),
+          predictor(1 << 13, 4), stride(std::max(numSets / 64, 1u)),
+          history(8 * associativity), sampled((numSets + stride - 1) / stride) {}
+
+    bool Friendly(UINT32 sig) const { return predictor[sig] > 3; }
+
+    VOID Train(UINT32 sig, bool hit)
+    {
+        UINT32 &counter = predictor[sig];
+        if (hit)
+            counter = std::min(counter + 1, 7u);
+        else if (counter > 0)
+            counter--;
+    }
+
+    VOID OptGen(SAMPLED_SET &s, CACHE_TAG tag, UINT32 sig)
+    {
+        const UINT32 now = s.clock++;
+        s.occupancy[now] = 0;
+        s.occupancy.erase(now - history);
+
+        if (s.samples.count(tag)) {
+            const UINT32 then = s.samples[tag].time;
+            bool hit = now - then < history;
+            for (UINT32 t = then; hit && t != now; t++)
+                hit = s.occupancy[t] < ways;
+            for (UINT32 t = then; hit && t != now; t++)
+                s.occupancy[t]++;
+            Train(s.samples[tag].signature, hit);
+        } else if (s.samples.size() == history) {
+            std::map<CACHE_TAG, SAMPLE>::iterator oldest = s.samples.begin();
+            for (std::map<CACHE_TAG, SAMPLE>::iterator i = s.samples.begin(); i != s.samples.end(); ++i)
+                if (i->second.time < oldest->second.time)
+                    oldest = i;
+            Train(oldest->second.signature, false);
+            s.samples.erase(oldest);
+        }
+        s.samples[tag].time = now;
+        s.samples[tag].signature = sig;
+    }
+
+    bool Find(UINT32 set, CACHE_TAG tag)
+    {
+        const UINT32 sig = CACHE_SET::PcSignature(pc, 13);
+        if (set % stride == 0)
+            OptGen(sampled[set / stride], tag, sig);
+        const INT32 way = Way(set, tag);
+        if (way < 0)
+            return false;
+        rrpv[set][way] = Friendly(sig) ? 0 : 7;
+        signature[set][way] = sig;
+        return true;
+    }
+
+    UINT32 Victim(UINT32 set)
+    {
+        UINT32 victim = 0;
+        for (UINT32 w = 0; w < ways; w++) {
+            if (rrpv[set][w] == 7)
+                return w;
+            if (rrpv[set][w] > rrpv[set][victim])
+                victim = w;
+        }
+        Train(signature[set][victim], false);
+        return victim;
+    }
+
+    CACHE_TAG Replace(UINT32 set, CACHE_TAG tag)
+    {
+        INT32 way = Empty(set);
+        if (way < 0)
+            way = Victim(set);
+        const UINT32 sig = CACHE_SET::PcSignature(pc, 13);
+        if (Friendly(sig)) {
+            bool saturated = false;
+            for (UINT32 w = 0; w < ways; w++)
+                saturated = saturated || rrpv[set][w] == 6;
+            for (UINT32 w = 0; w < ways && !saturated; w++)
+                if (rrpv[set][w] < 6)
+                    rrpv[set][w]++;
+        }
+        rrpv[set][way] = Friendly(sig) ? 0 : 7;
+        signature[set][way] = sig;
+        return Fill(set, way, tag);
+    }
+
+    VOID Delete(UINT32 set, CACHE_TAG tag)
+    {
+        const INT32 way = Way(set, tag);
+        if (way < 0)
+            return;
+        tags[set][way] = INVALID_TAG;
+        rrpv[set][way] = 7;
+    }
+};
+
+/**
+ * LFU and LRFU as one list of ways per set, ordered by access count and,
+ * for equal counts, from the least to the most recently moved. A hit or
+ * a fill (count 1) moves the way behind the others of its new count, a
+ * delete (count 0) to the front, and the victim is the front way. Every
+ * 16 (LFU) or 1 (LRFU) accesses per way halve the counts in place,
+ * keeping valid lines at least at 1.
+ **/
+struct FREQUENCY_REFERENCE : REFERENCE
+{
+    struct ENTRY
+    {
+        UINT32 way, count;
+    };
+    typedef std::list<ENTRY> ORDER;
+
+    UINT32 aging;
+    std::vector<ORDER> order;
+    std::vector<UINT32> accesses;
+
+    FREQUENCY_REFERENCE(UINT32 numSets, UINT32 associativity, UINT32 agingPerWay)
+        : REFERENCE(numSets, associativity), aging(agingPerWay * associativity),
+          order(numSets), accesses(numSets, 0)
+    {
+        for (UINT32 s = 0; s < numSets; s++)
+            for (UINT32 w = 0; w < associativity; w++) {
+                ENTRY empty = { w, 0 };
+                order[s].push_back(empty);
+            }
+    }
+
+    VOID Move(UINT32 set, UINT32 way, UINT32 count)
+    {
+        ORDER &o = order[set];
+        for (ORDER::iterator i = o.begin(); i != o.end(); ++i)
+            if (i->way == way) {
+                o.erase(i);
+                break;
+            }
+        ORDER::iterator at = o.begin();
+        while (at != o.end() && at->count <= count)
+            ++at;
+        ENTRY entry = { way, count };
+        o.insert(at, entry);
+    }
+
+    VOID Accessed(UINT32 set)
+    {
+        if (++accesses[set] < aging)
+            return;
+        accesses[set] = 0;
+        for (ORDER::iterator i = order[set].begin(); i != order[set].end(); ++i)
+            if (i->count)
+                i->count = std::max(i->count / 2, 1u);
+    }
+
+    UINT32 Count(UINT32 set, UINT32 way) const
+    {
+        for (ORDER::const_iterator i = order[set].begin(); i != order[set].end(); ++i)
+            if (i->way == way)
+                return i->count;
+        return 0;
+    }
+
+    bool Find(UINT32 set, CACHE_TAG tag)
+    {
+        const INT32 way = Way(set, tag);
+        if (way < 0)
+            return false;
+        Move(set, way, std::min(Count(set, way) + 1, 0xffffu));
+        Accessed(set);
+        return true;
+    }
+
+    CACHE_TAG Replace(UINT32 set, CACHE_TAG tag)
+    {
+        const UINT32 way = order[set].front().way;
+        Move(set, way, 1);
+        Accessed(set);
+        return Fill(set, way, tag);
+    }
+
+    VOID Delete(UINT32 set, CACHE_TAG tag)
+    {
+        const INT32 way = Way(set, tag);
+        if (way < 0)
+            return;
+        tags[set][way] = INVALID_TAG;
+        ORDER &o = order[set];
+        for (ORDER::iterator i = o.begin(); i != o.end(); ++i)
+            if (i->way == (UINT32)way) {
+                o.erase(i);
+                break;
+            }
+        ENTRY empty = { (UINT32)way, 0 };
+        o.push_front(empty);
+    }
+};
+
+struct LFU_REFERENCE : FREQUENCY_REFERENCE
+{
+    LFU_REFERENCE(UINT32 numSets, UINT32 associativity)
+        : FREQUENCY_REFERENCE(numSets, associativity, 16) {}
+};
+
+struct LRFU_REFERENCE : FREQUENCY_REFERENCE
+{
+    LRFU_REFERENCE(UINT32 numSets, UINT32 associativity)
+        : FREQUENCY_REFERENCE(numSets, associativity, 1) {}
+};
+
+template <class POLICY, class MODEL>
+static bool Check(UINT32 associativity, UINT32 numSets)
+{
+    POLICY policy;
+    policy.Init(numSets, associativity);
+    MODEL model(numSets, associativity);
+
+    UINT64 state = 0x9e3779b97f4a7c15ULL + associativity;
+    for (UINT32 op = 0; op < NUM_OPS; op++) {
+        const UINT32 set = Rand64(state) % numSets;
+        // The first half of the PCs reuse a few tags, the rest stream
+        const UINT32 pcIndex = Rand64(state) % NUM_PCS;
+        const ADDRINT pc = 0x400000 + 4 * pcIndex;
+        const CACHE_TAG tag = pcIndex < NUM_PCS / 2 ?
+            CACHE_TAG(Rand64(state) % (associativity + associativity / 2 + 1)) :
+            CACHE_TAG(1000 + Rand64(state) % (16 * associativity + 16));
+
+        policy.SetPc(pc);
+        model.SetPc(pc);
+        if (Rand64(state) % 16 == 0) {
+            policy.DeleteIfPresent(set, tag);
+            model.Delete(set, tag);
+            continue;
+        }
+
+        const bool hit = policy.Find(set, tag);
+        if (hit != model.Find(set, tag)) {
+            printf("FAIL %s %u ways: op %u, tag %u of set %u: %s, the model disagrees\n",
+                   policy.Name().c_str(), associativity, op, (UINT32)tag, set,
+                   hit ? "hit" : "miss");
+            return false;
+        }
+        if (hit)
+            continue;
+        const CACHE_TAG victim = policy.Replace(set, tag);
+        const CACHE_TAG expected = model.Replace(set, tag);
+        if (!(victim == expected)) {
+            printf("FAIL %s %u ways: op %u, set %u evicted %d, the model %d\n",
+                   policy.Name().c_str(), associativity, op, set,
+                   (int)(ADDRINT)victim, (int)(ADDRINT)expected);
+            return false;
+        }
+    }
+    return true;
+}
+
+template <template <UINT32> class POLICY, class MODEL>
+static bool CheckPolicy(UINT32 maxAssociativity = MAX_ASSOC, UINT32 numSets = NUM_SETS)
+{
+    UINT32 checked = 0;
+    for (UINT32 associativity = 1; associativity <= maxAssociativity; associativity++) {
+        if (!POLICY<0>::Supports(associativity))
+            continue;
+        if (!Check<POLICY<0>, MODEL>(associativity, numSets))
+            return false;
+        checked++;
+    }
+    if (!Check<POLICY<8>, MODEL>(8, numSets))
+        return false;
+
+    POLICY<0> policy;
+    printf("ok   %-7s %3u associativities x %u operations\n",
+           policy.Name().c_str(), checked, NUM_OPS);
+    return true;
+}
+
+int main()
+{
+    bool ok = true;
+    ok = CheckPolicy<CACHE_SET::PLRU_T, PLRU_REFERENCE>() && ok;
+    ok = CheckPolicy<CACHE_SET::NRU_T, NRU_REFERENCE>() && ok;
+    ok = CheckPolicy<CACHE_SET::SRRIP_T, RRIP_REFERENCE>() && ok;
+    ok = CheckPolicy<CACHE_SET::BRRIP_T, BRRIP_REFERENCE>() && ok;
+    ok = CheckPolicy<CACHE_SET::DRRIP_T, DRRIP_REFERENCE>() && ok;
+    ok = CheckPolicy<CACHE_SET::SHIP_T, SHIP_REFERENCE>() && ok;
+    ok = CheckPolicy<CACHE_SET::HAWKEYE_T, HAWKEYE_REFERENCE>() && ok;
+    ok = CheckPolicy<CACHE_SET::LFU_T, LFU_REFERENCE>(FREQUENCY_MAX_ASSOC, FREQUENCY_SETS) && ok;
+    ok = CheckPolicy<CACHE_SET::LRFU_T, LRFU_REFERENCE>(FREQUENCY_MAX_ASSOC, FREQUENCY_SETS) && ok;
+    return ok ? 0 : 1;
+}
@@ -3,10 +3,17 @@
 #include <iostream>
 #include <fstream>
 #include <cassert>
+#include <cstddef>  // offsetof
+#include <cmath>
 
 #define INSTRUCTIONS 10000000
 #define STORE_ALLOCATION STORE_ALLOCATE
 #include "cache.h"
+#include "cache_sim.h"
+#include "mlp.h"
+#include "pc_profile.h"
+#include "trace.h"
+#include "simpoint.h"
 
 /* ===================================================================== */
 /* Commandline Switches                                                  */
@@ -25,18 +32,360 @@ KNOB<UINT32> KnobL2BlockSize(KNOB_MODE_WRITEONCE, "pintool",
     "L2b","64", "L2 cache block size in bytes");
 KNOB<UINT32> KnobL2Associativity(KNOB_MODE_WRITEONCE, "pintool",
     "L2a","8", "L2 cache associativity (1 for direct mapped)");
+KNOB<UINT32> KnobL3CacheSize(KNOB_MODE_WRITEONCE, "pintool",
+    "L3c","0", "L3 cache size in kilobytes (0 for no L3)");
+KNOB<UINT32> KnobL3BlockSize(KNOB_MODE_WRITEONCE, "pintool",
+    "L3b","64", "L3 cache block size in bytes");
+KNOB<UINT32> KnobL3Associativity(KNOB_MODE_WRITEONCE, "pintool",
+    "L3a","16", "L3 cache associativity (1 for direct mapped)");
+KNOB<UINT32> KnobL1ICacheSize(KNOB_MODE_WRITEONCE, "pintool",
+    "L1Ic","0", "L1 instruction cache size in kilobytes (0 for no instruction cache)");
+KNOB<UINT32> KnobL1IBlockSize(KNOB_MODE_WRITEONCE, "pintool",
+    "L1Ib","64", "L1 instruction cache block size in bytes");
+KNOB<UINT32> KnobL1IAssociativity(KNOB_MODE_WRITEONCE, "pintool",
+    "L1Ia","8", "L1 instruction cache associativity (1 for direct mapped)");
+KNOB<BOOL> KnobBuffered(KNOB_MODE_WRITEONCE, "pintool",
+    "buffered","0", "collect memory references in a per-thread Pin trace buffer and simulate them in batches");
+KNOB<UINT32> KnobBufferPages(KNOB_MODE_WRITEONCE, "pintool",
+    "buffer_pages","256", "size of each trace buffer in pages (with -buffered)");
+KNOB<string> KnobConfigs(KNOB_MODE_APPEND, "pintool",
+    "cfg","", "simulate L1c_L1a_L1b:L2c_L2a_L2b, e.g. 32_8_64:1024_8_128 (repeatable, implies -buffered)");
+KNOB<string> KnobConfigFile(KNOB_MODE_WRITEONCE, "pintool",
+    "cfg_file","", "file with one -cfg configuration per line");
+KNOB<UINT32> KnobSimThreads(KNOB_MODE_WRITEONCE, "pintool",
+    "sim_threads","0", "threads simulating the configurations (0 for one per configuration)");
+KNOB<string> KnobStackDistance(KNOB_MODE_APPEND, "pintool",
+    "sdist","", "LRU stack distance analysis of <block_size>_<sets>, e.g. 64_64 (repeatable, implies -buffered)");
+KNOB<UINT32> KnobStackDistanceMaxAssoc(KNOB_MODE_WRITEONCE, "pintool",
+    "sdist_max_assoc","64", "largest associativity of the -sdist miss ratio curves");
+KNOB<BOOL> KnobSample(KNOB_MODE_WRITEONCE, "pintool",
+    "sample","0", "simulate sampled windows only (SMARTS-style): fast-forward, warm, then measure, every -sample_period instructions");
+KNOB<UINT64> KnobSamplePeriod(KNOB_MODE_WRITEONCE, "pintool",
+    "sample_period","1000000", "instructions between the starts of two detailed windows (with -sample)");
+KNOB<UINT64> KnobSampleWindow(KNOB_MODE_WRITEONCE, "pintool",
+    "sample_window","10000", "instructions of each detailed window (with -sample)");
+KNOB<UINT64> KnobSampleWarming(KNOB_MODE_WRITEONCE, "pintool",
+    "sample_warming","50000", "instructions of functional warming before each window (with -sample)");
+KNOB<string> KnobRecord(KNOB_MODE_WRITEONCE, "pintool",
+    "record","", "also write the ROI memory references to this trace file, for cache_replay (implies -buffered)");
+KNOB<UINT32> KnobCores(KNOB_MODE_WRITEONCE, "pintool",
+    "cores","0", "simulate private L1s (one per application thread), a shared L2 and MESI coherence for up to this many threads (0: one hierarchy shared by all threads)");
+KNOB<BOOL> KnobBbvProfile(KNOB_MODE_WRITEONCE, "pintool",
+    "bbv_profile","0", "profile basic block vectors instead of simulating, and pick the SimPoints (<o>.bb, <o>.simpoints, <o>.weights)");
+KNOB<UINT64> KnobBbvInterval(KNOB_MODE_WRITEONCE, "pintool",
+    "bbv_interval","100000000", "instructions of each interval (with -bbv_profile, and -simpoints, which checks it against <prefix>.simpoints)");
+KNOB<UINT32> KnobSimPointMaxK(KNOB_MODE_WRITEONCE, "pintool",
+    "simpoint_maxk","10", "most SimPoints to pick (with -bbv_profile)");
+KNOB<string> KnobSimPoints(KNOB_MODE_WRITEONCE, "pintool",
+    "simpoints","", "simulate the -bbv_interval intervals of <prefix>.simpoints only, weighted by <prefix>.weights");
+KNOB<UINT64> KnobSimPointWarming(KNOB_MODE_WRITEONCE, "pintool",
+    "simpoint_warming","1000000", "instructions of functional warming before each SimPoint (with -simpoints)");
+KNOB<string> KnobL1Prefetch(KNOB_MODE_WRITEONCE, "pintool",
+    "L1prefetch","none", "L1 prefetcher: none, next_line, stride or stream");
+KNOB<string> KnobL2Prefetch(KNOB_MODE_WRITEONCE, "pintool",
+    "L2prefetch","none", "L2 prefetcher: none, next_line, stride or stream");
+KNOB<UINT32> KnobPrefetchDegree(KNOB_MODE_WRITEONCE, "pintool",
+    "prefetch_degree","2", "most blocks prefetched per trigger");
+KNOB<UINT32> KnobPrefetchDistance(KNOB_MODE_WRITEONCE, "pintool",
+    "prefetch_distance","16", "blocks a stream prefetcher runs ahead of its stream");
+KNOB<BOOL> KnobTlb(KNOB_MODE_WRITEONCE, "pintool",
+    "tlb","0", "translate data accesses through TLBs, walking the page table through the caches");
+KNOB<string> KnobTlbGeometry(KNOB_MODE_WRITEONCE, "pintool",
+    "tlb_geometry","64_4:32_4:1536_12", "entries_assoc of the 4KB L1 DTLB, the 2MB L1 DTLB and the STLB (with -tlb)");
+KNOB<string> KnobThp(KNOB_MODE_APPEND, "pintool",
+    "thp","", "map <start>-<end> (hex), or all, with 2MB pages (repeatable, with -tlb)");
+KNOB<BOOL> KnobTraffic(KNOB_MODE_WRITEONCE, "pintool",
+    "traffic","0", "track dirty lines and report writebacks and the bytes between the levels");
+KNOB<BOOL> KnobStoreAllocate(KNOB_MODE_WRITEONCE, "pintool",
+    "store_allocate","1", "allocate L1 lines on store misses");
+KNOB<string> KnobL1Write(KNOB_MODE_WRITEONCE, "pintool",
+    "L1write","wb", "L1 write policy: wb (write-back) or wt (write-through)");
+KNOB<string> KnobL2Write(KNOB_MODE_WRITEONCE, "pintool",
+    "L2write","wb", "L2 write policy: wb (write-back) or wt (write-through)");
+KNOB<UINT32> KnobWriteBuffer(KNOB_MODE_WRITEONCE, "pintool",
+    "write_buffer","8", "entries of the coalescing write buffer below L1 (0 for none)");
+KNOB<string> KnobInclusion(KNOB_MODE_WRITEONCE, "pintool",
+    "inclusion","", "L2 inclusion of L1: inclusive, exclusive or nine (default: the build's L2_INCLUSIVE)");
+KNOB<string> KnobL1Policy(KNOB_MODE_WRITEONCE, "pintool",
+    "L1policy","", "L1 replacement policy: lru, random, lfu, lrfu, plru, nru, srrip, brrip, drrip, ship or hawkeye (default: the build's CACHE_SET_T)");
+KNOB<string> KnobL2Policy(KNOB_MODE_WRITEONCE, "pintool",
+    "L2policy","", "L2 replacement policy, as -L1policy (default: the build's CACHE_SET_T)");
+KNOB<UINT32> KnobMlpWindow(KNOB_MODE_WRITEONCE, "pintool",
+    "mlp_window","0", "non-blocking caches: instructions the core runs past a miss in flight (0 for blocking)");
+KNOB<UINT32> KnobL1Mshrs(KNOB_MODE_WRITEONCE, "pintool",
+    "l1_mshrs","10", "L1 misses in flight (with -mlp_window)");
+KNOB<UINT32> KnobL2Mshrs(KNOB_MODE_WRITEONCE, "pintool",
+    "l2_mshrs","16", "L2 misses in flight (with -mlp_window)");
+KNOB<UINT32> KnobPcProfile(KNOB_MODE_WRITEONCE, "pintool",
+    "pc_profile","0", "report the N instructions with the most L2, then L1, misses and their source lines (0 for none)");
+KNOB<UINT32> KnobPcProfilePcs(KNOB_MODE_WRITEONCE, "pintool",
+    "pc_profile_pcs","65536", "instructions with memory references that -pc_profile tells apart");
 
 /* ===================================================================== */
 
 /* ===================================================================== */
 /* Global Variables                                                      */
 /* ===================================================================== */
-typedef TWO_LEVEL_CACHE<CACHE_SET::LRU> CACHE_T;
-CACHE_T *two_level_cache;
+typedef CACHE_SET::LRU CACHE_SET_T;
 
 UINT64 total_cycles, total_instructions;
 std::ofstream outFile;
 
+// The simulated configurations. Without -cfg there is exactly one, given
+// by the -L1?/-L2? knobs and reported in the -o file.
+std::vector<CACHE_SIM *> sims;
+// -sdist analyzers, fed like the -cfg configurations
+std::vector<CACHE_SIM *> analyzers;
+bool multi_config;
+bool buffered;         // -buffered, -sdist, -record or more than one configuration
+TRACE_WRITER *trace_writer;
+
+BUFFER_ID memref_buffer;
+bool roi_done;         // ROI end seen (stop instrumenting)
+bool fetching;         // -L1Ic: basic blocks go through the instruction cache
+bool roi_drained;      // ROI end marker reached (stop simulating)
+NON_BLOCKING_CORE *mlp_core; // -mlp_window: the stalls of the references
+PC_PROFILE *pc_profile;      // -pc_profile: the misses of each instruction
+
+/**
+ * In live mode the simulated hierarchy is one concrete TWO_LEVEL_CACHE or CACHE_HIERARCHY type
+ * chosen at startup. CACHE_BINDING<CACHE> holds the analysis routines for
+ * each type, so that Load/Store call straight into its Access() and
+ * Instruction() only needs the bound function pointers.
+ **/
+template <class CACHE>
+struct CACHE_BINDING
+{
+    static CACHE *cache;
+
+    static VOID Load(ADDRINT addr, ADDRINT pc)
+    {
+        total_cycles += cache->Access(addr, CACHE::ACCESS_TYPE_LOAD, pc);
+    }
+
+    static VOID Store(ADDRINT addr, ADDRINT pc, UINT32 size)
+    {
+        total_cycles += cache->Access(addr, CACHE::ACCESS_TYPE_STORE, pc, size);
+    }
+
+    // -mlp_window: the core decides how long the reference stalls it
+    static VOID LoadMlp(ADDRINT addr, ADDRINT pc)
+    {
+        const UINT32 latency = cache->Access(addr, CACHE::ACCESS_TYPE_LOAD, pc);
+        mlp_core->Access(addr, latency, cache->ServedBy(), total_cycles);
+    }
+
+    static VOID StoreMlp(ADDRINT addr, ADDRINT pc, UINT32 size)
+    {
+        const UINT32 latency = cache->Access(addr, CACHE::ACCESS_TYPE_STORE, pc, size);
+        mlp_core->Access(addr, latency, cache->ServedBy(), total_cycles);
+    }
+
+    // -pc_profile: the misses of the reference go to instruction `id`
+    static VOID LoadProfiled(ADDRINT addr, ADDRINT pc, UINT32 id)
+    {
+        const CACHE_STATS l1Misses = cache->L1Misses(), l2Misses = cache->L2Misses();
+        if (mlp_core)
+            LoadMlp(addr, pc);
+        else
+            Load(addr, pc);
+        pc_profile->Count(id, cache->L1Misses() - l1Misses, cache->L2Misses() - l2Misses);
+    }
+
+    static VOID StoreProfiled(ADDRINT addr, ADDRINT pc, UINT32 size, UINT32 id)
+    {
+        const CACHE_STATS l1Misses = cache->L1Misses(), l2Misses = cache->L2Misses();
+        if (mlp_core)
+            StoreMlp(addr, pc, size);
+        else
+            Store(addr, pc, size);
+        pc_profile->Count(id, cache->L1Misses() - l1Misses, cache->L2Misses() - l2Misses);
+    }
+
+    // A basic block of `size` bytes at `addr` is about to run
+    static VOID Fetch(ADDRINT addr, UINT32 size, UINT32 numInstructions)
+    {
+        total_cycles += cache->Fetch(addr, size, numInstructions);
+    }
+};
+template <class CACHE> CACHE *CACHE_BINDING<CACHE>::cache = NULL;
+
+AFUNPTR LoadFn, StoreFn, FetchFn;
+
+/**
+ * Multi-core mode (-cores N): thread t runs on core t % N of a
+ * MULTI_CORE_CACHE and counts its own instructions and cycles, so that
+ * concurrent application threads share nothing but the simulated L2 and
+ * directory, which lock per set. Threads beyond N share a core and its
+ * counters, which then race.
+ **/
+struct CORE_COUNTERS
+{
+    UINT64 instructions;
+    UINT64 cycles;
+    UINT64 pad[HOST_CACHE_LINE / sizeof(UINT64) - 2]; // a host cache line each
+};
+
+UINT32 num_cores;
+CORE_COUNTERS *core_counters;
+volatile UINT32 shared_core_threads; // threads beyond -cores
+
+template <class CACHE>
+struct MULTI_CORE_BINDING
+{
+    static CACHE *cache;
+
+    static VOID Load(THREADID tid, ADDRINT addr)
+    {
+        const UINT32 core = tid % num_cores;
+        core_counters[core].cycles += cache->Access(core, addr, CACHE::ACCESS_TYPE_LOAD);
+    }
+
+    static VOID Store(THREADID tid, ADDRINT addr)
+    {
+        const UINT32 core = tid % num_cores;
+        core_counters[core].cycles += cache->Access(core, addr, CACHE::ACCESS_TYPE_STORE);
+    }
+};
+template <class CACHE> CACHE *MULTI_CORE_BINDING<CACHE>::cache = NULL;
+
+struct MULTI_CORE_BINDER
+{
+    const CACHE_CONFIG &config;
+
+    MULTI_CORE_BINDER(const CACHE_CONFIG &cfg) : config(cfg) {}
+
+    template <class TWO_LEVEL>
+    VOID Visit()
+    {
+        typedef typename MULTI_CORE_OF<TWO_LEVEL>::type CACHE;
+        CACHE *cache = new CACHE("Multi-core cache hierarchy", num_cores,
+                                 config.l1Size * KILO, config.l1Block, config.l1Assoc,
+                                 config.l2Size * KILO, config.l2Block, config.l2Assoc);
+        MULTI_CORE_BINDING<CACHE>::cache = cache;
+        LoadFn = (AFUNPTR)MULTI_CORE_BINDING<CACHE>::Load;
+        StoreFn = (AFUNPTR)MULTI_CORE_BINDING<CACHE>::Store;
+
+        // Only used for reporting, the cycles go to core_counters
+        sims.push_back(new CACHE_SIM(config.OutputName(""), cache));
+    }
+};
+
+/**
+ * Sampling modes. The ROI is fast-forwarded (instructions counted, caches
+ * untouched) except for detailed windows, whose stats are kept, each
+ * preceded by W instructions of functional warming (caches updated, stats
+ * dropped).
+ * -sample: the last U instructions of every period of P are a window. IPC
+ * and MPKI are estimated from the per-window values, with confidence
+ * intervals from their variance across windows.
+ * -simpoints: the windows are the intervals picked by -bbv_profile, and
+ * the estimates are their values weighted by the SimPoint weights.
+ **/
+enum {
+    PHASE_FAST_FORWARD = 0,
+    PHASE_WARMING,
+    PHASE_DETAILED
+};
+
+bool sampling;         // -sample or -simpoints
+UINT32 sample_phase;
+UINT64 phase_end;      // instruction count at which sample_phase ends
+UINT64 window_begin;   // instruction count of the next window start
+UINT64 window_length;
+UINT64 windows_scheduled;
+static const UINT64 NO_WINDOW = ~0ULL;
+
+std::vector<SIMPOINT> simpoints;
+double window_weight;  // SimPoint weight of the current window
+double simpoint_weight, simpoint_cpi, simpoint_l1_mpki, simpoint_l2_mpki; // weighted sums
+
+/**
+ * Running mean and variance of a per-window metric
+ **/
+struct SAMPLE_ESTIMATE
+{
+    UINT64 n;
+    double sum, sumSq;
+
+    SAMPLE_ESTIMATE() : n(0), sum(0), sumSq(0) {}
+
+    VOID Add(double x) { n++; sum += x; sumSq += x * x; }
+    double Mean() const { return n ? sum / n : 0; }
+    double StdDev() const
+    {
+        return n > 1 ? sqrt(std::max(0.0, (sumSq - sum * sum / n) / (n - 1))) : 0;
+    }
+    // Half width of the confidence interval of the mean, for a z score
+    double HalfWidth(double z) const { return n ? z * StdDev() / sqrt((double)n) : 0; }
+};
+
+// 99.7% confidence, as SMARTS
+static const double SAMPLE_Z = 3.0;
+
+SAMPLE_ESTIMATE sample_cpi, sample_l1_mpki, sample_l2_mpki;
+UINT64 window_instructions, window_cycles; // at the start of the window
+UINT64 sampled_instructions, sampled_cycles;
+
+/**
+ * Per cache type hooks of the detailed windows: the stats of a window are
+ * those of the simulated cache between BeginWindow and EndWindow, and are
+ * summed into `detailed`, which is what gets reported. The occupancy of
+ * the levels is not summed: `detailed` reports that of the simulated
+ * cache after the last window.
+ **/
+template <class CACHE>
+struct SAMPLE_BINDING
+{
+    static CACHE *detailed;
+
+    static VOID BeginWindow() { CACHE_BINDING<CACHE>::cache->ResetStats(); }
+
+    static VOID EndWindow(CACHE_STATS &l1Misses, CACHE_STATS &l2Misses)
+    {
+        const CACHE *cache = CACHE_BINDING<CACHE>::cache;
+        l1Misses = cache->L1Misses();
+        l2Misses = cache->L2Misses();
+        detailed->AddWindowStats(*cache);
+    }
+};
+template <class CACHE> CACHE *SAMPLE_BINDING<CACHE>::detailed = NULL;
+
+VOID (*BeginWindowFn)();
+VOID (*EndWindowFn)(CACHE_STATS &, CACHE_STATS &);
+
+struct LIVE_BINDER
+{
+    const CACHE_CONFIG &config;
+
+    LIVE_BINDER(const CACHE_CONFIG &cfg) : config(cfg) {}
+
+    template <class CACHE>
+    VOID Visit()
+    {
+        CACHE *cache = NewCache<CACHE>(config);
+        CACHE_BINDING<CACHE>::cache = cache;
+        LoadFn = (AFUNPTR)(mlp_core ? CACHE_BINDING<CACHE>::LoadMlp : CACHE_BINDING<CACHE>::Load);
+        StoreFn = (AFUNPTR)(mlp_core ? CACHE_BINDING<CACHE>::StoreMlp : CACHE_BINDING<CACHE>::Store);
+        if (pc_profile) {
+            LoadFn = (AFUNPTR)CACHE_BINDING<CACHE>::LoadProfiled;
+            StoreFn = (AFUNPTR)CACHE_BINDING<CACHE>::StoreProfiled;
+        }
+        FetchFn = (AFUNPTR)CACHE_BINDING<CACHE>::Fetch;
+
+        if (sampling) {
+            // Report the detailed windows only
+            cache = NewCache<CACHE>(config);
+            SAMPLE_BINDING<CACHE>::detailed = cache;
+            BeginWindowFn = SAMPLE_BINDING<CACHE>::BeginWindow;
+            EndWindowFn = SAMPLE_BINDING<CACHE>::EndWindow;
+        }
+
+        // Only used for reporting, the cycles go to total_cycles directly
+        sims.push_back(new CACHE_SIM(config.OutputName(""), cache));
+    }
+};
+
 /* ===================================================================== */
 
 INT32 Usage()
@@ -48,17 +397,160 @@ INT32 Usage()
 }
 
 /* ===================================================================== */
+/* Simulation threads (buffered mode)                                    */
+/* ===================================================================== */
+
+/**
+ * Full trace buffers are published in a ring shared by all application
+ * threads (serialized by ring_lock) and consumed by every worker thread:
+ * worker i simulates configurations i, i + W, i + 2W, ... on each batch,
+ * so a single instrumented run feeds all configurations. A slot is reused
+ * once all W workers are past it, and its buffer goes back to Pin.
+ **/
+static const UINT32 RING_SLOTS = 16;
+
+struct RING_SLOT
+{
+    VOID *buf;
+    UINT64 numRefs;
+    volatile UINT32 pending;   // workers that have not simulated it yet
+};
+
+struct WORKER
+{
+    UINT32 id;
+    UINT64 tail;               // next batch to simulate
+    PIN_THREAD_UID uid;
+};
+
+RING_SLOT ring[RING_SLOTS];
+volatile UINT64 ring_head;     // batches published so far
+PIN_LOCK ring_lock;
+std::vector<WORKER> workers;
+volatile bool workers_stop;
+volatile UINT32 workers_running;
+
+// Configurations and analyzers, as one list split among the workers
+UINT32 NumModels() { return sims.size() + analyzers.size(); }
+CACHE_SIM *Model(UINT32 i)
+{
+    return i < sims.size() ? sims[i] : analyzers[i - sims.size()];
+}
+
+VOID SimulateBatch(UINT32 worker, const RING_SLOT &slot)
+{
+    const MEMREF *refs = static_cast<const MEMREF *>(slot.buf);
+    for (UINT32 i = worker; i < NumModels(); i += workers.size())
+        Model(i)->Simulate(refs, slot.numRefs);
+}
+
+VOID WorkerMain(VOID *arg)
+{
+    WORKER *worker = static_cast<WORKER *>(arg);
+
+    for (;;) {
+        if (worker->tail == ring_head) {
+            if (workers_stop)
+                break;
+            PIN_Yield();
+            continue;
+        }
+        __sync_synchronize();
+
+        RING_SLOT &slot = ring[worker->tail % RING_SLOTS];
+        SimulateBatch(worker->id, slot);
+        __sync_fetch_and_sub(&slot.pending, 1);
+        worker->tail++;
+    }
+    __sync_fetch_and_sub(&workers_running, 1);
+}
+
+VOID StartWorkers()
+{
+    UINT32 numWorkers = KnobSimThreads.Value();
+    if (numWorkers == 0 || numWorkers > NumModels())
+        numWorkers = NumModels();
+
+    workers.resize(numWorkers);
+    workers_running = numWorkers;
+    for (UINT32 i = 0; i < numWorkers; i++) {
+        workers[i].id = i;
+        workers[i].tail = 0;
+        if (PIN_SpawnInternalThread(WorkerMain, &workers[i], 0,
+                                    &workers[i].uid) == INVALID_THREADID) {
+            cerr << "Error: could not spawn simulation thread " << i << endl;
+            PIN_ExitProcess(1);
+        }
+    }
+}
+
+/**
+ * Waits for the workers to exit and simulates, on the calling thread,
+ * whatever batches they did not get to.
+ **/
+VOID DrainRing()
+{
+    workers_stop = true;
+    while (workers_running)
+        PIN_Yield();
+
+    for (UINT32 i = 0; i < workers.size(); i++)
+        for (; workers[i].tail < ring_head; workers[i].tail++)
+            SimulateBatch(i, ring[workers[i].tail % RING_SLOTS]);
+}
 
-VOID Load(ADDRINT addr)
+// Internal threads must be told to exit before Pin runs the Fini functions
+VOID PrepareForFini(VOID *v)
 {
-    total_cycles += two_level_cache->Access(addr, CACHE_T::ACCESS_TYPE_LOAD);
+    workers_stop = true;
 }
 
-VOID Store(ADDRINT addr)
+/**
+ * Called by Pin when a thread's trace buffer is full or the thread exits.
+ * Publishes the buffered references up to the ROI end marker, if any, and
+ * returns the buffer Pin fills next: the one of the recycled ring slot.
+ **/
+VOID * BufferFull(BUFFER_ID id, THREADID tid, const CONTEXT *ctxt, VOID *buf,
+                  UINT64 numElements, VOID *v)
 {
-    total_cycles += two_level_cache->Access(addr, CACHE_T::ACCESS_TYPE_STORE);
+    const MEMREF *refs = static_cast<const MEMREF *>(buf);
+    VOID *next = buf;
+
+    PIN_GetLock(&ring_lock, tid + 1);
+    if (!roi_drained) {
+        UINT64 n = 0;
+        while (n < numElements && refs[n].type != MEMREF_ROI_END)
+            n++;
+        roi_drained = (n < numElements);
+        if (trace_writer)
+            trace_writer->Write(refs, n);
+
+        RING_SLOT &slot = ring[ring_head % RING_SLOTS];
+        if (workers_stop) {
+            // Threads exiting after PrepareForFini: the workers may be
+            // gone, so simulate here
+            DrainRing();
+            RING_SLOT batch = { buf, n, 0 };
+            for (UINT32 i = 0; i < workers.size(); i++)
+                SimulateBatch(i, batch);
+        } else {
+            while (slot.pending)   // ring full, wait for the slowest worker
+                PIN_Yield();
+            next = slot.buf ? slot.buf : PIN_AllocateBuffer(id);
+            slot.buf = buf;
+            slot.numRefs = n;
+            slot.pending = workers.size();
+            __sync_synchronize();
+            ring_head++;
+        }
+    }
+    PIN_ReleaseLock(&ring_lock);
+
+    return next;
 }
 
+/* ===================================================================== */
+
 VOID count_instruction()
 {
     total_instructions++;
@@ -71,8 +563,281 @@ VOID count_instruction()
 	}
 }
 
+// count_instruction() with -mlp_window, which may stall the core
+VOID count_mlp_instruction()
+{
+    total_instructions++;
+    mlp_core->Retire(total_cycles);
+    if (total_instructions % INSTRUCTIONS == 0)
+        outFile << (double)total_instructions / (double)total_cycles << "\n";
+}
+
+VOID count_core_instruction(THREADID tid)
+{
+    CORE_COUNTERS &counters = core_counters[tid % num_cores];
+    counters.instructions++;
+    counters.cycles++;
+}
+
+VOID ThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+    if (tid >= num_cores)
+        __sync_fetch_and_add(&shared_core_threads, 1);
+}
+
+/* ===================================================================== */
+/* Sampling                                                              */
+/* ===================================================================== */
+
+/**
+ * Schedules the next detailed window (window_begin is NO_WINDOW when there
+ * is none) and returns the instruction count at which its warming starts.
+ **/
+UINT64 NextWindow()
+{
+    UINT64 warming;
+    if (simpoints.empty()) {
+        const UINT64 period = KnobSamplePeriod.Value();
+        window_length = KnobSampleWindow.Value();
+        window_begin = windows_scheduled * period + period - window_length;
+        warming = KnobSampleWarming.Value();
+    } else if (windows_scheduled < simpoints.size()) {
+        const SIMPOINT &simpoint = simpoints[windows_scheduled];
+        window_length = KnobBbvInterval.Value();
+        window_begin = simpoint.interval * window_length;
+        window_weight = simpoint.weight;
+        warming = KnobSimPointWarming.Value();
+    } else {
+        window_begin = NO_WINDOW;
+        return NO_WINDOW;
+    }
+    windows_scheduled++;
+    return window_begin > warming ? window_begin - warming : 0;
+}
+
+VOID NextPhase()
+{
+    // Phases may be shorter than a basic block, or empty
+    do {
+        switch (sample_phase) {
+            case PHASE_FAST_FORWARD:
+                sample_phase = PHASE_WARMING;
+                phase_end = window_begin;
+                break;
+
+            case PHASE_WARMING:
+                BeginWindowFn();
+                window_instructions = total_instructions;
+                window_cycles = total_cycles;
+                sample_phase = PHASE_DETAILED;
+                phase_end = window_begin + window_length;
+                break;
+
+            case PHASE_DETAILED: {
+                CACHE_STATS l1Misses, l2Misses;
+                EndWindowFn(l1Misses, l2Misses);
+                const UINT64 instructions = total_instructions - window_instructions;
+                // One cycle per instruction plus the memory hierarchy ones
+                const UINT64 cycles = instructions + total_cycles - window_cycles;
+                if (instructions) {
+                    sample_cpi.Add((double)cycles / instructions);
+                    sample_l1_mpki.Add(1000.0 * l1Misses / instructions);
+                    sample_l2_mpki.Add(1000.0 * l2Misses / instructions);
+                    sampled_instructions += instructions;
+                    sampled_cycles += cycles;
+
+                    simpoint_weight += window_weight;
+                    simpoint_cpi += window_weight * cycles / instructions;
+                    simpoint_l1_mpki += window_weight * 1000.0 * l1Misses / instructions;
+                    simpoint_l2_mpki += window_weight * 1000.0 * l2Misses / instructions;
+                }
+                sample_phase = PHASE_FAST_FORWARD;
+                phase_end = NextWindow();
+                break;
+            }
+        }
+    } while (total_instructions >= phase_end);
+}
+
+// Counts the instructions of a basic block; true at the end of a phase
+ADDRINT CountBlock(UINT32 numInstructions)
+{
+    total_instructions += numInstructions;
+    return total_instructions >= phase_end;
+}
+
+// Whether memory references go to the caches
+ADDRINT Simulating()
+{
+    return sample_phase != PHASE_FAST_FORWARD;
+}
+
+VOID SampleTrace(TRACE trace, VOID *v)
+{
+    if (roi_done)
+        return;
+
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)) {
+        if (fetching) {
+            BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR)Simulating, IARG_END);
+            BBL_InsertThenCall(bbl, IPOINT_BEFORE, FetchFn, IARG_ADDRINT, BBL_Address(bbl),
+                               IARG_UINT32, BBL_Size(bbl), IARG_UINT32, BBL_NumIns(bbl),
+                               IARG_END);
+        }
+        BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR)CountBlock,
+                         IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+        BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR)NextPhase, IARG_END);
+    }
+}
+
+VOID SampleInstruction(INS ins, VOID *v)
+{
+    if (roi_done)
+        return;
+
+    UINT32 memOperands = INS_MemoryOperandCount(ins);
+    for (UINT32 memOp = 0; memOp < memOperands; memOp++) {
+        if (INS_MemoryOperandIsRead(ins, memOp)) {
+            INS_InsertIfPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)Simulating, IARG_END);
+            INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE, LoadFn,
+                                         IARG_MEMORYOP_EA, memOp, IARG_INST_PTR, IARG_END);
+        }
+        if (INS_MemoryOperandIsWritten(ins, memOp)) {
+            INS_InsertIfPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)Simulating, IARG_END);
+            INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE, StoreFn,
+                                         IARG_MEMORYOP_EA, memOp, IARG_INST_PTR,
+                                         IARG_UINT32, INS_MemoryOperandSize(ins, memOp), IARG_END);
+        }
+    }
+}
+
+VOID SampleReport(std::ofstream &out, const CACHE_SIM *sim)
+{
+    if (!sampled_instructions) {
+        out << "Sampling: no complete window in " << total_instructions
+            << " ROI instructions, lower -sample_period\n";
+        return;
+    }
+
+    const double cpi = (double)sampled_cycles / sampled_instructions;
+    const double ipc = 1.0 / cpi;
+    // Same relative error for IPC as for its inverse, to first order
+    const double ipcError = ipc * sample_cpi.HalfWidth(SAMPLE_Z) / cpi;
+
+    // Totals of the detailed windows, so that misses / instructions of the
+    // stats below give the MPKI
+    out << "Total Instructions: " << sampled_instructions << "\n";
+    out << "Total Cycles: " << sampled_cycles << "\n";
+    out << "IPC: " << ipc << " +- " << ipcError << "\n";
+    out << "\n";
+    out << "Sampling: " << sample_cpi.n << " windows of " << KnobSampleWindow.Value()
+        << " instructions every " << KnobSamplePeriod.Value() << ", "
+        << KnobSampleWarming.Value() << " warming (99.7% confidence)\n";
+    out << "ROI Instructions: " << total_instructions << "\n";
+    out << "Estimated ROI Cycles: " << (UINT64)(cpi * total_instructions) << "\n";
+    out << "L1-MPKI: " << sample_l1_mpki.Mean() << " +- " << sample_l1_mpki.HalfWidth(SAMPLE_Z) << "\n";
+    out << "L2-MPKI: " << sample_l2_mpki.Mean() << " +- " << sample_l2_mpki.HalfWidth(SAMPLE_Z) << "\n";
+    out << "\n";
+
+    // Report Cache configuration + statistics
+    out << sim->Report(sampled_instructions);
+}
+
+VOID SimPointReport(std::ofstream &out, const CACHE_SIM *sim)
+{
+    if (!sampled_instructions) {
+        out << "SimPoints: none reached in " << total_instructions << " ROI instructions\n";
+        return;
+    }
+
+    // Weighted over the SimPoints reached, in case the ROI ended earlier
+    // than when profiled
+    const double cpi = simpoint_cpi / simpoint_weight;
+
+    out << "Total Instructions: " << sampled_instructions << "\n";
+    out << "Total Cycles: " << sampled_cycles << "\n";
+    out << "IPC: " << 1.0 / cpi << "\n";
+    out << "\n";
+    out << "SimPoints: " << sample_cpi.n << " of " << simpoints.size() << " intervals of "
+        << KnobBbvInterval.Value() << " instructions, " << KnobSimPointWarming.Value()
+        << " warming, total weight " << simpoint_weight << "\n";
+    out << "ROI Instructions: " << total_instructions << "\n";
+    out << "Estimated ROI Cycles: " << (UINT64)(cpi * total_instructions) << "\n";
+    out << "L1-MPKI: " << simpoint_l1_mpki / simpoint_weight << "\n";
+    out << "L2-MPKI: " << simpoint_l2_mpki / simpoint_weight << "\n";
+    out << "\n";
+
+    // Report Cache configuration + statistics
+    out << sim->Report(sampled_instructions);
+}
+
+/* ===================================================================== */
+/* Basic block vector profiling                                          */
+/* ===================================================================== */
+
+BBV_PROFILER *bbv_profiler;
+
+ADDRINT BbvCount(UINT32 id, UINT32 numInstructions)
+{
+    total_instructions += numInstructions;
+    return bbv_profiler->Count(id, numInstructions);
+}
+
+VOID BbvEndInterval()
+{
+    bbv_profiler->EndInterval();
+}
+
+VOID BbvTrace(TRACE trace, VOID *v)
+{
+    if (roi_done)
+        return;
+
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)) {
+        BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR)BbvCount,
+                         IARG_UINT32, bbv_profiler->BlockId(BBL_Address(bbl)),
+                         IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+        BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR)BbvEndInterval, IARG_END);
+    }
+}
+
+// Writes <prefix>.bb, picks the SimPoints and writes them
+VOID BbvReport(std::ofstream &out, const string &prefix)
+{
+    bbv_profiler->EndInterval();
+
+    std::ofstream bb((prefix + ".bb").c_str());
+    bbv_profiler->WriteBbv(bb);
+    const std::vector<SIMPOINT> picks = PickSimPoints(*bbv_profiler, KnobSimPointMaxK.Value());
+    WriteSimPoints(prefix, picks, bbv_profiler->IntervalSize());
+
+    out << "Total Instructions: " << total_instructions << "\n";
+    out << "\n";
+    out << "BBV Profile: " << bbv_profiler->Intervals().size() << " intervals of "
+        << KnobBbvInterval.Value() << " instructions\n";
+    out << "SimPoints: (Interval - Cluster - Weight)\n";
+    for (UINT32 i = 0; i < picks.size(); i++)
+        out << "  " << picks[i].interval << " " << picks[i].cluster << " "
+            << picks[i].weight << "\n";
+}
+
+/* ===================================================================== */
+
+VOID InsertBufferedRef(INS ins, UINT32 memOp, UINT32 type)
+{
+    INS_InsertFillBufferPredicated(ins, IPOINT_BEFORE, memref_buffer,
+        IARG_MEMORYOP_EA, memOp, offsetof(MEMREF, addr),
+        IARG_INST_PTR, offsetof(MEMREF, pc),
+        IARG_UINT32, INS_MemoryOperandSize(ins, memOp), offsetof(MEMREF, size),
+        IARG_UINT32, type, offsetof(MEMREF, type),
+        IARG_END);
+}
+
 VOID Instruction(INS ins, void * v)
 {
+    if (roi_done)
+        return;
+
     UINT32 memOperands = INS_MemoryOperandCount(ins);
 
     // Instrument each memory operand. If the operand is both read and written
@@ -80,44 +845,232 @@ VOID Instruction(INS ins, void * v)
     // Iterating over memory operands ensures that instructions on IA-32 with
     // two read operands (such as SCAS and CMPS) are correctly handled.
     for (UINT32 memOp = 0; memOp < memOperands; memOp++) {
+        if (buffered) {
+            if (INS_MemoryOperandIsRead(ins, memOp))
+                InsertBufferedRef(ins, memOp, MEMREF_LOAD);
+            if (INS_MemoryOperandIsWritten(ins, memOp))
+                InsertBufferedRef(ins, memOp, MEMREF_STORE);
+            continue;
+        }
+
+        if (num_cores) {
+            if (INS_MemoryOperandIsRead(ins, memOp))
+                INS_InsertPredicatedCall(ins, IPOINT_BEFORE, LoadFn, IARG_THREAD_ID,
+                                         IARG_MEMORYOP_EA, memOp, IARG_END);
+            if (INS_MemoryOperandIsWritten(ins, memOp))
+                INS_InsertPredicatedCall(ins, IPOINT_BEFORE, StoreFn, IARG_THREAD_ID,
+                                         IARG_MEMORYOP_EA, memOp, IARG_END);
+            continue;
+        }
+
+        if (pc_profile) {
+            const UINT32 id = pc_profile->Id(INS_Address(ins));
+            if (INS_MemoryOperandIsRead(ins, memOp))
+                INS_InsertPredicatedCall(ins, IPOINT_BEFORE, LoadFn, IARG_MEMORYOP_EA, memOp,
+                                         IARG_INST_PTR, IARG_UINT32, id, IARG_END);
+            if (INS_MemoryOperandIsWritten(ins, memOp))
+                INS_InsertPredicatedCall(ins, IPOINT_BEFORE, StoreFn, IARG_MEMORYOP_EA, memOp,
+                                         IARG_INST_PTR, IARG_UINT32, INS_MemoryOperandSize(ins, memOp),
+                                         IARG_UINT32, id, IARG_END);
+            continue;
+        }
+
         if (INS_MemoryOperandIsRead(ins, memOp)) {
-            INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) Load,
-                                     IARG_MEMORYOP_EA, memOp, IARG_END);
+            INS_InsertPredicatedCall(ins, IPOINT_BEFORE, LoadFn,
+                                     IARG_MEMORYOP_EA, memOp, IARG_INST_PTR, IARG_END);
         }
         if (INS_MemoryOperandIsWritten(ins, memOp)) {
-            INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) Store,
-                                     IARG_MEMORYOP_EA, memOp, IARG_END);
+            INS_InsertPredicatedCall(ins, IPOINT_BEFORE, StoreFn,
+                                     IARG_MEMORYOP_EA, memOp, IARG_INST_PTR,
+                                     IARG_UINT32, INS_MemoryOperandSize(ins, memOp), IARG_END);
         }
     }
 
     // Count each and every instruction
-    INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)count_instruction, IARG_END);
+    if (num_cores)
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)count_core_instruction,
+                       IARG_THREAD_ID, IARG_END);
+    else if (mlp_core)
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)count_mlp_instruction, IARG_END);
+    else
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)count_instruction, IARG_END);
+}
+
+// One instruction cache access per basic block, covering the lines it spans
+VOID FetchTrace(TRACE trace, VOID *v)
+{
+    if (roi_done)
+        return;
+
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+        BBL_InsertCall(bbl, IPOINT_BEFORE, FetchFn, IARG_ADDRINT, BBL_Address(bbl),
+                       IARG_UINT32, BBL_Size(bbl), IARG_UINT32, BBL_NumIns(bbl), IARG_END);
 }
 
 /* ===================================================================== */
 
-VOID Fini(int code, VOID * v)
+// "<routine> <file>:<line>" of the instruction at `pc`, "?" where unknown
+string SourceLocation(ADDRINT pc)
+{
+    INT32 line = 0;
+    string file;
+    PIN_LockClient();
+    string routine = RTN_FindNameByAddress(pc);
+    PIN_GetSourceLocation(pc, NULL, &line, &file);
+    PIN_UnlockClient();
+
+    if (routine.empty())
+        routine = "?";
+    if (file.empty())
+        return routine + " ?";
+    return routine + " " + file + ":" + decstr(line);
+}
+
+// The -pc_profile top instructions, ranked
+VOID PcProfileReport(std::ofstream &out)
 {
+    const std::vector<UINT32> top = pc_profile->Top(KnobPcProfile.Value());
+    out << "PC Profile: " << pc_profile->NumPcs() << " instructions with memory references\n";
+    out << "Delinquent PCs: (Rank - PC - Accesses - L1-Misses - L2-Misses - L2-MPKI - Routine - File:Line)\n";
+    for (UINT32 i = 0; i < top.size(); i++) {
+        const PC_PROFILE::COUNTS &counts = pc_profile->Counts(top[i]);
+        out << "  " << i + 1 << ": " << hexstr(pc_profile->Pc(top[i])) << " "
+            << counts.accesses << " " << counts.l1Misses << " " << counts.l2Misses << " "
+            << (total_instructions ? 1000.0 * counts.l2Misses / total_instructions : 0) << " "
+            << SourceLocation(pc_profile->Pc(top[i])) << "\n";
+    }
+    if (pc_profile->Overflow().accesses)
+        out << "Warning: " << pc_profile->Overflow().accesses
+            << " references of instructions beyond -pc_profile_pcs were not attributed\n";
+    out << "\n";
+}
+
+VOID Report(std::ofstream &out, const CACHE_SIM *sim)
+{
+    // In live mode sim->cycles is 0, Load/Store add to total_cycles
+    const UINT64 cycles = total_cycles + sim->cycles;
+
     // Report total instructions and total cycles
-    outFile << "Total Instructions: " << total_instructions << "\n";
-    outFile << "Total Cycles: " << total_cycles << "\n";
-    outFile << "IPC: " << (double)total_instructions / (double)total_cycles << "\n";
-    outFile << "\n";
+    out << "Total Instructions: " << total_instructions << "\n";
+    out << "Total Cycles: " << cycles << "\n";
+    out << "IPC: " << (double)total_instructions / (double)cycles << "\n";
+    if (mlp_core)
+        out << "MLP: " << mlp_core->Mlp() << "\n";
+    out << "\n";
 
     // Report Cache configuration + statistics
-    outFile << two_level_cache->PrintCache("");
-    outFile << two_level_cache->StatsLong("");
+    out << sim->Report(total_instructions);
+    if (mlp_core)
+        out << mlp_core->StatsLong("");
+    if (pc_profile)
+        PcProfileReport(out);
+}
+
+/**
+ * The cores run in parallel: the ROI takes as long as the slowest one, and
+ * IPC is that of the whole chip.
+ **/
+VOID MultiCoreReport(std::ofstream &out, const CACHE_SIM *sim)
+{
+    UINT64 cycles = 0;
+    total_instructions = 0;
+    for (UINT32 c = 0; c < num_cores; c++) {
+        total_instructions += core_counters[c].instructions;
+        cycles = std::max(cycles, core_counters[c].cycles);
+    }
+
+    out << "Total Instructions: " << total_instructions << "\n";
+    out << "Total Cycles: " << cycles << "\n";
+    out << "IPC: " << (double)total_instructions / (double)cycles << "\n";
+    out << "\n";
+    out << "Cores: (Core - Instructions - Cycles - IPC)\n";
+    for (UINT32 c = 0; c < num_cores; c++)
+        out << "  " << c << ": " << core_counters[c].instructions << " "
+            << core_counters[c].cycles << " "
+            << (core_counters[c].cycles ?
+                (double)core_counters[c].instructions / core_counters[c].cycles : 0) << "\n";
+    if (shared_core_threads)
+        out << "Warning: " << shared_core_threads << " threads shared a core, raise -cores\n";
+    out << "\n";
 
-    outFile.close();
+    // Report Cache configuration + statistics
+    out << sim->Report();
+}
+
+VOID Fini(int code, VOID * v)
+{
+    if (buffered)
+        DrainRing();
+    if (trace_writer)
+        trace_writer->Close(total_instructions);
+    if (mlp_core)
+        mlp_core->Drain(total_cycles);
+
+    // Other than the -o file, one file per configuration or analyzer,
+    // named after -o like run_l1.sh names them
+    string prefix = KnobOutputFile.Value();
+    if (prefix.size() > 4 && prefix.compare(prefix.size() - 4, 4, ".out") == 0)
+        prefix.erase(prefix.size() - 4);
+
+    if (bbv_profiler) {
+        BbvReport(outFile, prefix);
+        outFile.close();
+    } else if (num_cores) {
+        MultiCoreReport(outFile, sims[0]);
+        outFile.close();
+    } else if (sampling && !simpoints.empty()) {
+        SimPointReport(outFile, sims[0]);
+        outFile.close();
+    } else if (sampling) {
+        SampleReport(outFile, sims[0]);
+        outFile.close();
+    } else if (!multi_config) {
+        Report(outFile, sims[0]);
+        outFile.close();
+    } else {
+        for (UINT32 i = 0; i < sims.size(); i++) {
+            std::ofstream out((prefix + sims[i]->output).c_str());
+            Report(out, sims[i]);
+        }
+    }
+
+    for (UINT32 i = 0; i < analyzers.size(); i++) {
+        std::ofstream out((prefix + analyzers[i]->output).c_str());
+        out << "Total Instructions: " << total_instructions << "\n";
+        out << "\n";
+        out << analyzers[i]->Report();
+    }
 }
 
 VOID roi_begin()
 {
+    if (bbv_profiler) {
+        TRACE_AddInstrumentFunction(BbvTrace, 0);
+        return;
+    }
+    if (sampling) {
+        phase_end = NextWindow();
+        TRACE_AddInstrumentFunction(SampleTrace, 0);
+        INS_AddInstrumentFunction(SampleInstruction, 0);
+        return;
+    }
+    if (fetching)
+        TRACE_AddInstrumentFunction(FetchTrace, 0);
     INS_AddInstrumentFunction(Instruction, 0);
 }
 
 VOID roi_end()
 {
+    // In buffered mode the ROI tail is still sitting in the trace buffer,
+    // and Pin only hands it over when the thread exits. So instead of
+    // detaching, drop the instrumentation and let Fini run at exit, once
+    // the buffers are drained up to the ROI end marker.
+    if (buffered) {
+        roi_done = true;
+        PIN_RemoveInstrumentation();
+        return;
+    }
+
     // We need to manually call Fini here because it is not called by PIN
     // if PIN_Detach() is encountered.
     Fini(0, 0);
@@ -130,14 +1083,48 @@ VOID Routine(RTN rtn, void *v)
 
     if (RTN_Name(rtn) == "__parsec_roi_begin")
         RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)roi_begin, IARG_END);
-    if (RTN_Name(rtn) == "__parsec_roi_end")
+    if (RTN_Name(rtn) == "__parsec_roi_end") {
         RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)roi_end, IARG_END);
+        if (buffered)
+            INS_InsertFillBuffer(RTN_InsHead(rtn), IPOINT_BEFORE, memref_buffer,
+                IARG_UINT32, MEMREF_ROI_END, offsetof(MEMREF, type),
+                IARG_END);
+    }
 
     RTN_Close(rtn);
 }
 
 /* ===================================================================== */
 
+/**
+ * Collects the -cfg configurations and the lines of -cfg_file ('#' starts
+ * a comment).
+ **/
+bool ReadConfigs(std::vector<CACHE_CONFIG> &configs)
+{
+    std::vector<string> names;
+    for (UINT32 i = 0; i < KnobConfigs.NumberOfValues(); i++)
+        names.push_back(KnobConfigs.Value(i));
+
+    if (!KnobConfigFile.Value().empty() &&
+        !ReadConfigFile(KnobConfigFile.Value(), names)) {
+        cerr << "Error: could not open " << KnobConfigFile.Value() << endl;
+        return false;
+    }
+
+    for (UINT32 i = 0; i < names.size(); i++) {
+        CACHE_CONFIG config;
+        if (names[i].empty())
+            continue;
+        if (!config.Parse(names[i])) {
+            cerr << "Error: invalid cache configuration " << names[i] << endl;
+            return false;
+        }
+        configs.push_back(config);
+    }
+    return true;
+}
+
 int main(int argc, char *argv[])
 {
     PIN_InitSymbols();
@@ -145,17 +1132,268 @@ int main(int argc, char *argv[])
     if(PIN_Init(argc,argv))
         return Usage();
 
-    // Open output file
-    outFile.open(KnobOutputFile.Value().c_str());
+    std::vector<CACHE_CONFIG> configs;
+    if (!ReadConfigs(configs))
+        return Usage();
+    multi_config = !configs.empty();
+
+    for (UINT32 i = 0; i < KnobStackDistance.NumberOfValues(); i++) {
+        STACK_DISTANCE_CONFIG config;
+        if (KnobStackDistance.Value(i).empty())
+            continue;
+        if (!config.Parse(KnobStackDistance.Value(i))) {
+            cerr << "Error: invalid stack distance geometry " << KnobStackDistance.Value(i) << endl;
+            return Usage();
+        }
+        analyzers.push_back(NewStackDistanceSim(config, KnobStackDistanceMaxAssoc.Value()));
+    }
+
+    if (!KnobRecord.Value().empty()) {
+        trace_writer = new TRACE_WRITER();
+        if (!trace_writer->Open(KnobRecord.Value())) {
+            cerr << "Error: could not open " << KnobRecord.Value() << endl;
+            return 1;
+        }
+    }
+
+    buffered = KnobBuffered.Value() || multi_config || !analyzers.empty() ||
+               trace_writer;
+
+    UINT64 simpointInterval = 0;
+    if (!KnobSimPoints.Value().empty() &&
+        !ReadSimPoints(KnobSimPoints.Value(), simpoints, simpointInterval)) {
+        cerr << "Error: could not read " << KnobSimPoints.Value() << ".simpoints/.weights" << endl;
+        return 1;
+    }
+    if (simpointInterval && simpointInterval != KnobBbvInterval.Value()) {
+        cerr << "Error: " << KnobSimPoints.Value() << ".simpoints has intervals of "
+             << simpointInterval << " instructions, not -bbv_interval " << KnobBbvInterval.Value() << endl;
+        return Usage();
+    }
+    if (KnobBbvProfile.Value() + KnobSample.Value() + !simpoints.empty() > 1) {
+        cerr << "Error: -bbv_profile, -sample and -simpoints are exclusive" << endl;
+        return Usage();
+    }
+    if (KnobBbvInterval.Value() == 0) {
+        cerr << "Error: -bbv_interval must be positive" << endl;
+        return Usage();
+    }
+    if (KnobBbvProfile.Value())
+        bbv_profiler = new BBV_PROFILER(KnobBbvInterval.Value());
+
+    sampling = KnobSample.Value() || !simpoints.empty();
+    if ((sampling || bbv_profiler) && buffered) {
+        cerr << "Error: -sample, -simpoints and -bbv_profile do not combine with -buffered, -cfg, -sdist or -record" << endl;
+        return Usage();
+    }
+    if (KnobSample.Value() && (KnobSampleWindow.Value() == 0 ||
+                     KnobSampleWindow.Value() + KnobSampleWarming.Value() > KnobSamplePeriod.Value())) {
+        cerr << "Error: -sample_window + -sample_warming must be positive and at most -sample_period" << endl;
+        return Usage();
+    }
+
+    num_cores = KnobCores.Value();
+    if (num_cores && (buffered || sampling || bbv_profiler)) {
+        cerr << "Error: -cores is a live mode, it does not combine with -buffered, -cfg, -sdist, -record, -sample, -simpoints or -bbv_profile" << endl;
+        return Usage();
+    }
+    fetching = KnobL1ICacheSize.Value() != 0;
+    if (fetching && (buffered || num_cores)) {
+        cerr << "Error: -L1Ic is simulated live, it does not combine with -buffered, -cfg, -sdist, -record or -cores" << endl;
+        return Usage();
+    }
+    if (num_cores > MULTI_CORE_CACHE<CACHE_SET_T>::MAX_CORES) {
+        cerr << "Error: -cores is at most " << MULTI_CORE_CACHE<CACHE_SET_T>::MAX_CORES << endl;
+        return Usage();
+    }
+
+    if (!multi_config) {
+        CACHE_CONFIG config = CACHE_CONFIG();
+        config.l1Size = KnobL1CacheSize.Value();
+        config.l1Assoc = KnobL1Associativity.Value();
+        config.l1Block = KnobL1BlockSize.Value();
+        config.l2Size = KnobL2CacheSize.Value();
+        config.l2Assoc = KnobL2Associativity.Value();
+        config.l2Block = KnobL2BlockSize.Value();
+        config.l3Size = KnobL3CacheSize.Value();
+        config.l3Assoc = KnobL3Associativity.Value();
+        config.l3Block = KnobL3BlockSize.Value();
+        config.l1iSize = KnobL1ICacheSize.Value();
+        config.l1iAssoc = KnobL1IAssociativity.Value();
+        config.l1iBlock = KnobL1IBlockSize.Value();
+        configs.push_back(config);
+
+        // Open output file
+        outFile.open(KnobOutputFile.Value().c_str());
+    }
+
+    PREFETCHER::KIND l1Prefetch, l2Prefetch;
+    if (!PREFETCHER::Parse(KnobL1Prefetch.Value(), l1Prefetch) ||
+        !PREFETCHER::Parse(KnobL2Prefetch.Value(), l2Prefetch)) {
+        cerr << "Error: the prefetchers are none, next_line, stride or stream" << endl;
+        return Usage();
+    }
+    for (UINT32 i = 0; i < configs.size(); i++) {
+        configs[i].l1Prefetch = l1Prefetch;
+        configs[i].l2Prefetch = l2Prefetch;
+        configs[i].prefetchDegree = KnobPrefetchDegree.Value();
+        configs[i].prefetchDistance = KnobPrefetchDistance.Value();
+    }
+    if (num_cores && configs[0].Prefetching()) {
+        cerr << "Error: -cores does not model prefetchers" << endl;
+        return Usage();
+    }
+
+    TLB_CONFIG tlb;
+    memset(&tlb, 0, sizeof(tlb));
+    if (KnobTlb.Value() && !tlb.Parse(KnobTlbGeometry.Value())) {
+        cerr << "Error: -tlb_geometry is <entries>_<assoc> x3, with power of 2 sets" << endl;
+        return Usage();
+    }
+    for (UINT32 i = 0; i < KnobThp.NumberOfValues(); i++) {
+        if (KnobThp.Value(i).empty())
+            continue;
+        if (!KnobTlb.Value() || !tlb.AddHugeRange(KnobThp.Value(i))) {
+            cerr << "Error: -thp takes <start>-<end> in hex or all, at most "
+                 << TLB_MAX_HUGE_RANGES << " times, with -tlb" << endl;
+            return Usage();
+        }
+    }
+    if (num_cores && tlb.Enabled()) {
+        cerr << "Error: -cores does not model TLBs" << endl;
+        return Usage();
+    }
+    for (UINT32 i = 0; i < configs.size(); i++)
+        configs[i].tlb = tlb;
 
-    // Initialize two level cache
-    two_level_cache = new CACHE_T("Two level cache hierarchy",
-                                  KnobL1CacheSize.Value() * KILO,
-                                  KnobL1BlockSize.Value(),
-                                  KnobL1Associativity.Value(),
-                                  KnobL2CacheSize.Value() * KILO,
-                                  KnobL2BlockSize.Value(),
-                                  KnobL2Associativity.Value());
+    WRITE_CONFIG writes;
+    memset(&writes, 0, sizeof(writes));
+    writes.storeAllocate = KnobStoreAllocate.Value();
+    writes.bufferEntries = KnobWriteBuffer.Value();
+    if (!WRITE_CONFIG::ParsePolicy(KnobL1Write.Value(), writes.l1Policy) ||
+        !WRITE_CONFIG::ParsePolicy(KnobL2Write.Value(), writes.l2Policy)) {
+        cerr << "Error: the write policies are wb or wt" << endl;
+        return Usage();
+    }
+    if (writes.bufferEntries > WRITE_BUFFER::MAX_ENTRIES) {
+        cerr << "Error: -write_buffer is at most " << WRITE_BUFFER::MAX_ENTRIES << endl;
+        return Usage();
+    }
+    writes.enabled = KnobTraffic.Value() || !writes.storeAllocate ||
+        writes.l1Policy != WRITE_BACK || writes.l2Policy != WRITE_BACK;
+    if (writes.enabled && num_cores) {
+        cerr << "Error: -traffic, -store_allocate and the write policies do not model -cores" << endl;
+        return Usage();
+    }
+    for (UINT32 i = 0; i < configs.size(); i++)
+        configs[i].writes = writes;
+    INCLUSION inclusion;
+    memset(&inclusion, 0, sizeof(inclusion));
+    if (!KnobInclusion.Value().empty()) {
+        inclusion.enabled = true;
+        if (!INCLUSION::Parse(KnobInclusion.Value(), inclusion.kind)) {
+            cerr << "Error: -inclusion is inclusive, exclusive or nine" << endl;
+            return Usage();
+        }
+    }
+    if (num_cores && inclusion.Kind() != INCLUSION::INCLUSIVE) {
+        cerr << "Error: -cores only models an inclusive L2" << endl;
+        return Usage();
+    }
+    for (UINT32 i = 0; i < configs.size(); i++) {
+        if (inclusion.Kind() == INCLUSION::EXCLUSIVE &&
+            (configs[i].l1Block != configs[i].l2Block || configs[i].l3Size ||
+             configs[i].Prefetching())) {
+            cerr << "Error: an exclusive L2 needs the L1 block size, no L3 and no prefetchers" << endl;
+            return Usage();
+        }
+        configs[i].inclusion = inclusion;
+    }
+    REPLACEMENT::KIND l1Replacement, l2Replacement;
+    if (!REPLACEMENT::Parse(KnobL1Policy.Value(), l1Replacement) ||
+        !REPLACEMENT::Parse(KnobL2Policy.Value(), l2Replacement)) {
+        cerr << "Error: -L1policy and -L2policy are lru, random, lfu, lrfu, plru, nru, srrip, brrip, drrip, ship or hawkeye" << endl;
+        return Usage();
+    }
+    for (UINT32 i = 0; i < configs.size(); i++) {
+        configs[i].l1Replacement = l1Replacement;
+        configs[i].l2Replacement = l2Replacement;
+        if (configs[i].OtherReplacement(REPLACEMENT_OF<CACHE_SET_T>::KIND) &&
+            (num_cores || configs[i].l3Size)) {
+            cerr << "Error: -L1policy and -L2policy do not model -cores or L3 configurations" << endl;
+            return Usage();
+        }
+        if (!configs[i].ValidReplacement(REPLACEMENT_OF<CACHE_SET_T>::KIND)) {
+            cerr << "Error: the replacement policy of a level does not support its associativity"
+                 << " (plru: a power of 2 up to 64, nru: up to 64, lru: up to 256, lfu and lrfu: up to 254)" << endl;
+            return Usage();
+        }
+    }
+    for (UINT32 i = 0; i < configs.size(); i++)
+        if (configs[i].l3Size && num_cores) {
+            cerr << "Error: L3 configurations do not model -cores" << endl;
+            return Usage();
+        }
+    if (KnobPcProfile.Value() && (buffered || sampling || bbv_profiler || num_cores)) {
+        cerr << "Error: -pc_profile is simulated live, it does not combine with -buffered, -cfg, -sdist, -record, -sample, -simpoints, -bbv_profile or -cores" << endl;
+        return Usage();
+    }
+    if (KnobPcProfile.Value() &&
+        (KnobPcProfilePcs.Value() == 0 || KnobPcProfilePcs.Value() > PC_PROFILE::MAX_PCS)) {
+        cerr << "Error: -pc_profile_pcs is 1 to " << PC_PROFILE::MAX_PCS << endl;
+        return Usage();
+    }
+    if (KnobMlpWindow.Value() && (buffered || sampling || bbv_profiler || num_cores)) {
+        cerr << "Error: -mlp_window is simulated live, it does not combine with -buffered, -cfg, -sdist, -record, -sample, -simpoints, -bbv_profile or -cores" << endl;
+        return Usage();
+    }
+    if (KnobMlpWindow.Value() &&
+        (!KnobL1Mshrs.Value() || KnobL1Mshrs.Value() > MSHR_FILE::MAX_ENTRIES ||
+         !KnobL2Mshrs.Value() || KnobL2Mshrs.Value() > MSHR_FILE::MAX_ENTRIES)) {
+        cerr << "Error: -l1_mshrs and -l2_mshrs are 1 to " << MSHR_FILE::MAX_ENTRIES << endl;
+        return Usage();
+    }
+    if (fetching && !configs[0].Valid()) {
+        cerr << "Error: the -L1I? geometry needs power of 2 sets and blocks, within the L2's" << endl;
+        return Usage();
+    }
+
+    // Initialize the two level cache(s)
+    if (buffered) {
+        for (UINT32 i = 0; i < configs.size(); i++) {
+            CACHE_SIM_FACTORY factory(configs[i]);
+            VisitReplacementType<CACHE_SET_T>(configs[i], factory);
+            sims.push_back(factory.sim);
+        }
+    } else if (num_cores) {
+        core_counters = AlignedAlloc<CORE_COUNTERS>(num_cores);
+        memset(core_counters, 0, num_cores * sizeof(CORE_COUNTERS));
+        MULTI_CORE_BINDER binder(configs[0]);
+        VisitCacheType<CACHE_SET_T>(configs[0], binder);
+        PIN_AddThreadStartFunction(ThreadStart, 0);
+    } else {
+        if (KnobMlpWindow.Value())
+            mlp_core = new NON_BLOCKING_CORE(KnobMlpWindow.Value(),
+                                             KnobL1Mshrs.Value(), KnobL2Mshrs.Value(),
+                                             FloorLog2(configs[0].l1Block),
+                                             FloorLog2(configs[0].l2Block));
+        if (KnobPcProfile.Value())
+            pc_profile = new PC_PROFILE(KnobPcProfilePcs.Value());
+        LIVE_BINDER binder(configs[0]);
+        VisitReplacementType<CACHE_SET_T>(configs[0], binder);
+    }
+
+    if (buffered) {
+        PIN_InitLock(&ring_lock);
+        memref_buffer = PIN_DefineTraceBuffer(sizeof(MEMREF), KnobBufferPages.Value(),
+                                              BufferFull, 0);
+        if (memref_buffer == BUFFER_ID_INVALID) {
+            cerr << "Error: could not allocate the memory reference buffer" << endl;
+            return 1;
+        }
+        StartWorkers();
+        PIN_AddPrepareForFiniFunction(PrepareForFini, 0);
+    }
 
     // Instrument function calls in order to catch __parsec_roi_{begin,end}
     RTN_AddInstrumentFunction(Routine, 0);
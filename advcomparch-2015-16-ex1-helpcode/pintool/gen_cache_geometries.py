@@ -0,0 +1,72 @@
+#!/usr/bin/env python
+
+## Generates cache_geometries.h, the table of <L1, L2> geometries for which
+## cslab_cache instantiates a TWO_LEVEL_CACHE with compile-time geometry.
+## Geometries not in the table run on the dynamic (runtime) version.
+##
+## The table holds the tool defaults, the L1 and L2 sweeps of the exercise,
+## and every CONFS triple of the run scripts given on the command line:
+## $ ./gen_cache_geometries.py ../run_l1.sh > cache_geometries.h
+
+from __future__ import print_function
+
+import re
+import sys
+
+## <size_KB>_<assoc>_<block_size> triples
+DEFAULT_L1 = "32_8_64"
+DEFAULT_L2 = "256_8_64"
+
+L1_SWEEP = ("16_4_32 16_4_64 16_4_128 32_4_32 32_4_64 32_4_128 32_8_64 "
+            "64_4_32 64_4_64 64_4_128 64_8_64 128_8_64").split()
+L1_SWEEP_L2 = "1024_8_128"
+
+L2_SWEEP = ("256_4_128 512_4_128 512_8_64 512_8_128 512_8_256 1024_8_64 "
+            "1024_8_128 1024_8_256 1024_16_128 2048_8_64 2048_8_128 "
+            "2048_8_256 2048_16_128").split()
+L2_SWEEP_L1 = "32_8_64"
+
+def triple(conf):
+	return tuple(int(x) for x in conf.split('_'))
+
+def script_geometries(path):
+	text = open(path).read()
+	confs = re.search(r'^CONFS="([^"]*)"', text, re.M)
+	l2 = [re.search(r'^L2%s=(\d+)' % k, text, re.M) for k in ("size", "assoc", "bsize")]
+	if not confs or None in l2:
+		return []
+	l2conf = tuple(int(m.group(1)) for m in l2)
+	return [(triple(c), l2conf) for c in confs.group(1).split()]
+
+def valid(l1, l2):
+	def sets(c):
+		return (c[0] * 1024) // (c[1] * c[2])
+	pow2 = lambda n: n > 0 and (n & (n - 1)) == 0
+	return (pow2(l1[2]) and pow2(l2[2]) and pow2(sets(l1)) and pow2(sets(l2))
+	        and l1[0] <= l2[0] and l1[2] <= l2[2])
+
+geometries = [(triple(DEFAULT_L1), triple(DEFAULT_L2))]
+geometries += [(triple(c), triple(L1_SWEEP_L2)) for c in L1_SWEEP]
+geometries += [(triple(L2_SWEEP_L1), triple(c)) for c in L2_SWEEP]
+for script in sys.argv[1:]:
+	geometries += script_geometries(script)
+
+seen = set()
+table = []
+for g in geometries:
+	if g not in seen and valid(*g):
+		seen.add(g)
+		table.append(g)
+
+print("/* Generated by gen_cache_geometries.py -- do not edit. */")
+print("#ifndef CACHE_GEOMETRIES_H")
+print("#define CACHE_GEOMETRIES_H")
+print("")
+print("/**")
+print(" * X(l1SizeKB, l1Assoc, l1BlockSize, l2SizeKB, l2Assoc, l2BlockSize)")
+print(" **/")
+print("#define CACHE_GEOMETRY_TABLE(X) \\")
+for l1, l2 in table:
+	print("    X(%4d, %2d, %3d, %4d, %2d, %3d) \\" % (l1 + l2))
+print("")
+print("#endif // CACHE_GEOMETRIES_H")
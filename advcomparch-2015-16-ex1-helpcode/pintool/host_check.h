@@ -0,0 +1,23 @@
+#ifndef HOST_CHECK_H
+#define HOST_CHECK_H
+
+/**
+ * What the host checks and benchmarks (check_*, bench_*) share: their
+ * random streams and the geometry of the small hierarchies they drive.
+ * Include it after cache.h.
+ **/
+
+// Small caches, so that the L2 evicts (and back invalidates) often
+static const UINT32 L1_SIZE = 4 * KILO, L1_BLOCK = 64, L1_ASSOC = 4;
+static const UINT32 L2_SIZE = 32 * KILO, L2_BLOCK = 128, L2_ASSOC = 8;
+
+// xorshift64: cheap and reproducible, `state` must not be 0
+static inline UINT64 Rand64(UINT64 &state)
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+#endif // HOST_CHECK_H
@@ -0,0 +1,242 @@
+#ifndef MLP_H
+#define MLP_H
+
+/**
+ * Non-blocking memory timing for cslab_cache (-mlp_window). Include after
+ * cache.h.
+ *
+ * The cache model itself is blocking: Access() returns the full latency
+ * of a request, as if the core waited for it. NON_BLOCKING_CORE turns
+ * those latencies into stalls the way an out-of-order core with
+ * non-blocking caches would. A request that misses L1 (as the hierarchy's
+ * ServedBy() tells) takes an L1 MSHR until its data arrives, and one that
+ * also misses L2 takes an L2 MSHR.
+ * The core keeps running meanwhile, so independent misses overlap. It
+ * stalls only:
+ *  - when the MSHRs of a level are all busy, until the first one frees;
+ *  - when it gets `window` instructions past a miss still in flight, as
+ *    a full reorder buffer would, until that miss completes.
+ * Requests to a line already in flight (secondary misses) merge into its
+ * MSHR and wait for the same fill. L1 hits stay serial, as in the
+ * blocking model. The memory-level parallelism (MLP) is the average
+ * number of misses in flight over the cycles with at least one.
+ **/
+
+// Miss status holding registers of one cache level
+class MSHR_FILE
+{
+    public:
+    static const UINT32 MAX_ENTRIES = 64;
+
+    private:
+    ADDRINT _line[MAX_ENTRIES];
+    UINT64 _ready[MAX_ENTRIES];  // cycle the fill completes, the entry is free after
+    UINT32 _entries;
+    UINT32 _lineShift;
+
+    public:
+    CACHE_STATS allocated, merged, fullStalls, fullStallCycles;
+
+    VOID Init(UINT32 entries, UINT32 lineShift)
+    {
+        ASSERTX(entries > 0 && entries <= MAX_ENTRIES);
+        _entries = entries;
+        _lineShift = lineShift;
+        for (UINT32 i = 0; i < _entries; i++)
+            _ready[i] = 0;
+        allocated = merged = fullStalls = fullStallCycles = 0;
+    }
+
+    // When the fill of `addr`'s line completes if it is in flight at `now`, 0 otherwise
+    UINT64 InFlight(ADDRINT addr, UINT64 now) const
+    {
+        const ADDRINT line = addr >> _lineShift;
+        for (UINT32 i = 0; i < _entries; i++)
+            if (_ready[i] > now && _line[i] == line)
+                return _ready[i];
+        return 0;
+    }
+
+    /**
+     * Takes an MSHR for `addr`'s line, first stalling `now` until one is
+     * free. Returns the entry, whose completion the caller sets.
+     **/
+    UINT32 Allocate(ADDRINT addr, UINT64 &now)
+    {
+        UINT32 first = 0;
+        for (UINT32 i = 1; i < _entries; i++)
+            if (_ready[i] < _ready[first])
+                first = i;
+        if (_ready[first] > now) {
+            fullStalls++;
+            fullStallCycles += _ready[first] - now;
+            now = _ready[first];
+        }
+        allocated++;
+        _line[first] = addr >> _lineShift;
+        return first;
+    }
+
+    UINT32 Entries() const { return _entries; }
+
+    VOID SetReady(UINT32 entry, UINT64 ready) { _ready[entry] = ready; }
+
+    // When the last fill in flight completes
+    UINT64 LastReady() const
+    {
+        UINT64 last = 0;
+        for (UINT32 i = 0; i < _entries; i++)
+            last = std::max(last, _ready[i]);
+        return last;
+    }
+};
+
+class NON_BLOCKING_CORE
+{
+    private:
+    MSHR_FILE _l1, _l2;
+    UINT32 _window;
+    UINT32 _hitLatency;
+
+    UINT64 _instructions;
+    // Oldest miss in flight: the core stalls at instruction _stallAt
+    // until cycle _stallUntil
+    UINT64 _stallAt, _stallUntil;
+    UINT64 _issued[MSHR_FILE::MAX_ENTRIES]; // per L1 MSHR, its miss' instruction
+    UINT64 _readyAt[MSHR_FILE::MAX_ENTRIES];
+
+    CACHE_STATS _windowStalls, _windowStallCycles;
+    CACHE_STATS _missCycles;  // summed over the misses
+    CACHE_STATS _busyCycles;  // with at least one miss in flight
+    UINT64 _busyUntil;
+
+    static const UINT64 NEVER = ~0ULL;
+
+    // Finds the oldest miss still in flight at `now`
+    VOID FindOldest(UINT64 now)
+    {
+        _stallAt = NEVER;
+        for (UINT32 i = 0; i < _l1.Entries(); i++)
+            if (_readyAt[i] > now && _issued[i] + _window < _stallAt) {
+                _stallAt = _issued[i] + _window;
+                _stallUntil = _readyAt[i];
+            }
+    }
+
+    VOID WindowStall(UINT64 &now)
+    {
+        if (_stallUntil > now) {
+            _windowStalls++;
+            _windowStallCycles += _stallUntil - now;
+            now = _stallUntil;
+        }
+        FindOldest(now);
+    }
+
+    public:
+    /**
+     * `l1Mshrs` and `l2Mshrs` for lines of 2^`l1LineShift` and
+     * 2^`l2LineShift` bytes. A secondary miss takes at least `hitLatency`.
+     **/
+    NON_BLOCKING_CORE(UINT32 window, UINT32 l1Mshrs, UINT32 l2Mshrs,
+                      UINT32 l1LineShift, UINT32 l2LineShift, UINT32 hitLatency = 1)
+        : _window(window), _hitLatency(hitLatency),
+          _instructions(0), _stallAt(NEVER), _stallUntil(0),
+          _windowStalls(0), _windowStallCycles(0), _missCycles(0), _busyCycles(0),
+          _busyUntil(0)
+    {
+        _l1.Init(l1Mshrs, l1LineShift);
+        _l2.Init(l2Mshrs, l2LineShift);
+        for (UINT32 i = 0; i < l1Mshrs; i++)
+            _readyAt[i] = 0;
+    }
+
+    // One instruction retires, a cycle after the previous one
+    VOID Retire(UINT64 &now)
+    {
+        _instructions++;
+        now++;
+        if (_instructions >= _stallAt)
+            WindowStall(now);
+    }
+
+    /**
+     * A request to `addr` that the blocking model serves in `latency`
+     * cycles from level `servedBy` (1 for L1, 2 for L2, more below L2, as
+     * the hierarchy's ServedBy()). The latency of an L1 hit, TLB walk or
+     * late prefetch included, stalls the core.
+     **/
+    VOID Access(ADDRINT addr, UINT32 latency, UINT32 servedBy, UINT64 &now)
+    {
+        // Secondary miss: the data comes with the line in flight
+        if (_l1.InFlight(addr, now)) {
+            _l1.merged++;
+            return;
+        }
+        if (servedBy == 1) {
+            now += latency;
+            return;
+        }
+
+        const UINT32 entry = _l1.Allocate(addr, now);
+        UINT64 ready = now + latency;
+        if (servedBy > 2) {
+            const UINT64 l2Ready = _l2.InFlight(addr, now);
+            if (l2Ready) {
+                _l2.merged++;
+                ready = std::max(now + _hitLatency, l2Ready);
+            } else {
+                _l2.SetReady(_l2.Allocate(addr, now), now + latency);
+                ready = now + latency;
+            }
+        }
+        _l1.SetReady(entry, ready);
+        _issued[entry] = _instructions;
+        _readyAt[entry] = ready;
+        if (_instructions + _window < _stallAt) {
+            _stallAt = _instructions + _window;
+            _stallUntil = ready;
+        }
+
+        _missCycles += ready - now;
+        _busyCycles += ready - std::max(now, std::min(_busyUntil, ready));
+        _busyUntil = std::max(_busyUntil, ready);
+    }
+
+    // The end of the run: waits for the misses in flight
+    VOID Drain(UINT64 &now)
+    {
+        now = std::max(now, std::max(_l1.LastReady(), _l2.LastReady()));
+        _stallAt = NEVER;
+    }
+
+    double Mlp() const { return _busyCycles ? (double)_missCycles / _busyCycles : 0.0; }
+
+    string StatsLong(const string &prefix) const
+    {
+        const UINT32 headerWidth = 24;
+        const UINT32 numberWidth = 14;
+        string out;
+        out += prefix + "Non-blocking Stats:\n";
+        out += prefix + ljstr("Window:", headerWidth) + dec2str(_window, numberWidth) + "\n";
+        out += prefix + ljstr("L1-MSHRs:", headerWidth) + dec2str(_l1.Entries(), numberWidth) + "\n";
+        out += prefix + ljstr("L1-MSHR-Misses:", headerWidth) + dec2str(_l1.allocated, numberWidth) + "\n";
+        out += prefix + ljstr("L1-MSHR-Merged:", headerWidth) + dec2str(_l1.merged, numberWidth) + "\n";
+        out += prefix + ljstr("L1-MSHR-Full-Cycles:", headerWidth)
+            + dec2str(_l1.fullStallCycles, numberWidth) + "\n";
+        out += prefix + ljstr("L2-MSHR-Misses:", headerWidth) + dec2str(_l2.allocated, numberWidth) + "\n";
+        out += prefix + ljstr("L2-MSHR-Merged:", headerWidth) + dec2str(_l2.merged, numberWidth) + "\n";
+        out += prefix + ljstr("L2-MSHR-Full-Cycles:", headerWidth)
+            + dec2str(_l2.fullStallCycles, numberWidth) + "\n";
+        out += prefix + ljstr("Window-Stalls:", headerWidth)
+            + dec2str(_windowStalls, numberWidth) + "\n";
+        out += prefix + ljstr("Window-Stall-Cycles:", headerWidth)
+            + dec2str(_windowStallCycles, numberWidth) + "\n";
+        out += prefix + ljstr("Miss-Busy-Cycles:", headerWidth) + dec2str(_busyCycles, numberWidth) + "\n";
+        out += prefix + ljstr("MLP:", headerWidth) + fltstr(Mlp(), 3, numberWidth) + "\n";
+        out += prefix + "\n";
+        return out;
+    }
+};
+
+#endif // MLP_H
@@ -0,0 +1,129 @@
+#ifndef PC_PROFILE_H
+#define PC_PROFILE_H
+
+/**
+ * Per instruction miss attribution for cslab_cache (-pc_profile). Include
+ * after cache.h.
+ *
+ * Every instruction with memory references gets a static id when it is
+ * instrumented, from an open addressing table of its address sized for
+ * `maxPcs` instructions up front. The analysis routines receive the id as
+ * an argument, so counting a reference is an increment of a preallocated
+ * array entry, with no lookup. Instructions beyond `maxPcs` share id 0.
+ * The report ranks the instructions by L2 misses, then L1 misses, and
+ * names them by their source location (the tool does that at Fini).
+ **/
+
+#include <vector>
+#include <algorithm>
+
+class PC_PROFILE
+{
+    public:
+    static const UINT32 MAX_PCS = 1 << 24;
+
+    struct COUNTS
+    {
+        CACHE_STATS accesses, l1Misses, l2Misses;
+    };
+
+    private:
+    UINT32 *_slots;   // ids by address hash, 0 for empty
+    UINT32 _slotMask;
+    ADDRINT *_pcs;    // per id
+    COUNTS *_counts;  // per id
+    UINT32 _maxPcs;
+    UINT32 _numPcs;   // ids in use, besides 0
+
+    UINT32 Slot(ADDRINT pc) const
+    {
+        return (UINT32)((pc * 0x9e3779b97f4a7c15ULL) >> 32) & _slotMask;
+    }
+
+    // Whether id `a` ranks before id `b`
+    bool Before(UINT32 a, UINT32 b) const
+    {
+        if (_counts[a].l2Misses != _counts[b].l2Misses)
+            return _counts[a].l2Misses > _counts[b].l2Misses;
+        if (_counts[a].l1Misses != _counts[b].l1Misses)
+            return _counts[a].l1Misses > _counts[b].l1Misses;
+        return _counts[a].accesses > _counts[b].accesses;
+    }
+
+    struct RANK
+    {
+        const PC_PROFILE &profile;
+        RANK(const PC_PROFILE &p) : profile(p) {}
+        bool operator()(UINT32 a, UINT32 b) const { return profile.Before(a, b); }
+    };
+
+    public:
+    PC_PROFILE(UINT32 maxPcs) : _maxPcs(maxPcs), _numPcs(0)
+    {
+        ASSERTX(maxPcs > 0 && maxPcs <= MAX_PCS);
+        // At most half full, so that probes stay short
+        UINT32 slots = 1;
+        while (slots < 2 * maxPcs)
+            slots <<= 1;
+        _slotMask = slots - 1;
+        _slots = new UINT32[slots];
+        memset(_slots, 0, slots * sizeof(UINT32));
+        _pcs = new ADDRINT[maxPcs + 1];
+        _counts = new COUNTS[maxPcs + 1];
+        memset(_pcs, 0, (maxPcs + 1) * sizeof(ADDRINT));
+        memset(_counts, 0, (maxPcs + 1) * sizeof(COUNTS));
+    }
+
+    ~PC_PROFILE()
+    {
+        delete [] _slots;
+        delete [] _pcs;
+        delete [] _counts;
+    }
+
+    // Id of the instruction at `pc` (at instrumentation time)
+    UINT32 Id(ADDRINT pc)
+    {
+        UINT32 slot = Slot(pc);
+        for (; _slots[slot]; slot = (slot + 1) & _slotMask)
+            if (_pcs[_slots[slot]] == pc)
+                return _slots[slot];
+        if (_numPcs == _maxPcs)
+            return 0;
+        _numPcs++;
+        _slots[slot] = _numPcs;
+        _pcs[_numPcs] = pc;
+        return _numPcs;
+    }
+
+    // A reference of instruction `id` that missed `l1Misses` and `l2Misses` times
+    VOID Count(UINT32 id, CACHE_STATS l1Misses, CACHE_STATS l2Misses)
+    {
+        COUNTS &counts = _counts[id];
+        counts.accesses++;
+        counts.l1Misses += l1Misses;
+        counts.l2Misses += l2Misses;
+    }
+
+    UINT32 NumPcs() const { return _numPcs; }
+    ADDRINT Pc(UINT32 id) const { return _pcs[id]; }
+    const COUNTS &Counts(UINT32 id) const { return _counts[id]; }
+
+    // The references of the instructions that did not fit
+    const COUNTS &Overflow() const { return _counts[0]; }
+
+    // The ids of the (at most) `n` top ranked instructions that missed L1
+    std::vector<UINT32> Top(UINT32 n) const
+    {
+        std::vector<UINT32> ids;
+        for (UINT32 id = 1; id <= _numPcs; id++)
+            if (_counts[id].l1Misses)
+                ids.push_back(id);
+        n = std::min<UINT32>(n, ids.size());
+        std::partial_sort(ids.begin(), ids.begin() + n, ids.end(), RANK(*this));
+        ids.resize(n);
+        return ids;
+    }
+};
+
+#endif // PC_PROFILE_H
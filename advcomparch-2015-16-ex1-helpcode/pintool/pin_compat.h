@@ -0,0 +1,68 @@
+#ifndef PIN_COMPAT_H
+#define PIN_COMPAT_H
+
+/**
+ * Minimal stand-ins for the pin.H types and helpers that cache.h uses, so
+ * that the cache model can be compiled into Pin-free host programs
+ * (microbenchmarks, trace replay). Include this instead of pin.H.
+ **/
+
+#include <stdint.h>
+#include <cassert>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+
+using namespace std;
+
+typedef uint8_t  UINT8;
+typedef uint16_t UINT16;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+typedef int8_t   INT8;
+typedef int16_t  INT16;
+typedef int32_t  INT32;
+typedef int64_t  INT64;
+typedef double   FLT64;
+typedef char     CHAR;
+typedef bool     BOOL;
+typedef void     VOID;
+typedef uintptr_t ADDRINT;
+
+#define ASSERTX(x) assert(x)
+
+/**
+ * Left justifies `s` in a field of `width` characters
+ **/
+static inline string ljstr(const string &s, UINT32 width, CHAR padding = ' ')
+{
+    string str(s);
+    if (str.size() < width)
+        str.append(width - str.size(), padding);
+    return str;
+}
+
+/**
+ * Formats a floating point number with `prec` decimals, right justified in
+ * a field of `width` characters
+ **/
+static inline string fltstr(FLT64 v, UINT32 prec = 0, UINT32 width = 0)
+{
+    ostringstream o;
+    o << std::fixed << std::setprecision(prec) << std::setw(width) << v;
+    return o.str();
+}
+
+/**
+ * Formats `v` in hex with a 0x prefix, zero padded to `width` digits
+ **/
+static inline string hexstr(UINT64 v, UINT32 width = 0)
+{
+    ostringstream o;
+    o << "0x" << std::hex << std::setfill('0') << std::setw(width) << v;
+    return o.str();
+}
+
+#endif // PIN_COMPAT_H
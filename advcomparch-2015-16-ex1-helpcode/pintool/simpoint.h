@@ -0,0 +1,373 @@
+#ifndef SIMPOINT_H
+#define SIMPOINT_H
+
+/**
+ * Basic block vector (BBV) profiling and SimPoint-style selection of
+ * representative intervals, used by cslab_cache and cslab_branch
+ * (-bbv_profile writes the profile and the picks, -simpoints simulates
+ * the picked intervals only). Include after pin.H (or pin_compat.h).
+ *
+ * The ROI is cut in intervals of a fixed number of instructions, and the
+ * BBV of an interval counts the instructions executed in each basic block.
+ * Intervals with similar BBVs execute the same code, so they are expected
+ * to behave alike on the simulated hardware. The normalized BBVs are
+ * randomly projected down to a few dimensions and clustered with k-means;
+ * k is picked with the BIC as SimPoint does. The interval closest to each
+ * centroid represents its cluster, weighted by the cluster's share of the
+ * instructions.
+ *
+ * Files use the SimPoint 3 formats: <prefix>.bb has one "T:id:count ..."
+ * line per interval (block ids from 1), <prefix>.simpoints has
+ * "<interval> <cluster>" lines and <prefix>.weights "<weight> <cluster>"
+ * lines. The .simpoints written here start with a "# interval <size>"
+ * line, so that -simpoints can check it runs intervals of the size that
+ * was profiled; files without it (e.g. from SimPoint itself) are taken
+ * at -bbv_interval.
+ **/
+
+#include <map>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+
+// (block id, instructions) pairs of one interval
+typedef std::vector<std::pair<UINT32, UINT64> > BBV;
+
+class BBV_PROFILER
+{
+    private:
+    std::map<ADDRINT, UINT32> _ids;
+    std::vector<UINT64> _counts;  // per block, in the current interval
+    std::vector<UINT32> _touched; // blocks with non-zero _counts
+    std::vector<BBV> _intervals;
+    std::vector<UINT64> _lengths; // instructions of each interval
+    const UINT64 _intervalSize;
+    UINT64 _current;              // instructions of the current interval
+
+    public:
+    BBV_PROFILER(UINT64 intervalSize) : _intervalSize(intervalSize), _current(0) {}
+
+    // Id of the basic block at `addr` (at instrumentation time)
+    UINT32 BlockId(ADDRINT addr)
+    {
+        std::map<ADDRINT, UINT32>::iterator it = _ids.find(addr);
+        if (it != _ids.end())
+            return it->second;
+        _counts.push_back(0);
+        return _ids[addr] = _counts.size() - 1;
+    }
+
+    // Counts an execution of a block; true when the interval is complete
+    bool Count(UINT32 id, UINT32 numInstructions)
+    {
+        if (_counts[id] == 0)
+            _touched.push_back(id);
+        _counts[id] += numInstructions;
+        _current += numInstructions;
+        return _current >= _intervalSize;
+    }
+
+    VOID EndInterval()
+    {
+        if (_current == 0)
+            return;
+        std::sort(_touched.begin(), _touched.end());
+        BBV bbv;
+        bbv.reserve(_touched.size());
+        for (UINT32 i = 0; i < _touched.size(); i++) {
+            bbv.push_back(std::make_pair(_touched[i], _counts[_touched[i]]));
+            _counts[_touched[i]] = 0;
+        }
+        _touched.clear();
+        _intervals.push_back(bbv);
+        _lengths.push_back(_current);
+        _current = 0;
+    }
+
+    const std::vector<BBV> &Intervals() const { return _intervals; }
+    const std::vector<UINT64> &Lengths() const { return _lengths; }
+    UINT64 IntervalSize() const { return _intervalSize; }
+
+    VOID WriteBbv(std::ostream &out) const
+    {
+        for (UINT32 i = 0; i < _intervals.size(); i++) {
+            out << "T";
+            for (UINT32 j = 0; j < _intervals[i].size(); j++)
+                out << ":" << _intervals[i][j].first + 1 << ":" << _intervals[i][j].second << " ";
+            out << "\n";
+        }
+    }
+};
+
+struct SIMPOINT
+{
+    UINT32 interval;
+    UINT32 cluster;
+    double weight;
+
+    bool operator<(const SIMPOINT &other) const { return interval < other.interval; }
+};
+
+namespace SIMPOINT_CLUSTERING
+{
+    typedef std::vector<double> POINT;
+
+    // Deterministic uniform value in [-1, 1) for (block, dimension)
+    static inline double ProjectionWeight(UINT32 block, UINT32 dim, UINT32 seed)
+    {
+        UINT64 x = (UINT64(block) << 32 | dim) ^ (UINT64(seed) * 0x9e3779b97f4a7c15ULL);
+        x ^= x >> 33; x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33; x *= 0xc4ceb9fe1a85ec53ULL;
+        x ^= x >> 33;
+        return (x >> 11) * (2.0 / 9007199254740992.0) - 1.0;
+    }
+
+    static inline double Distance2(const POINT &a, const POINT &b)
+    {
+        double sum = 0;
+        for (UINT32 d = 0; d < a.size(); d++)
+            sum += (a[d] - b[d]) * (a[d] - b[d]);
+        return sum;
+    }
+
+    // Small xorshift generator, so that the picks do not depend on rand()
+    struct RNG
+    {
+        UINT64 state;
+        RNG(UINT64 seed) : state(seed * 0x9e3779b97f4a7c15ULL + 1) {}
+        UINT64 Next() { state ^= state << 13; state ^= state >> 7; state ^= state << 17; return state; }
+        double Uniform() { return (Next() >> 11) * (1.0 / 9007199254740992.0); }
+    };
+
+    /**
+     * k-means with k-means++ seeding. Returns the sum of squared distances
+     * of the points to their centroids.
+     **/
+    static inline double KMeans(const std::vector<POINT> &points, UINT32 k, RNG &rng,
+                                std::vector<POINT> &centroids, std::vector<UINT32> &assignment)
+    {
+        const UINT32 n = points.size();
+        std::vector<double> nearest(n);
+
+        centroids.assign(1, points[rng.Next() % n]);
+        for (UINT32 i = 0; i < n; i++)
+            nearest[i] = Distance2(points[i], centroids[0]);
+        while (centroids.size() < k) {
+            double total = 0;
+            for (UINT32 i = 0; i < n; i++)
+                total += nearest[i];
+            double r = rng.Uniform() * total;
+            UINT32 pick = 0;
+            while (pick + 1 < n && r >= nearest[pick])
+                r -= nearest[pick++];
+            centroids.push_back(points[pick]);
+            for (UINT32 i = 0; i < n; i++)
+                nearest[i] = std::min(nearest[i], Distance2(points[i], centroids.back()));
+        }
+
+        assignment.assign(n, 0);
+        double cost = 0;
+        for (UINT32 iter = 0; iter < 100; iter++) {
+            bool changed = false;
+            cost = 0;
+            for (UINT32 i = 0; i < n; i++) {
+                UINT32 best = 0;
+                double bestDist = Distance2(points[i], centroids[0]);
+                for (UINT32 c = 1; c < k; c++) {
+                    const double dist = Distance2(points[i], centroids[c]);
+                    if (dist < bestDist) {
+                        bestDist = dist;
+                        best = c;
+                    }
+                }
+                changed |= (assignment[i] != best);
+                assignment[i] = best;
+                cost += bestDist;
+            }
+            if (!changed && iter > 0)
+                break;
+
+            std::vector<POINT> sums(k, POINT(points[0].size(), 0));
+            std::vector<UINT32> sizes(k, 0);
+            for (UINT32 i = 0; i < n; i++) {
+                sizes[assignment[i]]++;
+                for (UINT32 d = 0; d < points[i].size(); d++)
+                    sums[assignment[i]][d] += points[i][d];
+            }
+            for (UINT32 c = 0; c < k; c++)
+                if (sizes[c])
+                    for (UINT32 d = 0; d < sums[c].size(); d++)
+                        centroids[c][d] = sums[c][d] / sizes[c];
+        }
+        return cost;
+    }
+
+    // Bayesian information criterion of a clustering (Pelleg & Moore)
+    static inline double Bic(const std::vector<UINT32> &assignment, UINT32 k,
+                             UINT32 dims, double cost)
+    {
+        const double n = assignment.size();
+        if (n <= k)
+            return -HUGE_VAL;
+        const double variance = std::max(cost / (n - k), 1e-12);
+
+        std::vector<UINT32> sizes(k, 0);
+        for (UINT32 i = 0; i < assignment.size(); i++)
+            sizes[assignment[i]]++;
+
+        double logLikelihood = 0;
+        for (UINT32 c = 0; c < k; c++) {
+            const double rc = sizes[c];
+            if (rc == 0)
+                continue;
+            logLikelihood += rc * log(rc) - rc * log(n) - rc / 2 * log(2 * M_PI)
+                - rc * dims / 2 * log(variance) - (rc - k) / 2;
+        }
+        const double parameters = (k - 1) + k * dims + 1;
+        return logLikelihood - parameters / 2 * log(n);
+    }
+}
+
+/**
+ * Picks up to `maxK` representative intervals of `profile`. `dims` is the
+ * dimension of the random projection, `restarts` the k-means runs per k.
+ * Returns them sorted by interval.
+ **/
+static inline std::vector<SIMPOINT> PickSimPoints(const BBV_PROFILER &profile, UINT32 maxK,
+                                                  UINT32 dims = 15, UINT32 restarts = 5,
+                                                  UINT32 seed = 1)
+{
+    using namespace SIMPOINT_CLUSTERING;
+
+    const std::vector<BBV> &intervals = profile.Intervals();
+    const std::vector<UINT64> &lengths = profile.Lengths();
+    const UINT32 n = intervals.size();
+    std::vector<SIMPOINT> picks;
+    if (n == 0)
+        return picks;
+
+    // Project the normalized BBVs
+    std::vector<POINT> points(n, POINT(dims, 0));
+    for (UINT32 i = 0; i < n; i++)
+        for (UINT32 j = 0; j < intervals[i].size(); j++) {
+            const double share = (double)intervals[i][j].second / lengths[i];
+            for (UINT32 d = 0; d < dims; d++)
+                points[i][d] += share * ProjectionWeight(intervals[i][j].first, d, seed);
+        }
+
+    // Cluster for every k, keep the best of the restarts of each
+    RNG rng(seed);
+    std::vector<std::vector<POINT> > bestCentroids(maxK + 1);
+    std::vector<std::vector<UINT32> > bestAssignment(maxK + 1);
+    std::vector<double> bic(maxK + 1, -HUGE_VAL);
+    for (UINT32 k = 1; k <= std::min(maxK, n); k++) {
+        double bestCost = HUGE_VAL;
+        for (UINT32 r = 0; r < restarts; r++) {
+            std::vector<POINT> centroids;
+            std::vector<UINT32> assignment;
+            const double cost = KMeans(points, k, rng, centroids, assignment);
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestCentroids[k] = centroids;
+                bestAssignment[k] = assignment;
+            }
+        }
+        bic[k] = Bic(bestAssignment[k], k, dims, bestCost);
+    }
+
+    // Smallest k whose BIC reaches 90% of the range, as SimPoint
+    double minBic = HUGE_VAL, maxBic = -HUGE_VAL;
+    for (UINT32 k = 1; k <= std::min(maxK, n); k++)
+        if (bic[k] > -HUGE_VAL) {
+            minBic = std::min(minBic, bic[k]);
+            maxBic = std::max(maxBic, bic[k]);
+        }
+    UINT32 k = 1;
+    if (maxBic > minBic)
+        while (k < std::min(maxK, n) && bic[k] < minBic + 0.9 * (maxBic - minBic))
+            k++;
+
+    // Representative and weight of each cluster
+    UINT64 total = 0;
+    for (UINT32 i = 0; i < n; i++)
+        total += lengths[i];
+    std::vector<UINT64> clusterLength(k, 0);
+    std::vector<INT64> closest(k, -1);
+    std::vector<double> closestDist(k, HUGE_VAL);
+    for (UINT32 i = 0; i < n; i++) {
+        const UINT32 c = bestAssignment[k][i];
+        clusterLength[c] += lengths[i];
+        const double dist = Distance2(points[i], bestCentroids[k][c]);
+        if (dist < closestDist[c]) {
+            closestDist[c] = dist;
+            closest[c] = i;
+        }
+    }
+    for (UINT32 c = 0; c < k; c++) {
+        if (closest[c] < 0)
+            continue;
+        SIMPOINT pick;
+        pick.interval = closest[c];
+        pick.cluster = picks.size();
+        pick.weight = (double)clusterLength[c] / total;
+        picks.push_back(pick);
+    }
+    std::sort(picks.begin(), picks.end());
+    return picks;
+}
+
+static inline bool WriteSimPoints(const string &prefix, const std::vector<SIMPOINT> &picks,
+                                  UINT64 intervalSize)
+{
+    std::ofstream simpoints((prefix + ".simpoints").c_str());
+    std::ofstream weights((prefix + ".weights").c_str());
+    simpoints << "# interval " << intervalSize << "\n";
+    for (UINT32 i = 0; i < picks.size(); i++) {
+        simpoints << picks[i].interval << " " << picks[i].cluster << "\n";
+        weights << picks[i].weight << " " << picks[i].cluster << "\n";
+    }
+    return simpoints.good() && weights.good();
+}
+
+/**
+ * Reads <prefix>.simpoints and <prefix>.weights; sorted by interval.
+ * `intervalSize` is the one the .simpoints header records, 0 without it.
+ **/
+static inline bool ReadSimPoints(const string &prefix, std::vector<SIMPOINT> &picks,
+                                 UINT64 &intervalSize)
+{
+    std::ifstream simpoints((prefix + ".simpoints").c_str());
+    std::ifstream weights((prefix + ".weights").c_str());
+    if (!simpoints || !weights)
+        return false;
+
+    intervalSize = 0;
+    if (simpoints.peek() == '#') {
+        string word;
+        simpoints.get();
+        if (!(simpoints >> word >> intervalSize) || word != "interval")
+            return false;
+    }
+
+    std::map<UINT32, double> weightOf;
+    double weight;
+    UINT32 interval, cluster;
+    while (weights >> weight >> cluster)
+        weightOf[cluster] = weight;
+
+    picks.clear();
+    while (simpoints >> interval >> cluster) {
+        if (weightOf.find(cluster) == weightOf.end())
+            return false;
+        SIMPOINT pick;
+        pick.interval = interval;
+        pick.cluster = cluster;
+        pick.weight = weightOf[cluster];
+        picks.push_back(pick);
+    }
+    std::sort(picks.begin(), picks.end());
+    return !picks.empty();
+}
+
+#endif // SIMPOINT_H
@@ -0,0 +1,275 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/**
+ * Binary memory reference traces, written by `cslab_cache -record` and
+ * replayed by cache_replay. Include after pin.H (or pin_compat.h) and
+ * cache_sim.h.
+ *
+ * A trace is a TRACE_HEADER followed by blocks of up to blockRefs
+ * references. Each block is a TRACE_BLOCK header and its encoded
+ * references; every block starts from address and PC 0, so blocks decode
+ * independently of each other. A reference is encoded as
+ *   - a control byte: bit 0 set for stores, bits 1-7 the access size
+ *     (TRACE_SIZE_ESCAPE: the size follows as a varint),
+ *   - the zigzag varint delta of its address from the previous address,
+ *   - the zigzag varint delta of its PC from the previous PC.
+ * Varints are little endian base 128 (7 bits per byte, MSB = more).
+ **/
+
+#include <cstdio>
+#include <cstring>
+
+#define TRACE_MAGIC "CSLABTRC"
+#define TRACE_VERSION 1
+#define TRACE_BLOCK_REFS 8192
+
+struct TRACE_HEADER
+{
+    CHAR magic[8];
+    UINT32 version;
+    UINT32 blockRefs;       // max references per block
+    UINT64 numRefs;
+    UINT64 numBlocks;
+    UINT64 numInstructions; // of the traced region, for IPC
+};
+
+struct TRACE_BLOCK
+{
+    UINT32 numRefs;
+    UINT32 bytes;           // encoded size, without this header
+};
+
+static const UINT32 TRACE_SIZE_ESCAPE = 127;
+// Worst case encoded size of one reference
+static const UINT32 TRACE_MAX_REF_BYTES = 1 + 5 + 10 + 10;
+// Most bytes decoding one reference reads, even from corrupt data
+static const UINT32 TRACE_MAX_DECODE_BYTES = 1 + 10 + 10 + 10;
+
+static inline UINT8 *TraceEncodeVarint(UINT8 *p, UINT64 v)
+{
+    while (v >= 0x80) {
+        *p++ = UINT8(v) | 0x80;
+        v >>= 7;
+    }
+    *p++ = UINT8(v);
+    return p;
+}
+
+// Reads at most 10 bytes, the most a UINT64 takes
+static inline const UINT8 *TraceDecodeVarint(const UINT8 *p, UINT64 &v)
+{
+    UINT64 b = *p++;
+    v = b;
+    if (b < 0x80) // most deltas fit in one byte
+        return p;
+    v &= 0x7f;
+    for (UINT32 shift = 7; (b & 0x80) && shift < 64; shift += 7) {
+        b = *p++;
+        v |= (b & 0x7f) << shift;
+    }
+    return p;
+}
+
+static inline UINT64 TraceZigzag(INT64 v) { return (UINT64(v) << 1) ^ UINT64(v >> 63); }
+static inline INT64 TraceUnzigzag(UINT64 v) { return INT64(v >> 1) ^ -INT64(v & 1); }
+
+/**
+ * Appends references to a trace file. Not thread safe; cslab_cache calls
+ * it with the ring lock held, in stream order.
+ **/
+class TRACE_WRITER
+{
+    private:
+    FILE *_file;
+    TRACE_HEADER _header;
+    std::vector<UINT8> _block;
+    UINT8 *_end;            // end of the encoded references in _block
+    UINT32 _blockRefs;      // references in _block
+    ADDRINT _prevAddr, _prevPc;
+
+    VOID Flush()
+    {
+        if (_blockRefs == 0)
+            return;
+        TRACE_BLOCK block;
+        block.numRefs = _blockRefs;
+        block.bytes = _end - &_block[0];
+        fwrite(&block, sizeof(block), 1, _file);
+        fwrite(&_block[0], 1, block.bytes, _file);
+
+        _header.numBlocks++;
+        _end = &_block[0];
+        _blockRefs = 0;
+        _prevAddr = _prevPc = 0;
+    }
+
+    TRACE_WRITER(const TRACE_WRITER &);            // not copyable
+    TRACE_WRITER &operator=(const TRACE_WRITER &);
+
+    public:
+    TRACE_WRITER()
+        : _file(NULL), _block(TRACE_BLOCK_REFS * TRACE_MAX_REF_BYTES),
+          _end(&_block[0]), _blockRefs(0), _prevAddr(0), _prevPc(0)
+    {
+        memset(&_header, 0, sizeof(_header));
+        memcpy(_header.magic, TRACE_MAGIC, sizeof(_header.magic));
+        _header.version = TRACE_VERSION;
+        _header.blockRefs = TRACE_BLOCK_REFS;
+    }
+    ~TRACE_WRITER() { if (_file) fclose(_file); }
+
+    bool Open(const string &path)
+    {
+        _file = fopen(path.c_str(), "wb");
+        if (!_file)
+            return false;
+        // Rewritten with the final counts by Close()
+        fwrite(&_header, sizeof(_header), 1, _file);
+        return true;
+    }
+
+    VOID Write(const MEMREF *refs, UINT64 numRefs)
+    {
+        for (UINT64 i = 0; i < numRefs; i++) {
+            const MEMREF &ref = refs[i];
+            UINT8 *p = _end;
+            const UINT32 size = ref.size < TRACE_SIZE_ESCAPE ? ref.size : TRACE_SIZE_ESCAPE;
+            *p++ = UINT8(size << 1) | (ref.type == MEMREF_STORE);
+            if (size == TRACE_SIZE_ESCAPE)
+                p = TraceEncodeVarint(p, ref.size);
+            p = TraceEncodeVarint(p, TraceZigzag(INT64(ref.addr - _prevAddr)));
+            p = TraceEncodeVarint(p, TraceZigzag(INT64(ref.pc - _prevPc)));
+            _end = p;
+            _prevAddr = ref.addr;
+            _prevPc = ref.pc;
+
+            if (++_blockRefs == TRACE_BLOCK_REFS)
+                Flush();
+        }
+        _header.numRefs += numRefs;
+    }
+
+    VOID Close(UINT64 numInstructions)
+    {
+        if (!_file)
+            return;
+        Flush();
+        _header.numInstructions = numInstructions;
+        fseek(_file, 0, SEEK_SET);
+        fwrite(&_header, sizeof(_header), 1, _file);
+        fclose(_file);
+        _file = NULL;
+    }
+
+    UINT64 NumRefs() const { return _header.numRefs; }
+};
+
+/**
+ * Decodes a trace held in memory (e.g. mmap()ed) block by block.
+ **/
+class TRACE_READER
+{
+    private:
+    const UINT8 *_data;
+    UINT64 _size;
+    UINT64 _offset;         // of the next block
+    TRACE_HEADER _header;
+
+    // Decodes the reference at `p` into `ref`, returns the byte after it
+    static const UINT8 *DecodeRef(const UINT8 *p, ADDRINT &addr, ADDRINT &pc, MEMREF &ref)
+    {
+        UINT64 v, size;
+        const UINT32 ctrl = *p++;
+        size = ctrl >> 1;
+        if (size == TRACE_SIZE_ESCAPE)
+            p = TraceDecodeVarint(p, size);
+        p = TraceDecodeVarint(p, v);
+        addr += TraceUnzigzag(v);
+        p = TraceDecodeVarint(p, v);
+        pc += TraceUnzigzag(v);
+
+        ref.addr = addr;
+        ref.pc = pc;
+        ref.size = size;
+        ref.type = (ctrl & 1) ? MEMREF_STORE : MEMREF_LOAD;
+        return p;
+    }
+
+    public:
+    TRACE_READER() : _data(NULL), _size(0), _offset(0) {}
+
+    // Returns false if `data` does not start with a valid trace header.
+    bool Init(const VOID *data, UINT64 size)
+    {
+        if (size < sizeof(TRACE_HEADER))
+            return false;
+        memcpy(&_header, data, sizeof(_header));
+        if (memcmp(_header.magic, TRACE_MAGIC, sizeof(_header.magic)) != 0 ||
+            _header.version != TRACE_VERSION)
+            return false;
+        _data = static_cast<const UINT8 *>(data);
+        _size = size;
+        Rewind();
+        return true;
+    }
+
+    const TRACE_HEADER &Header() const { return _header; }
+
+    VOID Rewind() { _offset = sizeof(TRACE_HEADER); }
+
+    // Position of the next block, to come back to it with Seek()
+    UINT64 Offset() const { return _offset; }
+    VOID Seek(UINT64 offset) { _offset = offset; }
+
+    // Moves past the next block without decoding it; false at the end.
+    bool SkipBlock()
+    {
+        TRACE_BLOCK block;
+        if (_offset + sizeof(block) > _size)
+            return false;
+        memcpy(&block, _data + _offset, sizeof(block));
+        _offset += sizeof(block) + block.bytes;
+        return true;
+    }
+
+    /**
+     * Decodes the next block into `refs` (room for Header().blockRefs
+     * references) and returns its number of references, 0 at the end of
+     * the trace (or at a truncated or corrupt block).
+     **/
+    UINT32 NextBlock(MEMREF *refs)
+    {
+        TRACE_BLOCK block;
+        if (_offset + sizeof(block) > _size)
+            return 0;
+        memcpy(&block, _data + _offset, sizeof(block));
+        if (block.numRefs > _header.blockRefs ||
+            _offset + sizeof(block) + block.bytes > _size)
+            return 0;
+
+        const UINT8 *p = _data + _offset + sizeof(block);
+        const UINT8 *end = p + block.bytes;
+        ADDRINT addr = 0, pc = 0;
+        UINT32 i = 0;
+        // Far from the end of the block no reference can read past it
+        for (; i < block.numRefs && end - p >= TRACE_MAX_DECODE_BYTES; i++)
+            p = DecodeRef(p, addr, pc, refs[i]);
+        // The last ones decode from a zero padded copy
+        for (; i < block.numRefs; i++) {
+            if (p >= end)
+                return 0;
+            UINT8 tail[TRACE_MAX_DECODE_BYTES];
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, p, end - p);
+            p += DecodeRef(tail, addr, pc, refs[i]) - tail;
+        }
+        if (p > end)
+            return 0;
+
+        _offset += sizeof(block) + block.bytes;
+        return block.numRefs;
+    }
+};
+
+#endif // TRACE_H
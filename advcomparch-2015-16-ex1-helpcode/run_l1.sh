@@ -16,8 +16,21 @@ L2size=1024
 L2assoc=8
 L2bsize=128
 
+## Set to 1 to simulate all CONFS in one Pin run per benchmark (-cfg).
+## The output files are named the same way.
+SINGLE_RUN=0
+
 for BENCH in $@; do
 	cmd=$(cat ${CMDS_FILE} | grep "$BENCH")
+if [ "$SINGLE_RUN" = "1" ]; then
+	cfgs=""
+	for conf in $CONFS; do
+		cfgs="$cfgs -cfg ${conf}:${L2size}_${L2assoc}_${L2bsize}"
+	done
+	pin_cmd="$PIN_EXE -t $PIN_TOOL -o $outDir/$BENCH.dcache_cslab.out $cfgs -- $cmd"
+	$pin_cmd
+	continue
+fi
 for conf in $CONFS; do
 	## Get parameters
     size=$(echo $conf | cut -d'_' -f1)
@@ -7,12 +7,23 @@
 #include "branch_predictor.h"
 #include "pentium_m_predictor/pentium_m_branch_predictor.h"
 #include "ras.h"
+#include "simpoint.h"
 
 /* ===================================================================== */
 /* Commandline Switches                                                  */
 /* ===================================================================== */
 KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE,    "pintool",
         "o", "cslab_branch.out", "specify output file name");
+KNOB<BOOL> KnobBbvProfile(KNOB_MODE_WRITEONCE, "pintool",
+        "bbv_profile", "0", "profile basic block vectors instead of simulating, and pick the SimPoints (<o>.bb, <o>.simpoints, <o>.weights)");
+KNOB<UINT64> KnobBbvInterval(KNOB_MODE_WRITEONCE, "pintool",
+        "bbv_interval", "100000000", "instructions of each interval (with -bbv_profile, and -simpoints, which checks it against <prefix>.simpoints)");
+KNOB<UINT32> KnobSimPointMaxK(KNOB_MODE_WRITEONCE, "pintool",
+        "simpoint_maxk", "10", "most SimPoints to pick (with -bbv_profile)");
+KNOB<string> KnobSimPoints(KNOB_MODE_WRITEONCE, "pintool",
+        "simpoints", "", "simulate the -bbv_interval intervals of <prefix>.simpoints only, weighted by <prefix>.weights");
+KNOB<UINT64> KnobSimPointWarming(KNOB_MODE_WRITEONCE, "pintool",
+        "simpoint_warming", "1000000", "instructions of predictor warming before each SimPoint (with -simpoints)");
 /* ===================================================================== */
 
 /* ===================================================================== */
@@ -32,6 +43,33 @@ typedef std::vector<RAS *>::iterator ras_vec_iterator_t;
 UINT64 total_instructions;
 std::ofstream outFile;
 
+BBV_PROFILER *bbv_profiler;
+
+/**
+ * SimPoint mode (-simpoints): the ROI is fast-forwarded (instructions
+ * counted, predictors untouched) up to each picked interval, the
+ * predictors are warmed for -simpoint_warming instructions, then the
+ * interval is measured. Each counter is estimated from its per-instruction
+ * rates in the intervals, weighted by the SimPoint weights and scaled to
+ * the ROI instructions, so the report reads like a full run.
+ **/
+enum {
+    PHASE_FAST_FORWARD = 0,
+    PHASE_WARMING,
+    PHASE_DETAILED
+};
+
+std::vector<SIMPOINT> simpoints;
+UINT32 next_simpoint;
+UINT32 sample_phase;
+UINT64 phase_end;       // instruction count at which sample_phase ends
+
+UINT64 window_instructions;           // at the start of the interval
+std::vector<UINT64> window_counters;  // at the start of the interval
+std::vector<double> simpoint_rates;   // weighted counters per instruction
+double simpoint_weight;
+UINT32 simpoints_simulated;
+
 /* ===================================================================== */
 
 INT32 Usage()
@@ -117,10 +155,197 @@ VOID Instruction(INS ins, void * v)
     INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)count_instruction, IARG_END);
 }
 
+/* ===================================================================== */
+/* SimPoints                                                             */
+/* ===================================================================== */
+
+/**
+ * All reported counters, in report order: RAS correct/incorrect,
+ * predictors correct/incorrect, BTBs correct/incorrect/target
+ * incorrect/target correct.
+ **/
+VOID ReadCounters(std::vector<UINT64> &counters)
+{
+    counters.clear();
+    for (ras_vec_iterator_t it = ras_vec.begin(); it != ras_vec.end(); ++it) {
+        counters.push_back((*it)->getNumCorrect());
+        counters.push_back((*it)->getNumIncorrect());
+    }
+    for (bp_iterator_t it = branch_predictors.begin(); it != branch_predictors.end(); ++it) {
+        counters.push_back((*it)->getNumCorrectPredictions());
+        counters.push_back((*it)->getNumIncorrectPredictions());
+    }
+    for (btb_iterator_t it = btb_predictors.begin(); it != btb_predictors.end(); ++it) {
+        counters.push_back((*it)->getNumCorrectPredictions());
+        counters.push_back((*it)->getNumIncorrectPredictions());
+        counters.push_back((*it)->getNumInorrectTargetPredictions());
+        counters.push_back((*it)->getNumCorrectTargetPredictions());
+    }
+}
+
+// Instruction count at which the warming of the next SimPoint starts
+UINT64 NextSimPoint()
+{
+    if (next_simpoint == simpoints.size())
+        return ~0ULL;
+    const UINT64 begin = simpoints[next_simpoint].interval * KnobBbvInterval.Value();
+    return begin > KnobSimPointWarming.Value() ? begin - KnobSimPointWarming.Value() : 0;
+}
+
+VOID NextPhase()
+{
+    // Phases may be shorter than a basic block, or empty
+    do {
+        switch (sample_phase) {
+            case PHASE_FAST_FORWARD:
+                sample_phase = PHASE_WARMING;
+                phase_end = simpoints[next_simpoint].interval * KnobBbvInterval.Value();
+                break;
+
+            case PHASE_WARMING:
+                window_instructions = total_instructions;
+                ReadCounters(window_counters);
+                sample_phase = PHASE_DETAILED;
+                phase_end += KnobBbvInterval.Value();
+                break;
+
+            case PHASE_DETAILED: {
+                const UINT64 instructions = total_instructions - window_instructions;
+                const double weight = simpoints[next_simpoint].weight;
+                std::vector<UINT64> counters;
+                ReadCounters(counters);
+                if (instructions) {
+                    simpoint_rates.resize(counters.size());
+                    for (UINT32 i = 0; i < counters.size(); i++)
+                        simpoint_rates[i] += weight * (counters[i] - window_counters[i]) / instructions;
+                    simpoint_weight += weight;
+                    simpoints_simulated++;
+                }
+                next_simpoint++;
+                sample_phase = PHASE_FAST_FORWARD;
+                phase_end = NextSimPoint();
+                break;
+            }
+        }
+    } while (total_instructions >= phase_end);
+}
+
+// Counts the instructions of a basic block; true at the end of a phase
+ADDRINT CountBlock(UINT32 numInstructions)
+{
+    total_instructions += numInstructions;
+    return total_instructions >= phase_end;
+}
+
+// Whether branches go to the predictors
+ADDRINT Simulating()
+{
+    return sample_phase != PHASE_FAST_FORWARD;
+}
+
+VOID SimPointTrace(TRACE trace, VOID *v)
+{
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)) {
+        BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR)CountBlock,
+                         IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+        BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR)NextPhase, IARG_END);
+    }
+}
+
+VOID SimPointInstruction(INS ins, void * v)
+{
+    if (INS_Category(ins) == XED_CATEGORY_COND_BR) {
+        INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)Simulating, IARG_END);
+        INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)cond_branch_instruction,
+                IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN,
+                IARG_END);
+    } else if (INS_IsCall(ins)) {
+        INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)Simulating, IARG_END);
+        INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)call_instruction,
+                IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR,
+                IARG_UINT32, INS_Size(ins), IARG_END);
+    } else if (INS_IsRet(ins)) {
+        INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)Simulating, IARG_END);
+        INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)ret_instruction,
+                IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_END);
+    }
+
+    if (INS_IsBranch(ins) && !INS_IsRet(ins)) {
+        INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)Simulating, IARG_END);
+        INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)branch_instruction,
+                IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN,
+                IARG_END);
+    }
+}
+
+/* ===================================================================== */
+/* Basic block vector profiling                                          */
+/* ===================================================================== */
+
+ADDRINT BbvCount(UINT32 id, UINT32 numInstructions)
+{
+    total_instructions += numInstructions;
+    return bbv_profiler->Count(id, numInstructions);
+}
+
+VOID BbvEndInterval()
+{
+    bbv_profiler->EndInterval();
+}
+
+VOID BbvTrace(TRACE trace, VOID *v)
+{
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)) {
+        BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR)BbvCount,
+                         IARG_UINT32, bbv_profiler->BlockId(BBL_Address(bbl)),
+                         IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+        BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR)BbvEndInterval, IARG_END);
+    }
+}
+
+// Writes <prefix>.bb, picks the SimPoints and writes them
+VOID BbvReport(const string &prefix)
+{
+    bbv_profiler->EndInterval();
+
+    std::ofstream bb((prefix + ".bb").c_str());
+    bbv_profiler->WriteBbv(bb);
+    const std::vector<SIMPOINT> picks = PickSimPoints(*bbv_profiler, KnobSimPointMaxK.Value());
+    WriteSimPoints(prefix, picks, bbv_profiler->IntervalSize());
+
+    outFile << "Total Instructions: " << total_instructions << "\n";
+    outFile << "\n";
+    outFile << "BBV Profile: " << bbv_profiler->Intervals().size() << " intervals of "
+        << KnobBbvInterval.Value() << " instructions\n";
+    outFile << "SimPoints: (Interval - Cluster - Weight)\n";
+    for (UINT32 i = 0; i < picks.size(); i++)
+        outFile << "  " << picks[i].interval << " " << picks[i].cluster << " "
+            << picks[i].weight << "\n";
+}
+
 /* ===================================================================== */
 
 VOID Fini(int code, VOID * v)
 {
+    if (bbv_profiler) {
+        string prefix = KnobOutputFile.Value();
+        if (prefix.size() > 4 && prefix.compare(prefix.size() - 4, 4, ".out") == 0)
+            prefix.erase(prefix.size() - 4);
+        BbvReport(prefix);
+        outFile.close();
+        return;
+    }
+
+    // The counters of the run, or their SimPoint estimates for the ROI
+    std::vector<UINT64> counters;
+    ReadCounters(counters);
+    if (!simpoints.empty()) {
+        for (UINT32 i = 0; i < counters.size(); i++)
+            counters[i] = simpoint_weight > 0 ?
+                (UINT64)(simpoint_rates[i] / simpoint_weight * total_instructions + 0.5) : 0;
+    }
+    std::vector<UINT64>::const_iterator c = counters.begin();
+
     bp_iterator_t bp_it;
     btb_iterator_t btb_it;
     ras_vec_iterator_t ras_it;
@@ -129,9 +354,20 @@ VOID Fini(int code, VOID * v)
     outFile << "Total Instructions: " << total_instructions << "\n";
     outFile << "\n";
 
+    if (!simpoints.empty()) {
+        // Weighted over the SimPoints reached, in case the ROI ended
+        // earlier than when profiled
+        outFile << "SimPoints: " << simpoints_simulated << " of " << simpoints.size()
+            << " intervals of " << KnobBbvInterval.Value() << " instructions, "
+            << KnobSimPointWarming.Value() << " warming, total weight "
+            << simpoint_weight << "\n";
+        outFile << "\n";
+    }
+
     for (ras_it = ras_vec.begin(); ras_it != ras_vec.end(); ++ras_it) {
         RAS *ras = *ras_it;
-        outFile << ras->getNameAndStats() << "\n";
+        outFile << "RAS (" << ras->getNumEntries() << " entries): " << c[0] << " " << c[1] << "\n";
+        c += 2;
     }
     outFile << "\n";
 
@@ -139,8 +375,8 @@ VOID Fini(int code, VOID * v)
     for (bp_it = branch_predictors.begin(); bp_it != branch_predictors.end(); ++bp_it) {
         BranchPredictor *curr_predictor = *bp_it;
         outFile << "  " << curr_predictor->getName() << ": "
-            << curr_predictor->getNumCorrectPredictions() << " "
-            << curr_predictor->getNumIncorrectPredictions() << "\n";
+            << c[0] << " " << c[1] << "\n";
+        c += 2;
     }
     outFile << "\n";
 
@@ -148,10 +384,19 @@ VOID Fini(int code, VOID * v)
     for (btb_it = btb_predictors.begin(); btb_it != btb_predictors.end(); ++btb_it) {
         BTBPredictor *curr_predictor = *btb_it;
         outFile << "  " << curr_predictor->getName() << ": "
-            << curr_predictor->getNumCorrectPredictions() << " "
-            << curr_predictor->getNumIncorrectPredictions() << " | "
-            << curr_predictor->getNumInorrectTargetPredictions() << " | "
-            << curr_predictor->getNumCorrectTargetPredictions() << "\n";
+            << c[0] << " " << c[1] << " | " << c[2] << " | " << c[3] << "\n";
+        c += 4;
+    }
+
+    if (!simpoints.empty()) {
+        outFile << "\n";
+        outFile << "Branch Predictor Accuracy (weighted):\n";
+        c = counters.begin() + 2 * ras_vec.size();
+        for (bp_it = branch_predictors.begin(); bp_it != branch_predictors.end(); ++bp_it) {
+            outFile << "  " << (*bp_it)->getName() << ": "
+                << (c[0] + c[1] ? (double)c[0] / (c[0] + c[1]) : 0) << "\n";
+            c += 2;
+        }
     }
 
     outFile.close();
@@ -159,6 +404,16 @@ VOID Fini(int code, VOID * v)
 
 VOID roi_begin()
 {
+    if (bbv_profiler) {
+        TRACE_AddInstrumentFunction(BbvTrace, 0);
+        return;
+    }
+    if (!simpoints.empty()) {
+        phase_end = NextSimPoint();
+        TRACE_AddInstrumentFunction(SimPointTrace, 0);
+        INS_AddInstrumentFunction(SimPointInstruction, 0);
+        return;
+    }
     INS_AddInstrumentFunction(Instruction, 0);
 }
 
@@ -278,6 +533,24 @@ int main(int argc, char *argv[])
     if(PIN_Init(argc,argv))
         return Usage();
 
+    UINT64 simpointInterval = 0;
+    if (!KnobSimPoints.Value().empty() &&
+        !ReadSimPoints(KnobSimPoints.Value(), simpoints, simpointInterval)) {
+        cerr << "Error: could not read " << KnobSimPoints.Value() << ".simpoints/.weights" << endl;
+        return 1;
+    }
+    if (simpointInterval && simpointInterval != KnobBbvInterval.Value()) {
+        cerr << "Error: " << KnobSimPoints.Value() << ".simpoints has intervals of "
+             << simpointInterval << " instructions, not -bbv_interval " << KnobBbvInterval.Value() << endl;
+        return Usage();
+    }
+    if (KnobBbvInterval.Value() == 0 || (KnobBbvProfile.Value() && !simpoints.empty())) {
+        cerr << "Error: -bbv_profile and -simpoints are exclusive, -bbv_interval must be positive" << endl;
+        return Usage();
+    }
+    if (KnobBbvProfile.Value())
+        bbv_profiler = new BBV_PROFILER(KnobBbvInterval.Value());
+
     // Open output file
     outFile.open(KnobOutputFile.Value().c_str());
 
@@ -31,12 +31,9 @@ public:
             incorrect++;
     }
 
-    string getNameAndStats() { 
-        std::ostringstream stream;
-        stream << "RAS (" << max_entries << " entries): " << correct <<
-                                                      " " << incorrect;
-        return stream.str(); 
-    };
+    UINT32 getNumEntries() { return max_entries; }
+    UINT64 getNumCorrect() { return correct; }
+    UINT64 getNumIncorrect() { return incorrect; }
 
 private:
     UINT32 max_entries;